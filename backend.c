@@ -0,0 +1,119 @@
+/*
+ * backend.c - Load allocators from shared objects with dlopen.
+ *
+ * Each object is opened RTLD_LOCAL, so several mm.c variants with the
+ * same symbol names can be loaded side by side. An mm variant gets its
+ * heap from mdriver's memlib (mdriver is linked with -rdynamic), which
+ * is what lets the driver measure its utilization.
+ *
+ * dlsym on a handle also searches the object's dependencies, so asking
+ * a library without its own malloc for "malloc" returns libc's. Every
+ * symbol is therefore checked to come from the object itself.
+ */
+#define _GNU_SOURCE /* for dladdr and dlinfo */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dlfcn.h>
+#include <link.h>
+
+#include "backend.h"
+
+static char errbuf[1024];  /* reason the last backend_load failed */
+
+/*
+ * own_sym - look up name in the object behind handle, and only there
+ */
+static void *own_sym(void *handle, struct link_map *map, char *name)
+{
+	void *sym;
+	Dl_info info;
+
+	if ((sym = dlsym(handle, name)) == NULL)
+		return NULL;
+	if (dladdr(sym, &info) == 0 || info.dli_fname == NULL ||
+			strcmp(info.dli_fname, map->l_name) != 0)
+		return NULL;
+	return sym;
+}
+
+/*
+ * backend_name - the label for spec: the part before '=', or else the
+ *     file name without its directory and ".so" (or ".so.6" and such)
+ */
+static char *backend_name(char *spec, char **path)
+{
+	char *eq, *base, *ext;
+	size_t len;
+
+	if ((eq = strchr(spec, '=')) != NULL && eq != spec) {
+		*path = eq + 1;
+		return strndup(spec, eq - spec);
+	}
+	*path = spec;
+	base = strrchr(spec, '/') ? strrchr(spec, '/') + 1 : spec;
+	ext = strstr(base, ".so");
+	len = (ext != NULL && ext != base) ? (size_t)(ext - base) : strlen(base);
+	return strndup(base, len);
+}
+
+/*
+ * backend_load - open the object named by spec and find its allocator
+ */
+int backend_load(backend_t *b, char *spec)
+{
+	struct link_map *map;
+	char *path;
+
+	memset(b, 0, sizeof(*b));
+	if ((b->name = backend_name(spec, &path)) == NULL || *path == '\0') {
+		snprintf(errbuf, sizeof(errbuf), "%s: no shared object given", spec);
+		return -1;
+	}
+
+	/* A name without a slash would be looked up on the library path */
+	if ((b->handle = dlopen(path, RTLD_NOW | RTLD_LOCAL)) == NULL) {
+		snprintf(errbuf, sizeof(errbuf), "%s", dlerror());
+		return -1;
+	}
+	if (dlinfo(b->handle, RTLD_DI_LINKMAP, &map) != 0) {
+		snprintf(errbuf, sizeof(errbuf), "%s", dlerror());
+		dlclose(b->handle);
+		return -1;
+	}
+
+	/* Prefer the mm interface, so the heap comes from memlib */
+	if ((b->init = (int (*)(void))own_sym(b->handle, map, "mm_init")) != NULL) {
+		b->malloc = (void *(*)(size_t))own_sym(b->handle, map, "mm_malloc");
+		b->free = (void (*)(void *))own_sym(b->handle, map, "mm_free");
+		b->realloc = (void *(*)(void *, size_t))own_sym(b->handle, map, "mm_realloc");
+		if (b->malloc == NULL || b->free == NULL || b->realloc == NULL) {
+			snprintf(errbuf, sizeof(errbuf),
+					"%s: has mm_init but not mm_malloc, mm_free and mm_realloc", path);
+			dlclose(b->handle);
+			return -1;
+		}
+		b->malloc_hint = (void *(*)(size_t, int))own_sym(b->handle, map, "mm_malloc_hint");
+		return 0;
+	}
+
+	b->malloc = (void *(*)(size_t))own_sym(b->handle, map, "malloc");
+	b->free = (void (*)(void *))own_sym(b->handle, map, "free");
+	b->realloc = (void *(*)(void *, size_t))own_sym(b->handle, map, "realloc");
+	if (b->malloc == NULL || b->free == NULL || b->realloc == NULL) {
+		snprintf(errbuf, sizeof(errbuf),
+				"%s: defines neither mm_init, mm_malloc, mm_free and mm_realloc"
+				" nor malloc, free and realloc", path);
+		dlclose(b->handle);
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * backend_error - why the last backend_load failed
+ */
+char *backend_error(void)
+{
+	return errbuf;
+}
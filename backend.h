@@ -0,0 +1,34 @@
+#ifndef __BACKEND_H_
+#define __BACKEND_H_
+
+/*
+ * backend.h - Allocators that mdriver runs on the traces: the mm
+ *             package linked into it, libc malloc, and shared objects
+ *             loaded with dlopen (--alloc).
+ */
+#include <stddef.h>
+
+/* An allocator the driver calls only through these pointers */
+typedef struct {
+	char *name;                          /* label in tables and results */
+	int (*init)(void);                   /* mm_init; NULL for the malloc interface */
+	void *(*malloc)(size_t size);
+	void (*free)(void *ptr);
+	void *(*realloc)(void *ptr, size_t size);
+	void *handle;                        /* from dlopen; NULL if linked in */
+	void *(*malloc_hint)(size_t size, int hint); /* mm_malloc_hint, or NULL */
+} backend_t;
+
+/*
+ * Load the allocator described by spec, "name=path" or just "path"
+ * (named after the file). The object's own mm_init, mm_malloc, mm_free
+ * and mm_realloc are used if it has them, else its malloc, free and
+ * realloc. An mm_malloc_hint is picked up too if the object has one.
+ * Returns 0, or -1 with the reason in backend_error().
+ */
+int backend_load(backend_t *b, char *spec);
+
+/* Why the last backend_load failed */
+char *backend_error(void);
+
+#endif /* __BACKEND_H_ */
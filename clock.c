@@ -8,6 +8,8 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
 #include <unistd.h>
 #include <sys/times.h>
 #include "clock.h"
@@ -21,55 +23,95 @@
  * You can verify this for yourself using gcc -v.
  *******************************************************/
 
-#if defined(__i386__)  
+#if defined(__i386__) || defined(__x86_64__)
 /*******************************************************
- * Pentium versions of start_counter() and get_counter()
+ * x86 versions of start_counter() and get_counter()
+ *
+ * The time stamp counter is kept as one 64-bit value, so it doesn't
+ * need the double precision subtraction of the old 32-bit halves.
+ * The start reading is fenced so it can't be taken before earlier
+ * instructions finish; the end reading uses rdtscp, which waits for
+ * the timed code, and a fence so later code can't start early.
  *******************************************************/
-
+#include <cpuid.h>
 
 /* $begin x86cyclecounter */
 /* Initialize the cycle counter */
-static unsigned cyc_hi = 0;
-static unsigned cyc_lo = 0;
+static unsigned long long cyc_start = 0;
+static int has_rdtscp = -1;  /* -1 until cpuid has been asked */
+
+/* Does the CPU have rdtscp (cpuid 0x80000001, EDX bit 27)? */
+static int rdtscp_ok(void)
+{
+	unsigned a, b, c, d;
+
+	if (has_rdtscp < 0)
+		has_rdtscp = __get_cpuid(0x80000001, &a, &b, &c, &d) && (d & (1u << 27));
+	return has_rdtscp;
+}
+
+/* Read the counter after all earlier instructions have finished */
+static inline unsigned long long counter_start(void)
+{
+	unsigned hi, lo;
 
+	asm volatile("lfence; rdtsc" : "=a" (lo), "=d" (hi) : : "memory");
+	return ((unsigned long long)hi << 32) | lo;
+}
 
-/* Set *hi and *lo to the high and low order bits  of the cycle counter.  
-	Implementation requires assembly code to use the rdtsc instruction. */
-void access_counter(unsigned *hi, unsigned *lo)
+/* Read the counter before any later instruction starts */
+static inline unsigned long long counter_end(void)
 {
-	asm("rdtsc; movl %%edx,%0; movl %%eax,%1"   /* Read cycle counter */
-			: "=r" (*hi), "=r" (*lo)                /* and move results to */
-			: /* No input */                        /* the two outputs */
-			: "%edx", "%eax");
+	unsigned hi, lo, aux;
+
+	if (rdtscp_ok())
+		asm volatile("rdtscp; lfence" : "=a" (lo), "=d" (hi), "=c" (aux) : : "memory");
+	else
+		asm volatile("lfence; rdtsc; lfence" : "=a" (lo), "=d" (hi) : : "memory");
+	return ((unsigned long long)hi << 32) | lo;
 }
 
 /* Record the current value of the cycle counter. */
 void start_counter()
 {
-	access_counter(&cyc_hi, &cyc_lo);
+	rdtscp_ok();
+	cyc_start = counter_start();
 }
 
 /* Return the number of cycles since the last call to start_counter. */
 double get_counter()
 {
-	unsigned ncyc_hi, ncyc_lo;
-	unsigned hi, lo, borrow;
-	double result;
-
-	/* Get cycle counter */
-	access_counter(&ncyc_hi, &ncyc_lo);
+	return (double)(counter_end() - cyc_start);
+}
+/* $end x86cyclecounter */
 
-	/* Do double precision subtraction */
-	lo = ncyc_lo - cyc_lo;
-	borrow = lo > ncyc_lo;
-	hi = ncyc_hi - cyc_hi - borrow;
-	result = (double) hi * (1 << 30) * 4 + lo;
-	if (result < 0) {
-		fprintf(stderr, "Error: counter returns neg value: %.0f\n", result);
+/*
+ * tsc_invariant - The TSC ticks at a constant rate through frequency
+ *     changes and sleep states if cpuid 0x80000007 says so (EDX bit 8).
+ *     Hypervisors often hide that leaf, so the kernel's constant_tsc
+ *     and nonstop_tsc flags, which mean the same together, also count.
+ */
+int tsc_invariant(void)
+{
+	unsigned a, b, c, d;
+	char line[4096];
+	int constant = 0, nonstop = 0;
+	FILE *fp;
+
+	if (__get_cpuid(0x80000007, &a, &b, &c, &d) && (d & (1u << 8)))
+		return 1;
+	if ((fp = fopen("/proc/cpuinfo", "r")) == NULL)
+		return 0;
+	while (fgets(line, sizeof(line), fp) != NULL) {
+		if (strncmp(line, "flags", 5) != 0)
+			continue;
+		constant = strstr(line, " constant_tsc") != NULL;
+		nonstop = strstr(line, " nonstop_tsc") != NULL;
+		break;
 	}
-	return result;
+	fclose(fp);
+	return constant && nonstop;
 }
-/* $end x86cyclecounter */
 
 #elif defined(__alpha)
 
@@ -133,6 +175,12 @@ double get_counter()
 	return result;
 }
 
+/* The Alpha counter counts only the cycles of this process */
+int tsc_invariant(void)
+{
+	return 0;
+}
+
 #else
 
 /****************************************************************
@@ -147,7 +195,7 @@ void start_counter()
 {
 	printf("ERROR: You are trying to use a start_counter routine in clock.c\n");
 	printf("that has not been implemented yet on this platform.\n");
-	printf("Please choose another timing package in config.h.\n");
+	printf("Please choose another timer with --timer.\n");
 	exit(1);
 }
 
@@ -155,9 +203,14 @@ double get_counter()
 {
 	printf("ERROR: You are trying to use a get_counter routine in clock.c\n");
 	printf("that has not been implemented yet on this platform.\n");
-	printf("Please choose another timing package in config.h.\n");
+	printf("Please choose another timer with --timer.\n");
 	exit(1);
 }
+
+int tsc_invariant(void)
+{
+	return 0;
+}
 #endif
 
 
@@ -195,10 +248,54 @@ double mhz_full(int verbose, int sleeptime)
 }
 /* $end mhz */
 
-/* Version using a default sleeptime */
+#define CAL_ROUNDS 5          /* calibration rounds; the median is kept */
+#define CAL_NSECS  10000000   /* length of each round: 10 ms */
+
+static double nsecs_raw(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static int cmp_rate(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+
+	return (x > y) - (x < y);
+}
+
+/*
+ * mhz_quick - Estimate the clock rate by spinning against
+ *     CLOCK_MONOTONIC_RAW, which NTP doesn't slew. An interrupt can
+ *     stretch one round, so the median of CAL_ROUNDS rounds is kept.
+ *     This takes 50 ms where mhz_full sleeps for seconds.
+ */
+double mhz_quick(int verbose)
+{
+	double rate[CAL_ROUNDS], t0, t1, c;
+	int i;
+
+	for (i = 0; i < CAL_ROUNDS; i++) {
+		t0 = nsecs_raw();
+		start_counter();
+		do {
+			t1 = nsecs_raw();
+		} while (t1 - t0 < CAL_NSECS);
+		c = get_counter();
+		rate[i] = c / ((t1 - t0) / 1e3);
+	}
+	qsort(rate, CAL_ROUNDS, sizeof(double), cmp_rate);
+	if (verbose)
+		printf("Processor clock rate ~= %.1f MHz\n", rate[CAL_ROUNDS / 2]);
+	return rate[CAL_ROUNDS / 2];
+}
+
+/* Version using the quick calibration */
 double mhz(int verbose)
 {
-	return mhz_full(verbose, 2);
+	return mhz_quick(verbose);
 }
 
 /** Special counters that compensate for timer interrupt overhead */
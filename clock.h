@@ -1,3 +1,6 @@
+#ifndef __CLOCK_H_
+#define __CLOCK_H_
+
 /* Routines for using cycle counter */
 
 /* Start the counter */
@@ -6,12 +9,19 @@ void start_counter();
 /* Get # cycles since counter started */
 double get_counter();
 
+/* Does the counter tick at a constant rate, even when the CPU idles
+   or changes speed? */
+int tsc_invariant(void);
+
 /* Measure overhead for counter */
 double ovhd();
 
-/* Determine clock rate of processor (using a default sleeptime) */
+/* Determine clock rate of processor (using the quick calibration) */
 double mhz(int verbose);
 
+/* Determine clock rate of processor in 50 ms, against CLOCK_MONOTONIC_RAW */
+double mhz_quick(int verbose);
+
 /* Determine clock rate of processor, having more control over accuracy */
 double mhz_full(int verbose, int sleeptime);
 
@@ -20,3 +30,5 @@ double mhz_full(int verbose, int sleeptime);
 void start_comp_counter();
 
 double get_comp_counter();
+
+#endif /* __CLOCK_H_ */
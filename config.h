@@ -62,11 +62,16 @@
  */
 #define MAX_HEAP (20*(1<<20))  /* 20 MB */
 
+/*
+ * Address space reserved for the heap when mm.c is the process
+ * allocator (libmm.so), and how much of it is made usable at a time
+ */
+#define SYS_MAX_HEAP   (512*(1<<20))  /* 512 MB */
+#define SYS_HEAP_CHUNK (1<<20)        /* 1 MB */
+
 /*****************************************************************************
- * Set exactly one of these USE_xxx constants to "1" to select a timing method
+ * The timing method is chosen when mdriver runs (--timer, see fsecs.h):
+ * the invariant TSC where the CPU has one, else clock_gettime()
  *****************************************************************************/
-#define USE_FCYC   0   /* cycle counter w/K-best scheme (x86 & Alpha only) */
-#define USE_ITIMER 0   /* interval timer (any Unix box) */
-#define USE_GETTOD 1   /* gettimeofday (any Unix box) */
 
 #endif /* __CONFIG_H */
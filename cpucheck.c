@@ -0,0 +1,105 @@
+/*
+ * cpucheck.c - CPU affinity and frequency scaling checks.
+ *
+ * The frequency checks read the Linux cpufreq files in sysfs. A file
+ * that is missing (no cpufreq driver, a VM, another OS) means there is
+ * nothing we can check, so it is not reported.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <sched.h>
+
+#include "cpucheck.h"
+
+#define SYSFS_CPU "/sys/devices/system/cpu"
+
+static int read_line(char *path, char *buf, int size);
+
+/*
+ * pin_to_cpu - restrict the calling process to one CPU
+ */
+int pin_to_cpu(int cpu)
+{
+#ifdef __linux__
+	cpu_set_t mask;
+
+	if (cpu < 0 || cpu >= CPU_SETSIZE) {
+		errno = EINVAL;
+		return -1;
+	}
+	CPU_ZERO(&mask);
+	CPU_SET(cpu, &mask);
+	return sched_setaffinity(0, sizeof(mask), &mask);
+#else
+	errno = ENOSYS;
+	return -1;
+#endif
+}
+
+/*
+ * check_cpu_frequency - warn about dynamic frequency scaling
+ */
+int check_cpu_frequency(int cpu)
+{
+	char path[128], buf[64], max[64];
+	int warnings = 0;
+
+#ifdef __linux__
+	if (cpu < 0)
+		cpu = sched_getcpu();
+#endif
+	if (cpu < 0)
+		return 0;
+
+	sprintf(path, SYSFS_CPU "/cpu%d/cpufreq/scaling_governor", cpu);
+	if (read_line(path, buf, sizeof(buf)) == 0 && strcmp(buf, "performance") != 0) {
+		printf("Warning: CPU %d uses the \"%s\" cpufreq governor; "
+				"timings may vary with its clock speed\n", cpu, buf);
+		warnings++;
+	}
+
+	/* A governor can be "performance" with a range the clock still moves in */
+	sprintf(path, SYSFS_CPU "/cpu%d/cpufreq/scaling_min_freq", cpu);
+	if (read_line(path, buf, sizeof(buf)) == 0) {
+		sprintf(path, SYSFS_CPU "/cpu%d/cpufreq/scaling_max_freq", cpu);
+		if (read_line(path, max, sizeof(max)) == 0 && strcmp(buf, max) != 0) {
+			printf("Warning: CPU %d may run anywhere from %s to %s kHz\n",
+					cpu, buf, max);
+			warnings++;
+		}
+	}
+
+	/* Turbo: intel_pstate has no_turbo, acpi-cpufreq and amd-pstate have boost */
+	if (read_line(SYSFS_CPU "/intel_pstate/no_turbo", buf, sizeof(buf)) == 0) {
+		if (strcmp(buf, "0") == 0) {
+			printf("Warning: turbo boost is on\n");
+			warnings++;
+		}
+	} else if (read_line(SYSFS_CPU "/cpufreq/boost", buf, sizeof(buf)) == 0) {
+		if (strcmp(buf, "1") == 0) {
+			printf("Warning: frequency boost is on\n");
+			warnings++;
+		}
+	}
+	return warnings;
+}
+
+/*
+ * read_line - read the first line of a file, without the newline
+ */
+static int read_line(char *path, char *buf, int size)
+{
+	FILE *fp;
+
+	if ((fp = fopen(path, "r")) == NULL)
+		return -1;
+	if (fgets(buf, size, fp) == NULL) {
+		fclose(fp);
+		return -1;
+	}
+	fclose(fp);
+	buf[strcspn(buf, "\n")] = '\0';
+	return 0;
+}
@@ -0,0 +1,21 @@
+#ifndef __CPUCHECK_H_
+#define __CPUCHECK_H_
+
+/*
+ * cpucheck.h - Keep the timed runs on one CPU (--cpu) and warn about
+ *              frequency scaling that makes them noisy (--check-freq).
+ */
+
+/* Pin the calling process to cpu. Returns 0, or -1 with errno set. */
+int pin_to_cpu(int cpu);
+
+/*
+ * Print a warning for each setting of cpu (or of the CPU we are on,
+ * if cpu < 0) that lets its clock speed change during a run: a
+ * cpufreq governor other than "performance", or turbo/boost enabled.
+ * Returns the number of warnings. Settings the kernel doesn't expose
+ * are skipped silently.
+ */
+int check_cpu_frequency(int cpu);
+
+#endif /* __CPUCHECK_H_ */
@@ -10,6 +10,8 @@
 #include <stdlib.h>
 #include <sys/times.h>
 #include <stdio.h>
+#include <string.h>
+#include <unistd.h>
 
 #include "fcyc.h"
 #include "clock.h"
@@ -20,16 +22,18 @@
 #define EPSILON 0.01         /* K samples should be EPSILON of each other*/
 #define COMPENSATE 0         /* 1-> try to compensate for clock ticks */
 #define CLEAR_CACHE 0        /* Clear cache before running test function */
-#define CACHE_BYTES (1<<19)  /* Max cache size in bytes */
-#define CACHE_BLOCK 32       /* Cache block size in bytes */
+#define CACHE_BYTES (1<<19)  /* Cache size in bytes, if none is detected */
+#define CACHE_BLOCK 32       /* Cache block size in bytes, if none is detected */
+#define FLUSH_FACTOR 2       /* Clear this many times the LLC size */
 
 static int kbest = K;
 static int maxsamples = MAXSAMPLES;
 static double epsilon = EPSILON;
 static int compensate = COMPENSATE;
 static int clear_cache = CLEAR_CACHE;
-static int cache_bytes = CACHE_BYTES;
-static int cache_block = CACHE_BLOCK;
+static int cache_bytes = 0;  /* 0 until set or detected */
+static int cache_block = 0;
+static int llc_bytes = -1;   /* detected LLC size; -1 before detect_cache */
 
 static int *cache_buf = NULL;
 
@@ -96,6 +100,77 @@ static int has_converged()
 		((1 + epsilon)*values[0] >= values[kbest-1]));
 }
 
+/*
+ * read_cache_attr - Read attribute name of cache index<i> of CPU 0
+ *     from sysfs into buf; returns 0, or -1 if there is no such file
+ */
+static int read_cache_attr(int i, char *name, char *buf, int len)
+{
+	char path[128];
+	FILE *fp;
+	int ok;
+
+	sprintf(path, "/sys/devices/system/cpu/cpu0/cache/index%d/%s", i, name);
+	if ((fp = fopen(path, "r")) == NULL)
+		return -1;
+	ok = fgets(buf, len, fp) != NULL;
+	fclose(fp);
+	return ok ? 0 : -1;
+}
+
+/*
+ * detect_cache - Find the size and line size of the last level data
+ *     cache, from sysfs or else from sysconf. Clearing the cache with a
+ *     fixed 512KB buffer leaves most of a modern LLC warm, so the buffer
+ *     is sized from the LLC unless set_fcyc_cache_size was called.
+ *     The LLC's replacement policy isn't strict LRU, so the buffer is
+ *     FLUSH_FACTOR times the LLC.
+ */
+static void detect_cache()
+{
+	char buf[64], *end;
+	int i, level, best = 0, line = 0;
+	long size;
+
+	llc_bytes = 0;
+	for (i = 0; read_cache_attr(i, "level", buf, sizeof(buf)) == 0; i++) {
+		level = atoi(buf);
+		if (level < best)
+			continue;
+		if (read_cache_attr(i, "type", buf, sizeof(buf)) == 0 &&
+				strncmp(buf, "Instruction", 11) == 0)
+			continue;
+		if (read_cache_attr(i, "size", buf, sizeof(buf)) < 0)
+			continue;
+		size = strtol(buf, &end, 10);
+		if (*end == 'K')
+			size <<= 10;
+		else if (*end == 'M')
+			size <<= 20;
+		if (size <= 0)
+			continue;
+		best = level;
+		llc_bytes = size;
+		if (read_cache_attr(i, "coherency_line_size", buf, sizeof(buf)) == 0)
+			line = atoi(buf);
+	}
+#ifdef _SC_LEVEL3_CACHE_SIZE
+	if (llc_bytes == 0 && (size = sysconf(_SC_LEVEL3_CACHE_SIZE)) > 0) {
+		llc_bytes = size;
+		line = sysconf(_SC_LEVEL3_CACHE_LINESIZE);
+	}
+	if (llc_bytes == 0 && (size = sysconf(_SC_LEVEL2_CACHE_SIZE)) > 0) {
+		llc_bytes = size;
+		line = sysconf(_SC_LEVEL2_CACHE_LINESIZE);
+	}
+#endif
+
+	if (cache_bytes == 0)
+		cache_bytes = llc_bytes ? FLUSH_FACTOR * llc_bytes : CACHE_BYTES;
+	if (cache_block == 0)
+		cache_block = (line >= (int)sizeof(int)) ? line : CACHE_BLOCK;
+}
+
 /* 
  * clear - Code to clear cache 
  */
@@ -105,13 +180,20 @@ static void clear()
 {
 	int x = sink;
 	int *cptr, *cend;
-	int incr = cache_block/sizeof(int);
+	int incr;
+	if (llc_bytes < 0 || !cache_bytes || !cache_block)
+		detect_cache();
+	incr = cache_block/sizeof(int);
 	if (!cache_buf) {
-		cache_buf = malloc(cache_bytes);
+		/* A 32-bit process may not find room for a big LLC's buffer */
+		while ((cache_buf = malloc(cache_bytes)) == NULL && cache_bytes > CACHE_BYTES)
+			cache_bytes /= 2;
 		if (!cache_buf) {
 			fprintf(stderr, "Fatal error.  Malloc returned null when trying to clear cache\n");
 			exit(1);
 		}
+		/* Untouched pages all map the one zero page, which flushes nothing */
+		memset(cache_buf, 1, cache_bytes);
 	}
 	cptr = (int *) cache_buf;
 	cend = cptr + cache_bytes/sizeof(int);
@@ -183,7 +265,7 @@ void set_fcyc_clear_cache(int clear)
 
 /* 
  * set_fcyc_cache_size - Set size of cache to use when clearing cache 
- *     Default = 1<<19 (512KB)
+ *     Default = FLUSH_FACTOR times the detected LLC, else 1<<19 (512KB)
  */
 void set_fcyc_cache_size(int bytes)
 {
@@ -198,12 +280,31 @@ void set_fcyc_cache_size(int bytes)
 
 /* 
  * set_fcyc_cache_block - Set size of cache block 
- *     Default = 32
+ *     Default = the detected line size, else 32
  */
 void set_fcyc_cache_block(int bytes) {
 	cache_block = bytes;
 }
 
+/*
+ * fcyc_llc_bytes - Size of the last level cache, or 0 if unknown
+ */
+int fcyc_llc_bytes(void)
+{
+	if (llc_bytes < 0)
+		detect_cache();
+	return llc_bytes;
+}
+
+/*
+ * fcyc_flush_cache - Clear the cache now, as fcyc does before each
+ *     measurement with set_fcyc_clear_cache
+ */
+void fcyc_flush_cache(void)
+{
+	clear();
+}
+
 
 /* 
  * set_fcyc_compensate- When set, will attempt to compensate for 
@@ -26,16 +26,28 @@ void set_fcyc_clear_cache(int clear);
 
 /* 
  * set_fcyc_cache_size - Set size of cache to use when clearing cache 
- *     Default = 1<<19 (512KB)
+ *     Default = twice the detected LLC size, else 1<<19 (512KB)
  */
 void set_fcyc_cache_size(int bytes);
 
 /* 
  * set_fcyc_cache_block - Set size of cache block 
- *     Default = 32
+ *     Default = the detected line size, else 32
  */
 void set_fcyc_cache_block(int bytes);
 
+/*
+ * fcyc_llc_bytes - Size of the last level cache, from sysfs or sysconf;
+ *     0 if it can't be found
+ */
+int fcyc_llc_bytes(void);
+
+/*
+ * fcyc_flush_cache - Clear the cache now, with the same buffer fcyc
+ *     uses before each measurement
+ */
+void fcyc_flush_cache(void);
+
 /* 
  * set_fcyc_compensate- When set, will attempt to compensate for 
  *     timer interrupt overhead 
@@ -2,6 +2,9 @@
  * High-level timing wrappers
  ****************************/
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
 #include "fsecs.h"
 #include "fcyc.h"
 #include "clock.h"
@@ -10,48 +13,218 @@
 
 static double Mhz;  /* estimated CPU clock frequency */
 
+static fsecs_params_t params = FSECS_DEFAULTS;
+static int timer;              /* params.timer, with auto resolved */
+static double *samples;        /* one per timed run (tsc and clock) */
+static fsecs_stats_t last;     /* summary of the last fsecs() call */
+
+static char *timer_names[FSECS_NTIMERS] = {"auto", "tsc", "clock", "fcyc", "itimer"};
+
 extern int verbose; /* -v option in mdriver.c */
 
+static void summarize(double *x, int n, fsecs_stats_t *st);
+
 /*
  * init_fsecs - initialize the timing package
  */
-void init_fsecs(void)
+void init_fsecs(fsecs_params_t *p)
 {
 	Mhz = 0; /* keep gcc -Wall happy */
 
-#if USE_FCYC
-	if (verbose)
-		printf("Measuring performance with a cycle counter.\n");
+	if (p != NULL)
+		params = *p;
+	if (params.min_runs < 1)
+		params.min_runs = 1;
+	if (params.max_runs < params.min_runs)
+		params.max_runs = params.min_runs;
+
+	/*
+	 * A TSC that isn't invariant speeds up and slows down with the
+	 * CPU clock, or stops in deep sleep states, so it doesn't measure
+	 * time. Use the monotonic clock instead.
+	 */
+	timer = params.timer;
+	if (timer == FSECS_AUTO || timer == FSECS_TSC) {
+		if (tsc_invariant())
+			timer = FSECS_TSC;
+		else {
+			if (timer == FSECS_TSC)
+				fprintf(stderr, "The TSC isn't invariant on this CPU; timing with clock_gettime() instead.\n");
+			timer = FSECS_CLOCK;
+		}
+	}
+
+	switch (timer) {
+	case FSECS_FCYC:
+		if (verbose)
+			printf("Measuring performance with a cycle counter.\n");
+
+		/* set key parameters for the fcyc package */
+		set_fcyc_maxsamples(params.fcyc_maxsamples);
+		set_fcyc_clear_cache(params.fcyc_clear_cache);
+		set_fcyc_compensate(params.fcyc_compensate);
+		set_fcyc_epsilon(params.fcyc_epsilon);
+		set_fcyc_k(params.fcyc_k);
+		Mhz = mhz(verbose > 0);
+		break;
+	case FSECS_ITIMER:
+		if (verbose)
+			printf("Measuring performance with the interval timer.\n");
+		break;
+	default:
+		if (timer == FSECS_TSC)
+			Mhz = mhz(verbose > 0);
+		if (verbose) {
+			printf("Measuring performance with %s: median of %d",
+					(timer == FSECS_TSC) ? "the invariant TSC" : "clock_gettime()",
+					params.min_runs);
+			if (params.ci_target > 0)
+				printf("-%d runs (95%% CI within %.1f%%)", params.max_runs, 100 * params.ci_target);
+			else
+				printf(" runs");
+			printf(" after %d warmup run%s.\n", params.warmup, params.warmup == 1 ? "" : "s");
+		}
+		free(samples);
+		if ((samples = (double *)malloc(params.max_runs * sizeof(double))) == NULL) {
+			fprintf(stderr, "init_fsecs: out of memory\n");
+			exit(1);
+		}
+		break;
+	}
+}
 
-	/* set key parameters for the fcyc package */
-	set_fcyc_maxsamples(20); 
-	set_fcyc_clear_cache(1);
-	set_fcyc_compensate(1);
-	set_fcyc_epsilon(0.01);
-	set_fcyc_k(3);
-	Mhz = mhz(verbose > 0);
-#elif USE_ITIMER
-	if (verbose)
-		printf("Measuring performance with the interval timer.\n");
-#elif USE_GETTOD
-	if (verbose)
-		printf("Measuring performance with gettimeofday().\n");
-#endif
+/*
+ * time_once - Time a single run of f(argp), in seconds
+ */
+static double time_once(fsecs_test_funct f, void *argp)
+{
+	if (timer == FSECS_TSC) {
+		start_counter();
+		f(argp);
+		return get_counter() / (Mhz * 1e6);
+	}
+	return ftimer_once(f, argp);
 }
 
 /*
  * fsecs - Return the running time of a function f (in seconds)
  */
-double fsecs(fsecs_test_funct f, void *argp) 
+double fsecs(fsecs_test_funct f, void *argp)
+{
+	int i, n = 0;
+
+	switch (timer) {
+	case FSECS_FCYC:
+		memset(&last, 0, sizeof(last));
+		last.median = fcyc(f, argp) / (Mhz * 1e6);
+		return last.median;
+	case FSECS_ITIMER:
+		memset(&last, 0, sizeof(last));
+		last.median = ftimer_itimer(f, argp, params.min_runs);
+		return last.median;
+	}
+
+	/* Warm the caches, the branch predictors and the heap's page tables */
+	for (i = 0; i < params.warmup; i++)
+		f(argp);
+
+	/*
+	 * Time runs one at a time. Past min_runs, stop as soon as the
+	 * confidence interval is tight enough, or at max_runs.
+	 */
+	while (n < params.max_runs) {
+		samples[n++] = time_once(f, argp);
+		if (n >= params.min_runs) {
+			summarize(samples, n, &last);
+			if (params.ci_target <= 0 ||
+					(last.ci_hi - last.ci_lo) / 2 <= params.ci_target * last.median)
+				break;
+		}
+	}
+	return last.median;
+}
+
+/*
+ * fsecs_timer_parse - the timer called name, or -1
+ */
+int fsecs_timer_parse(char *name)
+{
+	int i;
+
+	for (i = 0; i < FSECS_NTIMERS; i++)
+		if (strcmp(name, timer_names[i]) == 0)
+			return i;
+	return -1;
+}
+
+/*
+ * fsecs_timer_name - the name --timer knows timer by
+ */
+char *fsecs_timer_name(int t)
 {
-#if USE_FCYC
-	double cycles = fcyc(f, argp);
-	return cycles/(Mhz*1e6);
-#elif USE_ITIMER
-	return ftimer_itimer(f, argp, 10);
-#elif USE_GETTOD
-	return ftimer_gettod(f, argp, 10);
-#endif 
+	return (t >= 0 && t < FSECS_NTIMERS) ? timer_names[t] : "?";
 }
 
+/*
+ * fsecs_timer - the timer init_fsecs settled on
+ */
+int fsecs_timer(void)
+{
+	return timer;
+}
+
+/*
+ * fsecs_last_stats - describe the samples behind the last result
+ */
+void fsecs_last_stats(fsecs_stats_t *stats)
+{
+	*stats = last;
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+
+	return (x > y) - (x < y);
+}
+
+/* median of a sorted array */
+static double median(double *x, int n)
+{
+	return (n % 2) ? x[n / 2] : (x[n / 2 - 1] + x[n / 2]) / 2;
+}
+
+/*
+ * summarize - Median, MAD and a distribution-free 95% confidence
+ *     interval for the median. The interval comes from the order
+ *     statistics at ranks n/2 -+ 0.98 sqrt(n), so it needs no
+ *     assumption about the shape of the timing distribution, and a
+ *     few slow outliers cannot drag it the way they drag a mean.
+ */
+static void summarize(double *x, int n, fsecs_stats_t *st)
+{
+	double sorted[n], dev[n];
+	double half = 0.98 * sqrt((double)n);
+	int i, lo, hi;
+
+	memcpy(sorted, x, n * sizeof(double));
+	qsort(sorted, n, sizeof(double), cmp_double);
+	st->runs = n;
+	st->median = median(sorted, n);
 
+	for (i = 0; i < n; i++)
+		dev[i] = fabs(sorted[i] - st->median);
+	qsort(dev, n, sizeof(double), cmp_double);
+	st->mad = median(dev, n);
+
+	lo = (int)floor(n / 2.0 - half);         /* 0-based ranks */
+	hi = (int)ceil(n / 2.0 + half);
+	st->ci_lo = sorted[(lo < 0) ? 0 : lo];
+	st->ci_hi = sorted[(hi > n - 1) ? n - 1 : hi];
+
+	/* 1.4826 MAD estimates the standard deviation of normal noise */
+	st->outliers = 0;
+	for (i = 0; i < n; i++)
+		if (fabs(x[i] - st->median) > 3 * 1.4826 * st->mad)
+			st->outliers++;
+}
@@ -1,4 +1,62 @@
+#ifndef __FSECS_H_
+#define __FSECS_H_
+
 typedef void (*fsecs_test_funct)(void *);
 
-void init_fsecs(void);
+/* How fsecs() times a function (--timer) */
+enum {
+	FSECS_AUTO,    /* tsc if the TSC is invariant, else clock */
+	FSECS_TSC,     /* median of runs, timed with the invariant TSC */
+	FSECS_CLOCK,   /* median of runs, timed with clock_gettime */
+	FSECS_FCYC,    /* cycle counter w/K-best scheme (x86 & Alpha only) */
+	FSECS_ITIMER,  /* interval timer, mean of min_runs runs */
+	FSECS_NTIMERS
+};
+
+/*
+ * Timing parameters, normally filled in from the mdriver command line.
+ * The sampling fields apply to the tsc and clock timers; the fcyc
+ * fields to the K-best cycle counter timer.
+ */
+typedef struct {
+	int timer;           /* one of FSECS_AUTO ... FSECS_ITIMER */
+
+	int warmup;          /* untimed runs before the first sample */
+	int min_runs;        /* timed runs always made */
+	int max_runs;        /* stop here even if the CI is still wide */
+	double ci_target;    /* run until the 95% CI half-width is within
+	                        this fraction of the median; 0 = min_runs only */
+
+	int fcyc_k;          /* K in the K-best scheme */
+	int fcyc_maxsamples; /* give up on K-best after this many samples */
+	double fcyc_epsilon; /* K-best tolerance */
+	int fcyc_clear_cache;/* flush the cache before each sample? */
+	int fcyc_compensate; /* compensate for timer interrupts? */
+} fsecs_params_t;
+
+/* timer, warmup, min/max runs, CI target, then k, maxsamples, epsilon,
+   clear, compensate */
+#define FSECS_DEFAULTS {FSECS_AUTO, 1, 10, 100, 0, 3, 20, 0.01, 1, 1}
+
+/* Summary of the samples behind the last fsecs() result (tsc and clock) */
+typedef struct {
+	int runs;            /* timed runs */
+	double median;       /* seconds; this is what fsecs() returns */
+	double mad;          /* median absolute deviation, seconds */
+	double ci_lo, ci_hi; /* 95% confidence interval for the median */
+	int outliers;        /* runs more than 3 scaled MADs from the median */
+} fsecs_stats_t;
+
+void init_fsecs(fsecs_params_t *params);
 double fsecs(fsecs_test_funct f, void *argp);
+void fsecs_last_stats(fsecs_stats_t *stats);
+
+/* The FSECS_xxx timer called name, or -1 */
+int fsecs_timer_parse(char *name);
+
+/* The name of timer; after init_fsecs, fsecs_timer_name(fsecs_timer())
+   tells what auto chose */
+char *fsecs_timer_name(int timer);
+int fsecs_timer(void);
+
+#endif /* __FSECS_H_ */
@@ -7,9 +7,11 @@
  * Function timers that estimate the running time (in seconds) of a function f.
  *    ftimer_itimer: version that uses the interval timer
  *    ftimer_gettod: version that uses gettimeofday
+ *    ftimer_once: one run, for callers that keep their own statistics
  */
 #include <stdio.h>
 #include <sys/time.h>
+#include <time.h>
 #include "ftimer.h"
 
 /* function prototypes */
@@ -52,6 +54,19 @@ double ftimer_gettod(ftimer_test_funct f, void *argp, int n)
 	return (1E-3*diff);
 }
 
+/*
+ * ftimer_once - Time one run of f(argp). The monotonic clock has
+ * nanosecond resolution and doesn't jump when the wall clock is set.
+ */
+double ftimer_once(ftimer_test_funct f, void *argp)
+{
+	struct timespec sts, ets;
+
+	clock_gettime(CLOCK_MONOTONIC, &sts);
+	f(argp);
+	clock_gettime(CLOCK_MONOTONIC, &ets);
+	return (ets.tv_sec - sts.tv_sec) + 1E-9*(ets.tv_nsec - sts.tv_nsec);
+}
 
 /*
  * Routines for manipulating the Unix interval timer
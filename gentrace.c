@@ -0,0 +1,584 @@
+/*
+ * gentrace.c - Generate a synthetic .rep trace from a spec file.
+ *
+ *     unix> gentrace -o mixed.rep specs/mixed.spec
+ *     unix> gentrace -s 7 -b -o mixed7.bin specs/mixed.spec
+ *     unix> mdriver -V -f mixed.rep
+ *
+ * A spec is a list of phases. A phase makes a number of allocations
+ * and gives each one a size and a lifetime drawn from its
+ * distributions. The lifetime counts later allocations, so a block
+ * with lifetime 10 is freed just before the 10th allocation after it,
+ * and one with lifetime 0 or 1 just before the next.
+ * A phase can also grow live blocks with realloc. A phase starts with
+ * the settings of the one before it and changes only what it names.
+ *
+ *     # comment
+ *     seed 42                   PRNG seed (-s overrides it)
+ *     peak 4000000              cap on live payload bytes
+ *     phase warmup              start a new phase
+ *     allocs 20000              allocations in this phase
+ *     size uniform 8 256        size distribution, one of:
+ *          uniform <lo> <hi>
+ *          lognormal <mu> <sigma>          (of ln bytes)
+ *          powerlaw <alpha> <min> <max>    (truncated Pareto)
+ *          bins <size>:<weight> ...        (fixed sizes)
+ *     lifetime exp 500          lifetime distribution, the same kinds plus
+ *          exp <mean>
+ *          fixed <n>
+ *          forever                         (freed at the end)
+ *     realloc 0.05 geometric 1.5   per allocation, the chance that a
+ *     realloc 0.05 linear 64       random live block grows by a factor
+ *                                  or by a number of bytes
+ *
+ * When an allocation would take the live bytes over the peak, the
+ * blocks due to die soonest are freed early until it fits. Every block
+ * is freed by the end of the trace, and ids are handed out in order,
+ * so the trace passes read_trace's checks. The generator has its own
+ * PRNG, so the same spec and seed always give the same trace.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <getopt.h>
+
+#include "trace.h"
+
+#define MAXLINE    1024       /* max string size */
+#define MAX_PHASES 64         /* phases per spec */
+#define MAX_BINS   32         /* sizes in a bins distribution */
+#define MAX_SIZE   (1 << 24)  /* largest request we generate */
+
+int verbose = 0; /* read by trace.c */
+
+/* A size or lifetime distribution */
+typedef struct {
+	enum {D_UNIFORM, D_LOGNORMAL, D_POWERLAW, D_BINS, D_EXP, D_FIXED, D_FOREVER} kind;
+	double a, b, c;                /* parameters, in the order of the spec */
+	int nbins;
+	double bin_size[MAX_BINS];
+	double bin_weight[MAX_BINS];   /* cumulative, normalized to 1 */
+} dist_t;
+
+/* One phase of the spec */
+typedef struct {
+	char name[MAXLINE];
+	int allocs;
+	dist_t size;
+	dist_t lifetime;
+	double realloc_prob;
+	int realloc_linear;            /* grow by realloc_amount bytes... */
+	double realloc_amount;         /* ... or by this factor */
+} phase_t;
+
+/* A live block */
+typedef struct {
+	int id;
+	int size;
+	long death;                    /* allocation count at which it dies */
+	int live_pos;                  /* position in the live array */
+} block_t;
+
+/* Generator state */
+static unsigned long long rng_state;
+static block_t *blocks;            /* indexed by id */
+static int *deadline_heap;         /* ids, min-heap on death */
+static int heap_len;
+static int *live;                  /* ids of live blocks, in no order */
+static int live_len;
+static long live_bytes, max_live_bytes;
+static trace_t trace;              /* ops as they are generated */
+static int ops_cap;
+
+static void usage(void);
+static int read_spec(char *path, phase_t *phases, unsigned long long *seed, long *peak);
+static int parse_dist(char *args, dist_t *d, int lifetime, char *path, int lineno);
+static void generate(phase_t *phases, int nphases, long peak);
+static void emit(int type, int id, int size);
+static void free_block(int id);
+static void heap_push(int id);
+static int heap_pop(void);
+static void heap_sift_down(int i);
+static unsigned long long rng_next(void);
+static double rng_uniform(void);
+static double rng_normal(void);
+static double sample(dist_t *d);
+static void write_rep(FILE *out);
+
+int main(int argc, char **argv)
+{
+	phase_t phases[MAX_PHASES];
+	unsigned long long seed = 1, spec_seed = 1;
+	long peak = 0;
+	int nphases, c, binary = 0, seed_set = 0;
+	char *outfile = NULL;
+	FILE *out = stdout;
+
+	while ((c = getopt(argc, argv, "s:o:bh")) != EOF) {
+		switch (c) {
+			case 's':
+				seed = strtoull(optarg, NULL, 0);
+				seed_set = 1;
+				break;
+			case 'o':
+				outfile = optarg;
+				break;
+			case 'b':
+				binary = 1;
+				break;
+			case 'h':
+			default:
+				usage();
+				exit(c == 'h' ? 0 : 1);
+		}
+	}
+	if (optind != argc - 1) {
+		usage();
+		exit(1);
+	}
+	if (binary && outfile == NULL) {
+		fprintf(stderr, "gentrace: -b needs an output file (-o)\n");
+		exit(1);
+	}
+
+	nphases = read_spec(argv[optind], phases, &spec_seed, &peak);
+	if (!seed_set)
+		seed = spec_seed;
+	rng_state = seed ? seed : 1; /* xorshift must not start at 0 */
+
+	generate(phases, nphases, peak);
+
+	if (binary) {
+		if (write_trace_bin(&trace, outfile) < 0) {
+			fprintf(stderr, "gentrace: cannot write %s: %s\n", outfile, strerror(errno));
+			exit(1);
+		}
+	} else {
+		if (outfile != NULL && (out = fopen(outfile, "w")) == NULL) {
+			fprintf(stderr, "gentrace: cannot create %s: %s\n", outfile, strerror(errno));
+			exit(1);
+		}
+		write_rep(out);
+		if (out != stdout)
+			fclose(out);
+	}
+
+	fprintf(stderr, "gentrace: %d ids, %d ops, peak %ld live bytes\n",
+			trace.num_ids, trace.num_ops, max_live_bytes);
+	exit(0);
+}
+
+/*
+ * usage - print the command line options
+ */
+static void usage(void)
+{
+	fprintf(stderr, "Usage: gentrace [-hb] [-s <seed>] [-o <outfile>] <specfile>\n");
+	fprintf(stderr, "Options\n");
+	fprintf(stderr, "\t-b         Write a binary trace (see rep2bin).\n");
+	fprintf(stderr, "\t-h         Print this message.\n");
+	fprintf(stderr, "\t-o <file>  Write the trace to <file> instead of stdout.\n");
+	fprintf(stderr, "\t-s <seed>  Use <seed> instead of the spec's seed.\n");
+}
+
+/*
+ * read_spec - Parse the spec file into phases. Returns the phase count.
+ */
+static int read_spec(char *path, phase_t *phases, unsigned long long *seed, long *peak)
+{
+	FILE *f;
+	char line[MAXLINE], key[MAXLINE], mode[MAXLINE], *args, *p;
+	int lineno = 0, n = 0, used;
+	phase_t *ph = NULL;
+
+	if ((f = fopen(path, "r")) == NULL) {
+		fprintf(stderr, "gentrace: cannot open %s: %s\n", path, strerror(errno));
+		exit(1);
+	}
+
+	while (fgets(line, sizeof(line), f) != NULL) {
+		lineno++;
+		if ((p = strchr(line, '#')) != NULL)
+			*p = '\0';
+		if (sscanf(line, "%s%n", key, &used) != 1)
+			continue; /* blank line */
+		args = line + used;
+
+		if (!strcmp(key, "seed")) {
+			if (sscanf(args, "%llu", seed) != 1)
+				goto bad;
+		} else if (!strcmp(key, "peak")) {
+			if (sscanf(args, "%ld", peak) != 1 || *peak <= 0)
+				goto bad;
+		} else if (!strcmp(key, "phase")) {
+			if (n == MAX_PHASES) {
+				fprintf(stderr, "gentrace: %s: more than %d phases\n", path, MAX_PHASES);
+				exit(1);
+			}
+			ph = &phases[n];
+			if (n > 0)
+				*ph = phases[n - 1]; /* inherit everything... */
+			else {
+				memset(ph, 0, sizeof(*ph));
+				ph->size.kind = D_UNIFORM;
+				ph->size.a = 1;
+				ph->size.b = 1024;
+				ph->lifetime.kind = D_EXP;
+				ph->lifetime.a = 100;
+			}
+			ph->allocs = 0;      /* ...but the allocation count */
+			if (sscanf(args, "%s", ph->name) != 1)
+				sprintf(ph->name, "%d", n);
+			n++;
+		} else if (ph == NULL) {
+			fprintf(stderr, "gentrace: %s:%d: '%s' before the first phase\n", path, lineno, key);
+			exit(1);
+		} else if (!strcmp(key, "allocs")) {
+			if (sscanf(args, "%d", &ph->allocs) != 1 || ph->allocs < 0)
+				goto bad;
+		} else if (!strcmp(key, "size")) {
+			if (parse_dist(args, &ph->size, 0, path, lineno) < 0)
+				goto bad;
+		} else if (!strcmp(key, "lifetime")) {
+			if (parse_dist(args, &ph->lifetime, 1, path, lineno) < 0)
+				goto bad;
+		} else if (!strcmp(key, "realloc")) {
+			/* "realloc 0" turns reallocs off again */
+			if (sscanf(args, "%lf", &ph->realloc_prob) != 1 || ph->realloc_prob < 0)
+				goto bad;
+			if (ph->realloc_prob == 0)
+				continue;
+			if (sscanf(args, "%*f %s %lf", mode, &ph->realloc_amount) != 2)
+				goto bad;
+			if (!strcmp(mode, "linear") && ph->realloc_amount > 0)
+				ph->realloc_linear = 1;
+			else if (!strcmp(mode, "geometric") && ph->realloc_amount > 1)
+				ph->realloc_linear = 0;
+			else
+				goto bad;
+		} else {
+			fprintf(stderr, "gentrace: %s:%d: unknown keyword '%s'\n", path, lineno, key);
+			exit(1);
+		}
+	}
+	fclose(f);
+
+	if (n == 0) {
+		fprintf(stderr, "gentrace: %s: no phases\n", path);
+		exit(1);
+	}
+	return n;
+
+ bad:
+	fprintf(stderr, "gentrace: %s:%d: bad '%s' line\n", path, lineno, key);
+	exit(1);
+}
+
+/*
+ * parse_dist - Parse "<kind> <params>". Returns 0, or -1 on error.
+ */
+static int parse_dist(char *args, dist_t *d, int lifetime, char *path, int lineno)
+{
+	char kind[MAXLINE], *tok;
+	int used, i;
+	double total, w;
+
+	if (sscanf(args, "%s%n", kind, &used) != 1)
+		return -1;
+	args += used;
+	memset(d, 0, sizeof(*d));
+
+	if (!strcmp(kind, "uniform")) {
+		d->kind = D_UNIFORM;
+		return (sscanf(args, "%lf %lf", &d->a, &d->b) == 2 && d->a <= d->b) ? 0 : -1;
+	} else if (!strcmp(kind, "lognormal")) {
+		d->kind = D_LOGNORMAL;
+		return (sscanf(args, "%lf %lf", &d->a, &d->b) == 2 && d->b >= 0) ? 0 : -1;
+	} else if (!strcmp(kind, "powerlaw")) {
+		d->kind = D_POWERLAW;
+		return (sscanf(args, "%lf %lf %lf", &d->a, &d->b, &d->c) == 3 &&
+				d->a > 0 && d->b >= 1 && d->b <= d->c) ? 0 : -1;
+	} else if (!strcmp(kind, "bins")) {
+		d->kind = D_BINS;
+		total = 0;
+		for (tok = strtok(args, " \t\n"); tok != NULL; tok = strtok(NULL, " \t\n")) {
+			if (d->nbins == MAX_BINS) {
+				fprintf(stderr, "gentrace: %s:%d: more than %d bins\n", path, lineno, MAX_BINS);
+				exit(1);
+			}
+			if (sscanf(tok, "%lf:%lf", &d->bin_size[d->nbins], &w) != 2 || w < 0)
+				return -1;
+			total += w;
+			d->bin_weight[d->nbins++] = total;
+		}
+		if (d->nbins == 0 || total <= 0)
+			return -1;
+		for (i = 0; i < d->nbins; i++)
+			d->bin_weight[i] /= total;
+		return 0;
+	} else if (lifetime && !strcmp(kind, "exp")) {
+		d->kind = D_EXP;
+		return (sscanf(args, "%lf", &d->a) == 1 && d->a > 0) ? 0 : -1;
+	} else if (lifetime && !strcmp(kind, "fixed")) {
+		d->kind = D_FIXED;
+		return (sscanf(args, "%lf", &d->a) == 1 && d->a >= 0) ? 0 : -1;
+	} else if (lifetime && !strcmp(kind, "forever")) {
+		d->kind = D_FOREVER;
+		return 0;
+	}
+	return -1;
+}
+
+/*
+ * generate - run every phase, then free whatever is still live
+ */
+static void generate(phase_t *phases, int nphases, long peak)
+{
+	long now = 0, total = 0, lt;
+	int p, i, id, size, newsize;
+	double d;
+	block_t *b;
+	phase_t *ph;
+
+	for (p = 0; p < nphases; p++)
+		total += phases[p].allocs;
+	if (total == 0 || total > 0x7fffffff) {
+		fprintf(stderr, "gentrace: the spec must make between 1 and 2^31-1 allocations\n");
+		exit(1);
+	}
+	if ((blocks = (block_t *)malloc(total * sizeof(block_t))) == NULL ||
+			(deadline_heap = (int *)malloc(total * sizeof(int))) == NULL ||
+			(live = (int *)malloc(total * sizeof(int))) == NULL) {
+		fprintf(stderr, "gentrace: out of memory\n");
+		exit(1);
+	}
+	trace.num_threads = 1;
+	trace.weight = 1;
+
+	for (p = 0; p < nphases; p++) {
+		ph = &phases[p];
+		for (i = 0; i < ph->allocs; i++, now++) {
+			/* Free everything that is due */
+			while (heap_len > 0 && blocks[deadline_heap[0]].death <= now)
+				free_block(heap_pop());
+
+			/* Maybe grow a random live block */
+			if (live_len > 0 && ph->realloc_prob > 0 && rng_uniform() < ph->realloc_prob) {
+				b = &blocks[live[rng_next() % live_len]];
+				d = ph->realloc_linear ? b->size + ph->realloc_amount
+					: b->size * ph->realloc_amount;
+				/* Clamp before the cast, which is undefined out of range */
+				newsize = !(d < MAX_SIZE) ? MAX_SIZE : (d < 1) ? 1 : (int)d;
+				if (newsize <= b->size)
+					newsize = b->size + 1;
+				if (newsize > MAX_SIZE)
+					newsize = MAX_SIZE;
+				if (peak == 0 || live_bytes - b->size + newsize <= peak) {
+					live_bytes += newsize - b->size;
+					b->size = newsize;
+					emit(REALLOC, b->id, newsize);
+				}
+			}
+
+			/* Heavy-tailed draws can pass INT_MAX; clamp before the cast */
+			d = sample(&ph->size);
+			size = !(d < MAX_SIZE) ? MAX_SIZE : (d < 1) ? 1 : (int)d;
+
+			/* Keep under the peak by freeing the blocks closest to death */
+			while (peak > 0 && heap_len > 0 && live_bytes + size > peak)
+				free_block(heap_pop());
+
+			id = trace.num_ids++;
+			b = &blocks[id];
+			b->id = id;
+			b->size = size;
+			if (ph->lifetime.kind == D_FOREVER)
+				b->death = total + 1;
+			else {
+				/* A block that outlives the trace dies at the end anyway */
+				d = sample(&ph->lifetime);
+				lt = !(d < total) ? total : (d > 0) ? (long)d : 0;
+				b->death = now + lt;  /* freed when now reaches it */
+			}
+			heap_push(id);
+			b->live_pos = live_len;
+			live[live_len++] = id;
+			live_bytes += size;
+			if (live_bytes > max_live_bytes)
+				max_live_bytes = live_bytes;
+			emit(ALLOC, id, size);
+		}
+	}
+
+	while (heap_len > 0)
+		free_block(heap_pop());
+	trace.sugg_heapsize = (max_live_bytes > 0x7fffffff) ? 0x7fffffff : max_live_bytes;
+}
+
+/*
+ * emit - append an op to the trace
+ */
+static void emit(int type, int id, int size)
+{
+	traceop_t *op;
+
+	if (trace.num_ops == ops_cap) {
+		ops_cap = ops_cap ? 2 * ops_cap : 65536;
+		if ((trace.ops = (traceop_t *)realloc(trace.ops, ops_cap * sizeof(traceop_t))) == NULL) {
+			fprintf(stderr, "gentrace: out of memory\n");
+			exit(1);
+		}
+	}
+	op = &trace.ops[trace.num_ops++];
+	op->type = type;
+	op->index = id;
+	op->size = size;
+	op->tid = 0;
+}
+
+/*
+ * free_block - emit a free for a block already taken off the heap
+ */
+static void free_block(int id)
+{
+	block_t *b = &blocks[id];
+	int last = live[--live_len];
+
+	live[b->live_pos] = last;
+	blocks[last].live_pos = b->live_pos;
+	live_bytes -= b->size;
+	emit(FREE, id, 0);
+}
+
+/*
+ * Deadline heap. Ties go to the smaller id, so the order of frees does
+ * not depend on the heap's internal layout.
+ */
+#define EARLIER(x, y) (blocks[x].death < blocks[y].death || \
+		(blocks[x].death == blocks[y].death && (x) < (y)))
+
+static void heap_push(int id)
+{
+	int i = heap_len++, parent;
+
+	while (i > 0 && EARLIER(id, deadline_heap[parent = (i - 1) / 2])) {
+		deadline_heap[i] = deadline_heap[parent];
+		i = parent;
+	}
+	deadline_heap[i] = id;
+}
+
+static int heap_pop(void)
+{
+	int top = deadline_heap[0];
+
+	deadline_heap[0] = deadline_heap[--heap_len];
+	if (heap_len > 0)
+		heap_sift_down(0);
+	return top;
+}
+
+static void heap_sift_down(int i)
+{
+	int id = deadline_heap[i], child;
+
+	while ((child = 2 * i + 1) < heap_len) {
+		if (child + 1 < heap_len && EARLIER(deadline_heap[child + 1], deadline_heap[child]))
+			child++;
+		if (!EARLIER(deadline_heap[child], id))
+			break;
+		deadline_heap[i] = deadline_heap[child];
+		i = child;
+	}
+	deadline_heap[i] = id;
+}
+
+/*
+ * rng_next - xorshift64*; the same sequence on every platform
+ */
+static unsigned long long rng_next(void)
+{
+	rng_state ^= rng_state >> 12;
+	rng_state ^= rng_state << 25;
+	rng_state ^= rng_state >> 27;
+	return rng_state * 0x2545F4914F6CDD1DULL;
+}
+
+/*
+ * rng_uniform - uniform double in [0, 1)
+ */
+static double rng_uniform(void)
+{
+	return (rng_next() >> 11) * (1.0 / 9007199254740992.0);
+}
+
+/*
+ * rng_normal - standard normal deviate (Box-Muller)
+ */
+static double rng_normal(void)
+{
+	double u1 = 1.0 - rng_uniform(); /* (0, 1], so log is finite */
+	double u2 = rng_uniform();
+
+	return sqrt(-2.0 * log(u1)) * cos(2.0 * M_PI * u2);
+}
+
+/*
+ * sample - draw one value from a distribution
+ */
+static double sample(dist_t *d)
+{
+	double u, ea, ec;
+	int i;
+
+	switch (d->kind) {
+		case D_UNIFORM:
+			return d->a + floor(rng_uniform() * (d->b - d->a + 1));
+		case D_LOGNORMAL:
+			return floor(exp(d->a + d->b * rng_normal()));
+		case D_POWERLAW:
+			/* Inverse CDF of a Pareto(alpha) truncated to [min, max] */
+			u = rng_uniform();
+			ea = pow(d->b, -d->a);
+			ec = pow(d->c, -d->a);
+			return floor(pow(ea - u * (ea - ec), -1.0 / d->a));
+		case D_BINS:
+			u = rng_uniform();
+			for (i = 0; i < d->nbins - 1 && u >= d->bin_weight[i]; i++)
+				;
+			return d->bin_size[i];
+		case D_EXP:
+			return floor(-d->a * log(1.0 - rng_uniform()));
+		case D_FIXED:
+			return d->a;
+		case D_FOREVER:
+			break;
+	}
+	return 0;
+}
+
+/*
+ * write_rep - write the trace in the .rep text format
+ */
+static void write_rep(FILE *out)
+{
+	traceop_t *op;
+
+	fprintf(out, "%d\n%d\n%d\n%d\n", trace.sugg_heapsize, trace.num_ids,
+			trace.num_ops, trace.weight);
+	for (op = trace.ops; op < trace.ops + trace.num_ops; op++) {
+		switch (op->type) {
+			case ALLOC:
+				fprintf(out, "a %d %d\n", op->index, op->size);
+				break;
+			case REALLOC:
+				fprintf(out, "r %d %d\n", op->index, op->size);
+				break;
+			case FREE:
+				fprintf(out, "f %d\n", op->index);
+				break;
+		}
+	}
+}
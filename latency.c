@@ -0,0 +1,260 @@
+/*
+ * latency.c - Log-bucketed latency histograms and the slowest-op list.
+ *
+ * Ticks are converted to nanoseconds only when the report is printed.
+ * The tick rate is measured once against CLOCK_MONOTONIC. The cost of
+ * two back-to-back counter reads is measured too, and it is taken off
+ * every sample so that short ops are not dominated by the timer.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "latency.h"
+
+#define CALIBRATE_NSECS 20000000  /* measure the tick rate over 20 ms */
+#define OVERHEAD_TRIES  1000      /* back-to-back reads to find the overhead */
+
+static double ticks_per_ns = 0;      /* 0 until calibrated */
+static unsigned long long overhead;  /* ticks charged by the timer itself */
+
+static void calibrate(void);
+static int bucket_of(unsigned long long ticks);
+static unsigned long long bucket_high(int b);
+static unsigned long long percentile(lat_hist_t *h, double p);
+static double now_ns(void);
+
+/*
+ * lat_init - clear the histograms and make room for the slowest ops
+ */
+void lat_init(lat_t *lat, int slowest)
+{
+	if (ticks_per_ns == 0)
+		calibrate();
+
+	memset(lat, 0, sizeof(*lat));
+	lat->slow_max = slowest;
+	if (slowest > 0 &&
+			(lat->slow = (lat_op_t *)malloc(slowest * sizeof(lat_op_t))) == NULL) {
+		fprintf(stderr, "lat_init: out of memory\n");
+		exit(1);
+	}
+}
+
+/*
+ * lat_record - add one sample
+ */
+void lat_record(lat_t *lat, traceop_t *op, int opnum, unsigned long long ticks)
+{
+	lat_hist_t *h = &lat->hist[op->type];
+	lat_op_t *s, tmp;
+	int i, child;
+
+	ticks = (ticks > overhead) ? ticks - overhead : 0;
+	h->count++;
+	h->total += ticks;
+	if (ticks > h->max)
+		h->max = ticks;
+	h->bucket[bucket_of(ticks)]++;
+
+	if (lat->slow_max == 0)
+		return;
+	if (lat->slow_len == lat->slow_max) {
+		if (ticks <= lat->slow[0].ticks)
+			return;
+		i = 0; /* replace the fastest of the slow ops */
+	} else
+		i = lat->slow_len++;
+
+	s = &lat->slow[i];
+	s->ticks = ticks;
+	s->opnum = opnum;
+	s->type = op->type;
+	s->index = op->index;
+	s->size = op->size;
+
+	/* Restore the min-heap: sift up a new entry, or down a replaced root */
+	if (i > 0) {
+		while (i > 0 && lat->slow[(i - 1) / 2].ticks > lat->slow[i].ticks) {
+			tmp = lat->slow[i];
+			lat->slow[i] = lat->slow[(i - 1) / 2];
+			lat->slow[(i - 1) / 2] = tmp;
+			i = (i - 1) / 2;
+		}
+	} else {
+		while ((child = 2 * i + 1) < lat->slow_len) {
+			if (child + 1 < lat->slow_len && lat->slow[child + 1].ticks < lat->slow[child].ticks)
+				child++;
+			if (lat->slow[i].ticks <= lat->slow[child].ticks)
+				break;
+			tmp = lat->slow[i];
+			lat->slow[i] = lat->slow[child];
+			lat->slow[child] = tmp;
+			i = child;
+		}
+	}
+}
+
+static int cmp_slowest(const void *a, const void *b)
+{
+	unsigned long long ta = ((const lat_op_t *)a)->ticks;
+	unsigned long long tb = ((const lat_op_t *)b)->ticks;
+
+	return (ta < tb) - (ta > tb);
+}
+
+/*
+ * lat_summarize - convert the histograms to nanosecond percentiles
+ */
+void lat_summarize(lat_t *lat, lat_summary_t sum[3])
+{
+	lat_hist_t *h;
+	int t;
+
+	for (t = 0; t < 3; t++) {
+		h = &lat->hist[t];
+		memset(&sum[t], 0, sizeof(lat_summary_t));
+		if ((sum[t].count = h->count) == 0)
+			continue;
+		sum[t].mean = h->total / (double)h->count / ticks_per_ns;
+		sum[t].p50 = percentile(h, 0.50) / ticks_per_ns;
+		sum[t].p99 = percentile(h, 0.99) / ticks_per_ns;
+		sum[t].p999 = percentile(h, 0.999) / ticks_per_ns;
+		sum[t].max = h->max / ticks_per_ns;
+	}
+}
+
+/*
+ * lat_report - print the percentile table and the slowest ops
+ */
+void lat_report(lat_t *lat)
+{
+	static char *names[] = {"malloc", "free", "realloc"};
+	lat_summary_t sum[3];
+	lat_op_t *s;
+	int t, i;
+
+	lat_summarize(lat, sum);
+	printf("%-8s%10s%9s%9s%9s%9s%10s  (ns)\n",
+			"op", "count", "mean", "p50", "p99", "p99.9", "max");
+	for (t = 0; t < 3; t++) {
+		if (sum[t].count == 0)
+			continue;
+		printf("%-8s%10llu%9.0f%9.0f%9.0f%9.0f%10.0f\n", names[t], sum[t].count,
+				sum[t].mean, sum[t].p50, sum[t].p99, sum[t].p999, sum[t].max);
+	}
+
+	if (lat->slow_len == 0)
+		return;
+	qsort(lat->slow, lat->slow_len, sizeof(lat_op_t), cmp_slowest);
+	printf("Slowest %d ops:\n", lat->slow_len);
+	printf("%10s%8s%8s%10s%10s\n", "op", "type", "id", "size", "ns");
+	for (i = 0; i < lat->slow_len; i++) {
+		s = &lat->slow[i];
+		if (s->type == FREE)
+			printf("%10d%8s%8d%10s%10.0f\n", s->opnum, names[s->type],
+					s->index, "-", s->ticks / ticks_per_ns);
+		else
+			printf("%10d%8s%8d%10d%10.0f\n", s->opnum, names[s->type],
+					s->index, s->size, s->ticks / ticks_per_ns);
+	}
+}
+
+/*
+ * lat_free - release the slowest-op heap
+ */
+void lat_free(lat_t *lat)
+{
+	free(lat->slow);
+	lat->slow = NULL;
+}
+
+/*
+ * calibrate - measure the tick rate and the timer's own overhead
+ */
+static void calibrate(void)
+{
+	unsigned long long t0, t1, best = ~0ULL;
+	double n0, n1;
+	int i;
+
+	for (i = 0; i < OVERHEAD_TRIES; i++) {
+		t0 = lat_cycles();
+		t1 = lat_cycles();
+		if (t1 - t0 < best)
+			best = t1 - t0;
+	}
+	overhead = best;
+
+	n0 = now_ns();
+	t0 = lat_cycles();
+	while ((n1 = now_ns()) - n0 < CALIBRATE_NSECS)
+		;
+	t1 = lat_cycles();
+	ticks_per_ns = (t1 - t0) / (n1 - n0);
+	if (ticks_per_ns <= 0)
+		ticks_per_ns = 1;
+}
+
+/*
+ * bucket_of - Values below LAT_SUB_BUCKETS have a bucket each. Above
+ *     that, the top set bit picks the power of two and the next
+ *     LAT_SUB_BITS bits pick the bucket within it.
+ */
+static int bucket_of(unsigned long long ticks)
+{
+	int msb;
+
+	if (ticks < LAT_SUB_BUCKETS)
+		return (int)ticks;
+	msb = 63 - __builtin_clzll(ticks);
+	return ((msb - LAT_SUB_BITS + 1) << LAT_SUB_BITS) +
+		(int)((ticks >> (msb - LAT_SUB_BITS)) & (LAT_SUB_BUCKETS - 1));
+}
+
+/*
+ * bucket_high - largest value that falls in bucket b
+ */
+static unsigned long long bucket_high(int b)
+{
+	int shift, sub;
+
+	if (b < LAT_SUB_BUCKETS)
+		return b;
+	shift = (b >> LAT_SUB_BITS) - 1;
+	sub = b & (LAT_SUB_BUCKETS - 1);
+	return ((unsigned long long)(LAT_SUB_BUCKETS + sub + 1) << shift) - 1;
+}
+
+/*
+ * percentile - Upper edge of the bucket holding the p'th sample,
+ *     but never more than the true maximum
+ */
+static unsigned long long percentile(lat_hist_t *h, double p)
+{
+	unsigned long long rank = (unsigned long long)(p * h->count);
+	unsigned long long seen = 0, high;
+	int b;
+
+	if (rank >= h->count)
+		rank = h->count - 1;
+	for (b = 0; b < LAT_BUCKETS; b++) {
+		seen += h->bucket[b];
+		if (seen > rank)
+			break;
+	}
+	high = bucket_high(b);
+	return (high < h->max) ? high : h->max;
+}
+
+/*
+ * now_ns - monotonic time in nanoseconds
+ */
+static double now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
@@ -0,0 +1,86 @@
+#ifndef __LATENCY_H_
+#define __LATENCY_H_
+
+/*
+ * latency.h - Per-operation latency histograms for the driver's -L pass.
+ *
+ * Each request is bracketed by two reads of the cycle counter. The
+ * ticks are added to a log-bucketed histogram for the op type. Each
+ * power of two is split into LAT_SUB_BUCKETS buckets, so a percentile
+ * read from the histogram is within 25% of the true value. The slowest
+ * ops are kept separately together with their trace position.
+ */
+#include <time.h>
+
+#include "trace.h"
+
+#define LAT_SUB_BITS    2                      /* log2 of buckets per power of two */
+#define LAT_SUB_BUCKETS (1 << LAT_SUB_BITS)
+#define LAT_BUCKETS     (64 * LAT_SUB_BUCKETS)
+
+/* Histogram for one op type */
+typedef struct {
+	unsigned long long count;               /* ops recorded */
+	unsigned long long total;               /* sum of their ticks */
+	unsigned long long max;                 /* slowest, exactly */
+	unsigned long long bucket[LAT_BUCKETS];
+} lat_hist_t;
+
+/* One of the slowest ops */
+typedef struct {
+	unsigned long long ticks;
+	int opnum;                               /* position in the trace */
+	int type;                                /* ALLOC, FREE or REALLOC */
+	int index;                               /* block id */
+	int size;                                /* request size (ALLOC, REALLOC) */
+} lat_op_t;
+
+/* Percentiles of one op type, in nanoseconds (count is 0 if none) */
+typedef struct {
+	unsigned long long count;
+	double mean, p50, p99, p999, max;
+} lat_summary_t;
+
+/* Everything recorded in one latency pass */
+typedef struct {
+	lat_hist_t hist[3];                      /* indexed by op type */
+	int slow_max;                            /* keep this many slowest ops */
+	int slow_len;
+	lat_op_t *slow;                          /* min-heap on ticks */
+} lat_t;
+
+/*
+ * lat_cycles - Read the cycle counter. Elsewhere, fall back to a
+ *     nanosecond clock, which is slower but has the same meaning.
+ */
+static inline unsigned long long lat_cycles(void)
+{
+#if defined(__i386__) || defined(__x86_64__)
+	unsigned hi, lo;
+
+	asm volatile("rdtsc" : "=a" (lo), "=d" (hi));
+	return ((unsigned long long)hi << 32) | lo;
+#else
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+}
+
+/* Start a pass that also keeps the slowest ops */
+void lat_init(lat_t *lat, int slowest);
+
+/* Record ticks for op number opnum (the timer overhead is taken off) */
+void lat_record(lat_t *lat, traceop_t *op, int opnum, unsigned long long ticks);
+
+/* Per-type percentiles, indexed by op type */
+void lat_summarize(lat_t *lat, lat_summary_t sum[3]);
+
+/* Print per-type percentiles and the slowest ops, in nanoseconds */
+void lat_report(lat_t *lat);
+
+/* Free what lat_init allocated */
+void lat_free(lat_t *lat);
+
+#endif /* __LATENCY_H_ */
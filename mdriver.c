@@ -7,19 +7,38 @@
  * Copyright (c) 2002, R. Bryant and D. O'Hallaron, All rights reserved.
  * May not be used, modified, or copied without permission.
  */
+#define _GNU_SOURCE /* for sched_setaffinity */
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <getopt.h>
 #include <errno.h>
 #include <string.h>
 #include <assert.h>
 #include <float.h>
+#include <limits.h>
 #include <time.h>
+#include <sched.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <pthread.h>
 
 #include "mm.h"
 #include "memlib.h"
 #include "fsecs.h"
 #include "config.h"
+#include "trace.h"
+#include "tracestream.h"
+#include "mtreplay.h"
+#include "latency.h"
+#include "perfctr.h"
+#include "cpucheck.h"
+#include "results.h"
+#include "timeline.h"
+#include "snapshot.h"
+#include "backend.h"
+#include "touch.h"
+#include "fcyc.h"
 
 /**********************
  * Constants and macros
@@ -29,6 +48,8 @@
 #define MAXLINE     1024 /* max string size */
 #define HDRLINES       4 /* number of header lines in a trace file */
 #define LINENUM(i) (i+5) /* cnvt trace request nums to linenums (origin 1) */
+#define MT_RUNS        3 /* threaded replays per thread count; best is kept */
+#define COMPARE_COLUMNS 8 /* more --alloc results than this are ranked in rows */
 
 /* Returns true if p is ALIGNMENT-byte aligned */
 #define IS_ALIGNED(p)  ((((unsigned int)(p)) % ALIGNMENT) == 0)
@@ -44,24 +65,6 @@ typedef struct range_t {
 	struct range_t *next;  /* next list element */
 } range_t;
 
-/* Characterizes a single trace operation (allocator request) */
-typedef struct tag_traceop_t {
-	enum {ALLOC, FREE, REALLOC} type; /* type of request */
-	int index;                        /* index for free() to use later */
-	int size;                         /* byte size of alloc/realloc request */
-} traceop_t;
-
-/* Holds the information for one trace file*/
-typedef struct {
-	int sugg_heapsize;   /* suggested heap size (unused) */
-	int num_ids;         /* number of alloc/realloc ids */
-	int num_ops;         /* number of distinct requests */
-	int weight;          /* weight for this trace (unused) */
-	traceop_t *ops;      /* array of requests */
-	char **blocks;       /* array of ptrs returned by malloc/realloc... */
-	size_t *block_sizes; /* ... and a corresponding array of payload sizes */
-} trace_t;
-
 /*
  * Holds the params to the xxx_speed functions, which are timed by fcyc.
  * This struct is necessary because fcyc accepts only a pointer array
@@ -70,20 +73,21 @@ typedef struct {
 typedef struct {
 	trace_t *trace;
 	range_t *ranges;
+	int runs;        /* number of times the timer called the function */
+	perfctr_t *perf; /* hardware counters to run around each call, or NULL */
+	touch_t *touch;  /* payload accesses for eval_touch_speed */
+	mm_handle_t *handles; /* each id's handle for eval_handle_speed */
 } speed_t;
 
-/* Summarizes the important stats for some malloc function on some trace */
-typedef struct {
-	/* defined for both libc malloc and student malloc package (mm.c) */
-	double ops;      /* number of ops (malloc/free/realloc) in the trace */
-	int valid;       /* was the trace processed correctly by the allocator? */
-	double secs;     /* number of secs needed to run the trace */
+/* Evaluates one trace into a stats_t; run serially or in a -j worker */
+typedef void (*eval_trace_funct)(char *tracefile, int tracenum, stats_t *stats);
 
-	/* defined only for the student malloc package */
-	double util;     /* space utilization for this trace (always 0 for libc) */
-
-	/* Note: secs and util are only defined if valid is true */
-} stats_t;
+/* What a -j worker sends back to the parent over the results pipe */
+typedef struct {
+	int tracenum;    /* which trace these stats belong to */
+	int errors;      /* errors the worker reported while running it */
+	stats_t stats;
+} result_msg_t;
 
 /********************
  * Global variables
@@ -92,6 +96,84 @@ int verbose = 0;        /* global flag for verbose output */
 static int errors = 0;  /* number of errs found when running student malloc */
 char msg[MAXLINE];      /* for whenever we need to compose an error message */
 
+static int stream_traces = 0; /* stream ops from disk (-S)? */
+static int num_workers = 1;    /* max traces evaluated at once (-j) */
+static int pin_workers = 0;    /* pin each worker to its own CPU (-p)? */
+static int max_threads = 0;    /* threaded replay on 1..max_threads (-T) */
+static int lat_pass = 0;       /* run a per-op latency pass (-L)? */
+static int lat_slowest = 0;    /* list this many slowest ops (-n) */
+static int perf_counters = 0;  /* count hardware events in speed runs (-P)? */
+static fsecs_params_t timing = FSECS_DEFAULTS; /* --warmup, --runs, --ci, --fcyc-* */
+static int timing_cpu = -1;    /* pin the driver to this CPU (--cpu) */
+static int check_freq = 0;     /* warn about frequency scaling (--check-freq)? */
+static char *json_file = NULL; /* write results as JSON here (--json) */
+static char *csv_file = NULL;  /* write results as CSV here (--csv) */
+static char *baseline_file = NULL; /* CSV of an earlier run to compare with (--baseline) */
+static double threshold = 0.05;    /* smallest throughput loss that counts (--threshold) */
+static int libc_baseline = 0;  /* score throughput against libc from this run? */
+static char *timeline_file = NULL; /* write heap samples here (--timeline) */
+static int timeline_points = 100;  /* about this many samples per trace */
+static int *snap_ops = NULL;   /* dump the heap before these requests (--snapshot), */
+static int num_snap_ops = 0;   /* ... sorted; SNAP_END is after the last request */
+static char *snap_dir = ".";   /* where the dumps go (--snapshot-dir) */
+static backend_t *backends = NULL; /* shared objects to run as well (--alloc) */
+static int num_backends = 0;
+static double touch_frac = 0;  /* also time with payload accesses (--touch), */
+static int touch_write = 50;   /* ... this percent of them updates (--touch-write) */
+static double hint_frac = 0;   /* pass lifetime hints (--hint): short if freed */
+                               /* ... within this share of the trace's ops */
+static unsigned char *op_hints = NULL; /* MM_HINT_* for each op of the current trace */
+static int handle_pass = 0;    /* also replay with relocatable blocks (--handles)? */
+
+/* The allocators linked into the driver, and the one being evaluated */
+static backend_t mm_backend = {"mm", mm_init, mm_malloc, mm_free, mm_realloc, NULL,
+	mm_malloc_hint};
+static backend_t libc_backend = {"libc", NULL, malloc, free, realloc, NULL, NULL};
+static backend_t *cur = &mm_backend;
+
+#define SNAP_END INT_MAX
+
+/* Long options without a short form */
+enum {
+	OPT_WARMUP = 256, OPT_RUNS, OPT_MAX_RUNS, OPT_CI, OPT_CPU, OPT_CHECK_FREQ,
+	OPT_FCYC_K, OPT_FCYC_MAXSAMPLES, OPT_FCYC_EPSILON, OPT_FCYC_CLEAR_CACHE,
+	OPT_FCYC_COMPENSATE, OPT_JSON, OPT_CSV, OPT_BASELINE, OPT_THRESHOLD,
+	OPT_LIBC_BASELINE, OPT_TIMELINE, OPT_TIMELINE_POINTS, OPT_SNAPSHOT,
+	OPT_SNAPSHOT_DIR, OPT_ALLOC, OPT_TOUCH, OPT_TOUCH_WRITE, OPT_TIMER, OPT_HINT,
+	OPT_HANDLES
+};
+
+static struct option long_options[] = {
+	{"warmup",           required_argument, NULL, OPT_WARMUP},
+	{"runs",             required_argument, NULL, OPT_RUNS},
+	{"max-runs",         required_argument, NULL, OPT_MAX_RUNS},
+	{"ci",               required_argument, NULL, OPT_CI},
+	{"cpu",              required_argument, NULL, OPT_CPU},
+	{"timer",            required_argument, NULL, OPT_TIMER},
+	{"check-freq",       no_argument,       NULL, OPT_CHECK_FREQ},
+	{"fcyc-k",           required_argument, NULL, OPT_FCYC_K},
+	{"fcyc-maxsamples",  required_argument, NULL, OPT_FCYC_MAXSAMPLES},
+	{"fcyc-epsilon",     required_argument, NULL, OPT_FCYC_EPSILON},
+	{"fcyc-clear-cache", required_argument, NULL, OPT_FCYC_CLEAR_CACHE},
+	{"fcyc-compensate",  required_argument, NULL, OPT_FCYC_COMPENSATE},
+	{"json",             required_argument, NULL, OPT_JSON},
+	{"csv",              required_argument, NULL, OPT_CSV},
+	{"baseline",         required_argument, NULL, OPT_BASELINE},
+	{"threshold",        required_argument, NULL, OPT_THRESHOLD},
+	{"libc-baseline",    no_argument,       NULL, OPT_LIBC_BASELINE},
+	{"timeline",         required_argument, NULL, OPT_TIMELINE},
+	{"timeline-points",  required_argument, NULL, OPT_TIMELINE_POINTS},
+	{"snapshot",         required_argument, NULL, OPT_SNAPSHOT},
+	{"snapshot-dir",     required_argument, NULL, OPT_SNAPSHOT_DIR},
+	{"alloc",            required_argument, NULL, OPT_ALLOC},
+	{"touch",            required_argument, NULL, OPT_TOUCH},
+	{"touch-write",      required_argument, NULL, OPT_TOUCH_WRITE},
+	{"hint",             required_argument, NULL, OPT_HINT},
+	{"handles",          no_argument,       NULL, OPT_HANDLES},
+	{"help",             no_argument,       NULL, 'h'},
+	{NULL, 0, NULL, 0}
+};
+
 /* Directory where default tracefiles are found */
 static char tracedir[MAXLINE] = TRACEDIR;
 
@@ -111,9 +193,34 @@ static int add_range(range_t **ranges, char *lo, int size,
 static void remove_range(range_t **ranges, char *lo);
 static void clear_ranges(range_t **ranges);
 
-/* These functions read, allocate, and free storage for traces */
-static trace_t *read_trace(char *tracedir, char *filename);
-static void free_trace(trace_t *trace);
+/* These functions load traces and step through their ops */
+static trace_t *load_trace(char *tracedir, char *filename);
+static void unload_trace(trace_t *trace);
+static void start_pass(trace_t *trace);
+static inline traceop_t *next_op(trace_t *trace, int i);
+static unsigned char *lifetime_hints(trace_t *trace);
+static inline void *alloc_op(backend_t *b, int i, size_t size);
+static double time_speed(fsecs_test_funct f, speed_t *speed_params, stats_t *stats);
+static double time_touch(trace_t *trace);
+static double time_handles(trace_t *trace);
+static inline void use_sample(heapuse_t *use, size_t live);
+static void use_end(heapuse_t *use, int ops);
+
+/* These functions evaluate every trace, one at a time or in workers */
+static void run_traces(char **tracefiles, int n, stats_t *stats,
+		eval_trace_funct eval);
+static void run_traces_parallel(char **tracefiles, int n, stats_t *stats,
+		eval_trace_funct eval);
+static void eval_libc_trace(char *tracefile, int tracenum, stats_t *stats);
+static void eval_mm_trace(char *tracefile, int tracenum, stats_t *stats);
+static void eval_latency(trace_t *trace, char *tracefile, int tracenum,
+		stats_t *stats);
+
+/* These functions measure allocator scalability with threaded replay */
+static void eval_mt_scaling(char **tracefiles, int n, int use_libc);
+static void *mm_malloc_locked(size_t size);
+static void mm_free_locked(void *ptr);
+static void *mm_realloc_locked(void *ptr, size_t size);
 
 /* Routines for evaluating the correctness and speed of libc malloc */
 static int eval_libc_valid(trace_t *trace, int tracenum);
@@ -122,11 +229,24 @@ static void eval_libc_speed(void *ptr);
 /* Routines for evaluating correctnes, space utilization, and speed
 	of the student's malloc package in mm.c */
 static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges);
-static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges);
+static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges,
+		timeline_t *tl, heapuse_t *use);
+static int eval_handles(trace_t *trace, int tracenum, stats_t *stats);
 static void eval_mm_speed(void *ptr);
+static void eval_touch_speed(void *ptr);
+static void eval_handle_speed(void *ptr);
+static void parse_snap_ops(char *list);
+static void take_snapshot(int tracenum, int op, size_t live);
 
 /* Various helper routines */
 static void printresults(int n, stats_t *stats);
+static void printperf(int n, stats_t *stats);
+static void printtiming(int n, stats_t *stats);
+static void printfrag(int n, stats_t *stats);
+static void printtouch(char *name, int n, stats_t *stats);
+static void printhandles(int n, stats_t *stats);
+static void printcompare(int n, results_t *res, backend_t **alloc, int nres);
+static void printranking(int n, results_t *res, backend_t **alloc, int nres);
 static void sumresults(const stats_t *stats, const int n_stats,
 								int *num_err, double *avg_util, double *avg_tput);
 static void usage(void);
@@ -149,29 +269,32 @@ char *current_trace_name;
  **************/
 int main(int argc, char **argv)
 {
-	int i;
-	char c;
+	int c;
 	char **tracefiles = NULL;  /* null-terminated array of trace file names */
 	int num_tracefiles = 0;    /* the number of traces in that array */
-	trace_t *trace = NULL;     /* stores a single trace file in memory */
-	range_t *ranges = NULL;    /* keeps track of block extents for one trace */
 	stats_t *libc_stats = NULL;/* libc stats for each trace */
 	stats_t *mm_stats = NULL;  /* mm (i.e. student) stats for each trace */
-	speed_t speed_params;      /* input parameters to the xx_speed routines */
 
 	int team_check = 1;  /* If set, check team structure (reset by -a) */
 	int run_libc = 0;    /* If set, print the results from running libc malloc*/
 	int autograder = 0;  /* If set, emit summary info for autograder (-g) */
 
 	/* temporaries used to compute the performance index */
-	double avg_mm_util, avg_mm_throughput, p1, p2, perfindex;
-	double libc_tput;
+	double avg_mm_util, avg_mm_throughput, p1 = 0, p2 = 0, perfindex;
+	double libc_tput = 0, ref_tput = AVG_LIBC_THRUPUT;
 	int numcorrect;
 
+	/* what --json, --csv and --baseline report on */
+	results_t *results;
+	backend_t **result_alloc;  /* the allocator behind each of them */
+	int num_results = 0, regressions = 0, mm_errors, i;
+	perfindex_t pi;
+
 	/*
 	 * Read and interpret the command line arguments
 	 */
-	while ((c = getopt(argc, argv, "f:t:hvVgal")) != EOF) {
+	while ((c = getopt_long(argc, argv, "f:t:hvVgalSj:pT:Ln:P",
+					long_options, NULL)) != EOF) {
 		switch (c) {
 			case 'g': /* Generate summary info for the autograder */
 				autograder = 1;
@@ -197,12 +320,187 @@ int main(int argc, char **argv)
 			case 'l': /* Run libc malloc */
 				run_libc = 1;
 				break;
+			case 'S': /* Stream traces instead of loading them */
+				stream_traces = 1;
+				break;
+			case 'j': /* Evaluate up to <n> traces at once */
+				num_workers = atoi(optarg);
+				if (num_workers < 1) {
+					usage();
+					exit(1);
+				}
+				break;
+			case 'p': /* Pin each -j worker to its own CPU */
+				pin_workers = 1;
+				break;
+			case 'T': /* Threaded replay on 1..<n> threads */
+				max_threads = atoi(optarg);
+				if (max_threads < 1) {
+					usage();
+					exit(1);
+				}
+				break;
+			case 'L': /* Time each request and print latency percentiles */
+				lat_pass = 1;
+				break;
+			case 'n': /* List the <n> slowest requests (implies -L) */
+				lat_slowest = atoi(optarg);
+				if (lat_slowest < 1) {
+					usage();
+					exit(1);
+				}
+				lat_pass = 1;
+				break;
+			case 'P': /* Count hardware events during the speed runs */
+				perf_counters = 1;
+				break;
 			case 'v': /* Print per-trace performance breakdown */
 				verbose = 1;
 				break;
 			case 'V': /* Be more verbose than -v */
 				verbose = 2;
 				break;
+			case OPT_WARMUP: /* Untimed runs before the timed ones */
+				timing.warmup = atoi(optarg);
+				if (timing.warmup < 0) {
+					usage();
+					exit(1);
+				}
+				break;
+			case OPT_RUNS: /* Timed runs per trace (at least, with --ci) */
+				timing.min_runs = atoi(optarg);
+				if (timing.min_runs < 1) {
+					usage();
+					exit(1);
+				}
+				break;
+			case OPT_MAX_RUNS: /* Upper bound on timed runs with --ci */
+				timing.max_runs = atoi(optarg);
+				if (timing.max_runs < 1) {
+					usage();
+					exit(1);
+				}
+				break;
+			case OPT_CI: /* Repeat until the 95% CI is within <pct>% */
+				timing.ci_target = atof(optarg) / 100;
+				if (timing.ci_target <= 0) {
+					usage();
+					exit(1);
+				}
+				break;
+			case OPT_CPU: /* Run on this CPU only */
+				timing_cpu = atoi(optarg);
+				if (timing_cpu < 0) {
+					usage();
+					exit(1);
+				}
+				break;
+			case OPT_CHECK_FREQ: /* Warn if the clock speed can change */
+				check_freq = 1;
+				break;
+			case OPT_TIMER: /* How to time the runs */
+				if ((timing.timer = fsecs_timer_parse(optarg)) < 0) {
+					usage();
+					exit(1);
+				}
+				break;
+			case OPT_FCYC_K: /* K-best parameters for --timer fcyc */
+				timing.fcyc_k = atoi(optarg);
+				if (timing.fcyc_k < 1) {
+					usage();
+					exit(1);
+				}
+				break;
+			case OPT_FCYC_MAXSAMPLES:
+				timing.fcyc_maxsamples = atoi(optarg);
+				if (timing.fcyc_maxsamples < timing.fcyc_k) {
+					usage();
+					exit(1);
+				}
+				break;
+			case OPT_FCYC_EPSILON:
+				timing.fcyc_epsilon = atof(optarg);
+				if (timing.fcyc_epsilon <= 0) {
+					usage();
+					exit(1);
+				}
+				break;
+			case OPT_FCYC_CLEAR_CACHE:
+				timing.fcyc_clear_cache = atoi(optarg);
+				break;
+			case OPT_FCYC_COMPENSATE:
+				timing.fcyc_compensate = atoi(optarg);
+				break;
+			case OPT_JSON: /* Write the results to a JSON file */
+				json_file = optarg;
+				break;
+			case OPT_CSV: /* Write the results to a CSV file */
+				csv_file = optarg;
+				break;
+			case OPT_BASELINE: /* Compare with the CSV of an earlier run */
+				baseline_file = optarg;
+				break;
+			case OPT_THRESHOLD: /* Smallest throughput loss (in %) to flag */
+				threshold = atof(optarg) / 100;
+				if (threshold < 0) {
+					usage();
+					exit(1);
+				}
+				break;
+			case OPT_LIBC_BASELINE: /* Score against libc, measured now */
+				libc_baseline = 1;
+				run_libc = 1;
+				break;
+			case OPT_TIMELINE: /* Sample the mm heap during the util pass */
+				timeline_file = optarg;
+				break;
+			case OPT_TIMELINE_POINTS: /* About <n> samples per trace */
+				timeline_points = atoi(optarg);
+				if (timeline_points < 1) {
+					usage();
+					exit(1);
+				}
+				break;
+			case OPT_SNAPSHOT: /* Dump the mm heap before these requests */
+				parse_snap_ops(optarg);
+				break;
+			case OPT_SNAPSHOT_DIR: /* ... into this directory */
+				snap_dir = optarg;
+				break;
+			case OPT_ALLOC: /* Also run the allocator in a shared object */
+				if ((backends = (backend_t *)realloc(backends,
+								(num_backends + 1) * sizeof(backend_t))) == NULL)
+					unix_error("ERROR: realloc failed in main");
+				if (backend_load(&backends[num_backends], optarg) < 0) {
+					fprintf(stderr, "Can't load --alloc %s: %s\n", optarg, backend_error());
+					exit(1);
+				}
+				num_backends++;
+				break;
+			case OPT_TOUCH: /* Access <pct>% of the live blocks per request */
+				touch_frac = atof(optarg) / 100;
+				if (touch_frac <= 0) {
+					usage();
+					exit(1);
+				}
+				break;
+			case OPT_TOUCH_WRITE: /* ... updating <pct>% of those */
+				touch_write = atoi(optarg);
+				if (touch_write < 0 || touch_write > 100) {
+					usage();
+					exit(1);
+				}
+				break;
+			case OPT_HINT: /* Tell mm which blocks are freed within <pct>% of the trace */
+				hint_frac = atof(optarg) / 100;
+				if (hint_frac <= 0) {
+					usage();
+					exit(1);
+				}
+				break;
+			case OPT_HANDLES: /* Replay through mm_halloc too */
+				handle_pass = 1;
+				break;
 			case 'h': /* Print this message */
 				usage();
 				exit(0);
@@ -248,14 +546,54 @@ int main(int argc, char **argv)
 		printf("Using default tracefiles in %s\n", tracedir);
 	}
 
+	/* Threaded replay is a separate mode with its own report */
+	if (max_threads > 0) {
+		eval_mt_scaling(tracefiles, num_tracefiles, run_libc);
+		exit(0);
+	}
+
+	if (touch_frac > 0 && stream_traces)
+		app_error("--touch needs traces in memory; drop -S");
+	if (hint_frac > 0 && stream_traces)
+		app_error("--hint needs traces in memory; drop -S");
+	if (handle_pass && stream_traces)
+		app_error("--handles needs traces in memory; drop -S");
+
+	/* Keep the timed runs on one CPU, and check that its clock holds still */
+	if (timing_cpu >= 0 && pin_to_cpu(timing_cpu) < 0) {
+		fprintf(stderr, "Can't run on CPU %d: %s\n", timing_cpu, strerror(errno));
+		exit(1);
+	}
+	if (check_freq)
+		check_cpu_frequency(timing_cpu);
+
 	/* Initialize the timing package */
-	init_fsecs();
+	init_fsecs(&timing);
+	if (touch_frac > 0 && verbose) {
+		if (fcyc_llc_bytes() > 0)
+			printf("Caches are flushed before each --touch run (LLC %d KB)\n",
+					fcyc_llc_bytes() / 1024);
+		else
+			printf("LLC size unknown; --touch runs flush 512 KB of cache\n");
+	}
+
+	/* Without counters -P is ignored, rather than failing the run */
+	if (perf_counters) {
+		perfctr_t pc;
+
+		if (perf_open(&pc) == 0) {
+			printf("Hardware counters unavailable (%s); ignoring -P\n", strerror(errno));
+			perf_counters = 0;
+		}
+		perf_close(&pc);
+	}
 
 	/*
 	 * obtain the throughput of libc malloc package
 	 */
 	if (run_libc > 0) {
 			printf("\nTesting libc malloc\n");
+		cur = &libc_backend;
 
 		/* Allocate libc stats array, with one stats_t struct per tracefile */
 		libc_stats = (stats_t *)calloc(num_tracefiles, sizeof(stats_t));
@@ -263,23 +601,20 @@ int main(int argc, char **argv)
 			unix_error("libc_stats calloc in main failed");
 
 		/* Evaluate the libc malloc package*/
-		for (i=0; i < num_tracefiles; i++) {
-			trace = read_trace(tracedir, tracefiles[i]);
-			libc_stats[i].ops = trace->num_ops;
-			printf("Checking libc malloc for correctness, ");
-			libc_stats[i].valid = eval_libc_valid(trace, i);
-			if (libc_stats[i].valid) {
-				speed_params.trace = trace;
-				printf("and performance.\n");
-				libc_stats[i].secs = fsecs(eval_libc_speed, &speed_params);
-			}
-			free_trace(trace);
-		}
+		run_traces(tracefiles, num_tracefiles, libc_stats, eval_libc_trace);
 
 		/* Display the libc results in a compact table */
 		printf("\nResults for libc malloc:\n");
 		printresults(num_tracefiles, libc_stats);
+		if (verbose)
+			printtiming(num_tracefiles, libc_stats);
+		if (touch_frac > 0)
+			printtouch("libc", num_tracefiles, libc_stats);
+		if (perf_counters)
+			printperf(num_tracefiles, libc_stats);
 		sumresults(libc_stats,num_tracefiles, NULL, NULL, &libc_tput);
+		if (libc_baseline && libc_tput > 0)
+			ref_tput = libc_tput;
 	}
 
 	/*
@@ -287,6 +622,7 @@ int main(int argc, char **argv)
 	 */
 	if (verbose > 1)
 		printf("\nTesting mm malloc\n");
+	cur = &mm_backend;
 
 	/* Allocate the mm stats array, with one stats_t struct per tracefile */
 	mm_stats = (stats_t *)calloc(num_tracefiles, sizeof(stats_t));
@@ -296,32 +632,32 @@ int main(int argc, char **argv)
 	/* Initialize the simulated memory system in memlib.c */
 	mem_init();
 
-	/* Evaluate student's mm malloc package using the K-best scheme */
-	for (i=0; i < num_tracefiles; i++) {
-		current_trace_name = tracefiles[i];
+	if (timeline_file != NULL && tl_write_header(timeline_file) != 0)
+		unix_error("Can't write the --timeline file");
 
-		trace = read_trace(tracedir, tracefiles[i]);
-		mm_stats[i].ops = trace->num_ops;
-		if (verbose > 1)
-			printf("Checking mm_malloc for correctness, ");
-		mm_stats[i].valid = eval_mm_valid(trace, i, &ranges);
-		if (mm_stats[i].valid) {
-			if (verbose > 1)
-				printf("efficiency, ");
-			mm_stats[i].util = eval_mm_util(trace, i, &ranges);
-			speed_params.trace = trace;
-			speed_params.ranges = ranges;
-			if (verbose > 1)
-				printf("and performance.\n");
-			mm_stats[i].secs = fsecs(eval_mm_speed, &speed_params);
-		}
-		free_trace(trace);
-	}
+	/* Evaluate student's mm malloc package using the K-best scheme */
+	run_traces(tracefiles, num_tracefiles, mm_stats, eval_mm_trace);
 
 	/* Display the mm results in a compact table */
 	if (verbose) {
 		printf("\nResults for mm malloc:\n");
 		printresults(num_tracefiles, mm_stats);
+		printtiming(num_tracefiles, mm_stats);
+		if (timeline_file != NULL)
+			printfrag(num_tracefiles, mm_stats);
+		printf("\n");
+	}
+	if (touch_frac > 0) {
+		printtouch("mm", num_tracefiles, mm_stats);
+		printf("\n");
+	}
+	if (handle_pass) {
+		printhandles(num_tracefiles, mm_stats);
+		printf("\n");
+	}
+	if (perf_counters) {
+		printf("Hardware counters for mm malloc:\n");
+		printperf(num_tracefiles, mm_stats);
 		printf("\n");
 	}
 
@@ -335,14 +671,16 @@ int main(int argc, char **argv)
 	 */
 	if (errors == 0) {
 		p1 = UTIL_WEIGHT * avg_mm_util;
-		if (avg_mm_throughput > AVG_LIBC_THRUPUT) {
+		if (avg_mm_throughput > ref_tput) {
 			p2 = (double)(1.0 - UTIL_WEIGHT);
 		} else {
 			p2 = ((double) (1.0 - UTIL_WEIGHT)) *
-				(avg_mm_throughput/AVG_LIBC_THRUPUT);
+				(avg_mm_throughput/ref_tput);
 		}
 
 		perfindex = (p1 + p2)*100.0;
+		if (libc_baseline)
+			printf("Throughput scored against libc at %.0f Kops\n", ref_tput/1e3);
 		printf("Perf index = %.0f (util) + %.0f (thru) = %.0f/100\n",
 				p1*100,
 				p2*100,
@@ -359,6 +697,82 @@ int main(int argc, char **argv)
 		printf("perfidx:%.0f\n", perfindex);
 	}
 
+	results = (results_t *)calloc(2 + num_backends, sizeof(results_t));
+	result_alloc = (backend_t **)calloc(2 + num_backends, sizeof(backend_t *));
+	if (results == NULL || result_alloc == NULL)
+		unix_error("results calloc in main failed");
+	result_alloc[num_results] = &mm_backend;
+	results[num_results].name = "mm";
+	results[num_results].n = num_tracefiles;
+	results[num_results].tracefiles = tracefiles;
+	results[num_results++].stats = mm_stats;
+	if (run_libc) {
+		result_alloc[num_results] = &libc_backend;
+		results[num_results].name = "libc";
+		results[num_results].n = num_tracefiles;
+		results[num_results].tracefiles = tracefiles;
+		results[num_results++].stats = libc_stats;
+	}
+
+	/*
+	 * Run each --alloc backend on the same traces, the mm kind like mm.c
+	 * and the malloc kind like libc, and compare them all. The errors
+	 * reported at the end are still those of mm.c.
+	 */
+	mm_errors = errors;
+	for (i = 0; i < num_backends; i++) {
+		cur = &backends[i];
+		printf("\nTesting %s malloc\n", cur->name);
+		result_alloc[num_results] = cur;
+		results[num_results].name = cur->name;
+		results[num_results].n = num_tracefiles;
+		results[num_results].tracefiles = tracefiles;
+		if ((results[num_results].stats =
+					(stats_t *)calloc(num_tracefiles, sizeof(stats_t))) == NULL)
+			unix_error("backend stats calloc in main failed");
+		run_traces(tracefiles, num_tracefiles, results[num_results].stats,
+				(cur->init != NULL) ? eval_mm_trace : eval_libc_trace);
+		if (verbose) {
+			printf("\nResults for %s malloc:\n", cur->name);
+			printresults(num_tracefiles, results[num_results].stats);
+			printtiming(num_tracefiles, results[num_results].stats);
+		}
+		if (touch_frac > 0)
+			printtouch(cur->name, num_tracefiles, results[num_results].stats);
+		if (perf_counters) {
+			printf("Hardware counters for %s malloc:\n", cur->name);
+			printperf(num_tracefiles, results[num_results].stats);
+		}
+		num_results++;
+	}
+	errors = mm_errors;
+	if (num_backends > 0)
+		printcompare(num_tracefiles, results, result_alloc, num_results);
+
+	/*
+	 * Write the results for scripts, and check them against a baseline
+	 */
+	pi.util = p1*100;
+	pi.thru = p2*100;
+	pi.total = perfindex;
+	pi.ref_tput = ref_tput;
+	pi.measured_ref = (ref_tput != AVG_LIBC_THRUPUT);
+
+	if (json_file != NULL &&
+			write_results_json(json_file, results, num_results,
+				(errors == 0) ? &pi : NULL, errors) != 0)
+		unix_error("Can't write the --json file");
+	if (csv_file != NULL && write_results_csv(csv_file, results, num_results) != 0)
+		unix_error("Can't write the --csv file");
+	if (baseline_file != NULL) {
+		if ((regressions = compare_baseline(baseline_file, &results[0], threshold)) < 0) {
+			fprintf(stderr, "Can't read the baseline %s\n", baseline_file);
+			exit(2);
+		}
+		if (regressions > 0)
+			exit(1);
+	}
+
 	exit(0);
 }
 
@@ -462,112 +876,628 @@ static void clear_ranges(range_t **ranges)
 }
 
 
-/**********************************************
- * The following routines manipulate tracefiles
- *********************************************/
+/*****************************************************************
+ * The following routines evaluate all of the traces for one malloc
+ * package, either in order or (with -j) in forked worker processes
+ ****************************************************************/
+
+/*
+ * run_traces - evaluate each trace, filling in stats[0..n-1]
+ */
+static void run_traces(char **tracefiles, int n, stats_t *stats,
+		eval_trace_funct eval)
+{
+	int i;
+
+	if (num_workers > 1 && n > 1) {
+		run_traces_parallel(tracefiles, n, stats, eval);
+		return;
+	}
+	for (i = 0; i < n; i++)
+		eval(tracefiles[i], i, &stats[i]);
+}
+
+/*
+ * run_traces_parallel - Fork one worker per trace, at most num_workers
+ *     at a time. A forked worker has its own copy of the memlib heap and
+ *     of the mm package's globals, so traces cannot interfere. Each
+ *     worker writes a single result_msg_t to the shared pipe; that is
+ *     well under PIPE_BUF, so the writes never interleave. With -p the
+ *     workers are pinned to distinct CPUs from our affinity mask.
+ */
+static void run_traces_parallel(char **tracefiles, int n, stats_t *stats,
+		eval_trace_funct eval)
+{
+	int fds[2];
+	int i, slot, status;
+	int next = 0, running = 0;
+	pid_t pid;
+	pid_t *slot_pid;          /* worker running in each slot, or 0 */
+	int *slot_trace;          /* ... and the trace it is evaluating */
+	int cpus[CPU_SETSIZE];    /* CPUs we are allowed to run on */
+	int num_cpus = 0;
+	cpu_set_t mask;
+	result_msg_t msg;
+
+	if ((slot_pid = (pid_t *)calloc(num_workers, sizeof(pid_t))) == NULL ||
+			(slot_trace = (int *)calloc(num_workers, sizeof(int))) == NULL)
+		unix_error("calloc failed in run_traces_parallel");
+
+	if (pin_workers) {
+		if (sched_getaffinity(0, sizeof(mask), &mask) < 0)
+			unix_error("sched_getaffinity failed in run_traces_parallel");
+		for (i = 0; i < CPU_SETSIZE; i++)
+			if (CPU_ISSET(i, &mask))
+				cpus[num_cpus++] = i;
+		if (num_cpus < num_workers)
+			printf("Warning: %d workers share %d CPUs\n", num_workers, num_cpus);
+	}
+
+	if (pipe(fds) < 0)
+		unix_error("pipe failed in run_traces_parallel");
+
+	while (next < n || running > 0) {
+		/* Start workers while there are free slots and traces left */
+		for (slot = 0; slot < num_workers && next < n; slot++) {
+			if (slot_pid[slot] != 0)
+				continue;
+
+			fflush(stdout); /* don't let the child repeat buffered output */
+			if ((pid = fork()) < 0)
+				unix_error("fork failed in run_traces_parallel");
+
+			if (pid == 0) {
+				close(fds[0]);
+				if (pin_workers) {
+					CPU_ZERO(&mask);
+					CPU_SET(cpus[slot % num_cpus], &mask);
+					if (sched_setaffinity(0, sizeof(mask), &mask) < 0)
+						unix_error("sched_setaffinity failed in worker");
+				}
+				errors = 0;
+				memset(&msg, 0, sizeof(msg));
+				msg.tracenum = next;
+				eval(tracefiles[next], next, &msg.stats);
+				msg.errors = errors;
+				fflush(stdout);
+				if (write(fds[1], &msg, sizeof(msg)) != sizeof(msg))
+					unix_error("write failed in worker");
+				_exit(0);
+			}
+
+			slot_pid[slot] = pid;
+			slot_trace[slot] = next++;
+			running++;
+		}
+
+		/* Wait for any worker to finish, then collect what it sent */
+		if ((pid = wait(&status)) < 0)
+			unix_error("wait failed in run_traces_parallel");
+		for (slot = 0; slot < num_workers && slot_pid[slot] != pid; slot++)
+			;
+		if (slot == num_workers)
+			continue; /* not one of ours */
+		slot_pid[slot] = 0;
+		running--;
+
+		if (WIFEXITED(status) && WEXITSTATUS(status) == 0) {
+			if (read(fds[0], &msg, sizeof(msg)) != sizeof(msg))
+				unix_error("read failed in run_traces_parallel");
+			stats[msg.tracenum] = msg.stats;
+			errors += msg.errors;
+		}
+		else {
+			/* A crashed or failed worker counts as an invalid trace */
+			i = slot_trace[slot];
+			memset(&stats[i], 0, sizeof(stats_t));
+			malloc_error(i, 0, "worker process died before reporting");
+		}
+	}
+
+	close(fds[0]);
+	close(fds[1]);
+	free(slot_pid);
+	free(slot_trace);
+}
+
+/*
+ * eval_libc_trace - check libc malloc on one trace and time it
+ */
+static void eval_libc_trace(char *tracefile, int tracenum, stats_t *stats)
+{
+	trace_t *trace;
+	speed_t speed_params;
+
+	trace = load_trace(tracedir, tracefile);
+	stats->ops = trace->num_ops;
+	printf("Checking %s malloc for correctness, ", cur->name);
+	stats->valid = eval_libc_valid(trace, tracenum);
+	if (stats->valid) {
+		speed_params.trace = trace;
+		printf("and performance.\n");
+		stats->secs = time_speed(eval_libc_speed, &speed_params, stats);
+		if (touch_frac > 0)
+			stats->touch_secs = time_touch(trace);
+		if (lat_pass)
+			eval_latency(trace, tracefile, tracenum, stats);
+	}
+	unload_trace(trace);
+}
 
 /*
- * read_trace - read a trace file and store it in memory
+ * eval_mm_trace - check mm malloc on one trace, then measure its
+ *     space utilization and time it
  */
-static trace_t *read_trace(char *tracedir, char *filename)
+static void eval_mm_trace(char *tracefile, int tracenum, stats_t *stats)
 {
-	FILE *tracefile;
 	trace_t *trace;
-	char type[MAXLINE];
-	char path[MAXLINE];
-	unsigned index, size;
-	unsigned max_index = 0;
-	unsigned op_index;
+	range_t *ranges = NULL;  /* keeps track of block extents for the trace */
+	speed_t speed_params;
+	timeline_t tl;
+	heapuse_t *use = NULL;   /* the heap over the util run, for --handles */
+
+	current_trace_name = tracefile;
 
+	trace = load_trace(tracedir, tracefile);
+	stats->ops = trace->num_ops;
+	if (hint_frac > 0)
+		op_hints = lifetime_hints(trace);
 	if (verbose > 1)
-		printf("Reading tracefile: %s\n", filename);
-
-	/* Allocate the trace record */
-	if ((trace = (trace_t *) malloc(sizeof(trace_t))) == NULL)
-		unix_error("malloc 1 failed in read_trance");
-
-	/* Read the trace file header */
-	strcpy(path, tracedir);
-	strcat(path, filename);
-	if ((tracefile = fopen(path, "r")) == NULL) {
-		sprintf(msg, "Could not open %s in read_trace", path);
-		unix_error(msg);
+		printf("Checking mm_malloc for correctness, ");
+	stats->valid = eval_mm_valid(trace, tracenum, &ranges);
+	if (stats->valid) {
+		if (verbose > 1)
+			printf("efficiency, ");
+		if (handle_pass && cur == &mm_backend)
+			use = &stats->plain_use;
+		if (timeline_file != NULL && cur == &mm_backend) {
+			tl_init(&tl, trace->num_ops, timeline_points);
+			stats->util = eval_mm_util(trace, tracenum, &ranges, &tl, use);
+			stats->frag = *tl_peak(&tl);
+			if (tl_write(&tl, timeline_file, tracenum, tracefile) != 0)
+				unix_error("Can't append to the --timeline file");
+			tl_free(&tl);
+		}
+		else
+			stats->util = eval_mm_util(trace, tracenum, &ranges, NULL, use);
+		speed_params.trace = trace;
+		speed_params.ranges = ranges;
+		if (verbose > 1)
+			printf("and performance.\n");
+		stats->secs = time_speed(eval_mm_speed, &speed_params, stats);
+		if (touch_frac > 0)
+			stats->touch_secs = time_touch(trace);
+		if (use != NULL && eval_handles(trace, tracenum, stats))
+			stats->handle_secs = time_handles(trace);
+		if (lat_pass)
+			eval_latency(trace, tracefile, tracenum, stats);
+	}
+	clear_ranges(&ranges);
+	free(op_hints);
+	op_hints = NULL;
+	unload_trace(trace);
+}
+
+/*
+ * eval_latency - Replay the trace once more, timing every request on
+ *     its own, and print latency percentiles per request type (-L).
+ *     This is a separate pass so that the timer reads don't slow down
+ *     the throughput measurement.
+ */
+static void eval_latency(trace_t *trace, char *tracefile, int tracenum,
+		stats_t *stats)
+{
+	int i;
+	char *p;
+	traceop_t *op;
+	unsigned long long t0, t1;
+	lat_t lat;
+
+	lat_init(&lat, lat_slowest);
+	start_pass(trace);
+	if (cur->init != NULL) {
+		mem_reset_brk();
+		if (cur->init() < 0)
+			app_error("mm_init failed in eval_latency");
 	}
 
-	assert(fscanf(tracefile, "%d", &(trace->sugg_heapsize)) == 1); /* not used */
-	assert(fscanf(tracefile, "%d", &(trace->num_ids)) == 1);
-	assert(fscanf(tracefile, "%d", &(trace->num_ops)) == 1);
-	assert(fscanf(tracefile, "%d", &(trace->weight)) == 1);        /* not used */
-
-	/* We'll store each request line in the trace in this array */
-	if ((trace->ops =
-				(traceop_t *)malloc(trace->num_ops * sizeof(traceop_t))) == NULL)
-		unix_error("malloc 2 failed in read_trace");
-
-	/* We'll keep an array of pointers to the allocated blocks here... */
-	if ((trace->blocks =
-				(char **)malloc(trace->num_ids * sizeof(char *))) == NULL)
-		unix_error("malloc 3 failed in read_trace");
-
-	/* ... along with the corresponding byte sizes of each block */
-	if ((trace->block_sizes =
-				(size_t *)malloc(trace->num_ids * sizeof(size_t))) == NULL)
-		unix_error("malloc 4 failed in read_trace");
-
-	/* read every request line in the trace file */
-	index = 0;
-	op_index = 0;
-	while (fscanf(tracefile, "%s", type) != EOF) {
-		switch(type[0]) {
-			case 'a':
-				assert(fscanf(tracefile, "%u %u", &index, &size)==2);
-				trace->ops[op_index].type = ALLOC;
-				trace->ops[op_index].index = index;
-				trace->ops[op_index].size = size;
-				max_index = (index > max_index) ? index : max_index;
-				break;
-			case 'r':
-				assert(fscanf(tracefile, "%u %u", &index, &size)==2);
-				trace->ops[op_index].type = REALLOC;
-				trace->ops[op_index].index = index;
-				trace->ops[op_index].size = size;
-				max_index = (index > max_index) ? index : max_index;
-				break;
-			case 'f':
-				assert(fscanf(tracefile, "%ud", &index)==1);
-				trace->ops[op_index].type = FREE;
-				trace->ops[op_index].index = index;
+	for (i = 0;  (op = next_op(trace, i)) != NULL;  i++) {
+		switch (op->type) {
+			case ALLOC:
+				t0 = lat_cycles();
+				p = alloc_op(cur, i, op->size);
+				t1 = lat_cycles();
+				if (p == NULL)
+					app_error("malloc failed in eval_latency");
+				trace->blocks[op->index] = p;
+				break;
+
+			case REALLOC:
+				t0 = lat_cycles();
+				p = cur->realloc(trace->blocks[op->index], op->size);
+				t1 = lat_cycles();
+				if (p == NULL)
+					app_error("realloc failed in eval_latency");
+				trace->blocks[op->index] = p;
+				break;
+
+			case FREE:
+				p = trace->blocks[op->index];
+				t0 = lat_cycles();
+				cur->free(p);
+				t1 = lat_cycles();
 				break;
+
 			default:
-				printf("Bogus type character (%c) in tracefile %s\n",
-						type[0], path);
-				exit(1);
+				app_error("Nonexistent request type in eval_latency");
+				return;
 		}
-		op_index++;
+		lat_record(&lat, op, i, t1 - t0);
+	}
+
+	printf("\nLatency of %s malloc on trace %d (%s):\n",
+			cur->name, tracenum, tracefile);
+	lat_report(&lat);
+	lat_summarize(&lat, stats->lat);
+	lat_free(&lat);
+}
+
+/*****************************************************************
+ * The following routines replay each trace on 1..max_threads threads
+ * (-T) to show how the allocator scales across cores
+ ****************************************************************/
 
+/*
+ * mm.c is not thread safe. Unless it was built with -DMM_THREADSAFE,
+ * the threaded replay serializes mm calls through this lock, which
+ * gives the throughput of a single big lock around the allocator.
+ */
+#ifndef MM_THREADSAFE
+static pthread_mutex_t mm_lock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+static void *mm_malloc_locked(size_t size)
+{
+#ifdef MM_THREADSAFE
+	return mm_malloc(size);
+#else
+	void *p;
+
+	pthread_mutex_lock(&mm_lock);
+	p = mm_malloc(size);
+	pthread_mutex_unlock(&mm_lock);
+	return p;
+#endif
+}
+
+static void mm_free_locked(void *ptr)
+{
+#ifdef MM_THREADSAFE
+	mm_free(ptr);
+#else
+	pthread_mutex_lock(&mm_lock);
+	mm_free(ptr);
+	pthread_mutex_unlock(&mm_lock);
+#endif
+}
+
+static void *mm_realloc_locked(void *ptr, size_t size)
+{
+#ifdef MM_THREADSAFE
+	return mm_realloc(ptr, size);
+#else
+	void *p;
+
+	pthread_mutex_lock(&mm_lock);
+	p = mm_realloc(ptr, size);
+	pthread_mutex_unlock(&mm_lock);
+	return p;
+#endif
+}
+
+/*
+ * eval_mt_scaling - For every trace and every thread count from 1 to
+ *     max_threads, keep the best of MT_RUNS threaded replays and print
+ *     its aggregate throughput and the range of per-thread throughputs
+ *     (every thread's with -v).
+ */
+static void eval_mt_scaling(char **tracefiles, int n, int use_libc)
+{
+	static mt_alloc_t libc_alloc = {malloc, free, realloc};
+	static mt_alloc_t mm_alloc = {mm_malloc_locked, mm_free_locked,
+		mm_realloc_locked};
+	mt_alloc_t *alloc = use_libc ? &libc_alloc : &mm_alloc;
+	trace_t *trace;
+	mt_result_t res, best;
+	int i, t, nthreads, run;
+	double kops, min_kops, max_kops;
+
+	if (stream_traces)
+		app_error("Threaded replay (-T) needs traces in memory; drop -S");
+
+	res.thread_secs = (double *)malloc(max_threads * sizeof(double));
+	res.thread_ops = (int *)malloc(max_threads * sizeof(int));
+	best.thread_secs = (double *)malloc(max_threads * sizeof(double));
+	best.thread_ops = (int *)malloc(max_threads * sizeof(int));
+	if (!res.thread_secs || !res.thread_ops || !best.thread_secs || !best.thread_ops)
+		unix_error("malloc failed in eval_mt_scaling");
+
+	if (!use_libc) {
+		mem_init();
+#ifndef MM_THREADSAFE
+		printf("mm.c was not built with -DMM_THREADSAFE; calls are serialized by a lock\n");
+#endif
+	}
+
+	for (i = 0; i < n; i++) {
+		trace = read_trace(tracedir, tracefiles[i]);
+		printf("\nThreaded replay of %s with %s malloc (%d trace thread%s):\n",
+				tracefiles[i], use_libc ? "libc" : "mm", trace->num_threads,
+				(trace->num_threads > 1) ? "s" : ", split by block id");
+		printf("%7s%10s%12s%12s\n", "threads", "Kops", "min thr", "max thr");
+
+		for (nthreads = 1; nthreads <= max_threads; nthreads++) {
+			best.secs = 0;
+			for (run = 0; run < MT_RUNS; run++) {
+				if (!use_libc) {
+					mem_reset_brk();
+					if (mm_init() < 0)
+						app_error("mm_init failed in eval_mt_scaling");
+				}
+				if (mt_replay(trace, nthreads, alloc, &res) < 0) {
+					malloc_error(i, 0, "allocation failed in threaded replay");
+					break;
+				}
+				if (best.secs == 0 || res.secs < best.secs) {
+					best.nthreads = res.nthreads;
+					best.secs = res.secs;
+					memcpy(best.thread_secs, res.thread_secs, nthreads * sizeof(double));
+					memcpy(best.thread_ops, res.thread_ops, nthreads * sizeof(int));
+				}
+			}
+			if (best.secs == 0)
+				break;
+
+			/* Per-thread throughput: each thread's ops over its own time */
+			min_kops = max_kops = -1;
+			for (t = 0; t < nthreads; t++) {
+				if (best.thread_ops[t] == 0)
+					continue;
+				kops = (best.thread_ops[t]/1e3)/best.thread_secs[t];
+				if (min_kops < 0 || kops < min_kops)
+					min_kops = kops;
+				if (kops > max_kops)
+					max_kops = kops;
+			}
+			printf("%7d%10.0f%12.0f%12.0f\n", nthreads,
+					(trace->num_ops/1e3)/best.secs, min_kops, max_kops);
+
+			if (verbose) {
+				for (t = 0; t < nthreads; t++)
+					printf("%17s%2d: %8d ops%10.0f Kops\n", "thread", t,
+							best.thread_ops[t], best.thread_ops[t] ?
+							(best.thread_ops[t]/1e3)/best.thread_secs[t] : 0.0);
+			}
+		}
+		free_trace(trace);
 	}
-	fclose(tracefile);
-	assert(max_index == trace->num_ids - 1);
-	assert(trace->num_ops == op_index);
 
-	return trace;
+	free(res.thread_secs);
+	free(res.thread_ops);
+	free(best.thread_secs);
+	free(best.thread_ops);
 }
 
+/*****************************************************************
+ * The following routines hide whether a trace was read into memory
+ * or is being streamed from disk by tracestream.c
+ ****************************************************************/
+
 /*
- * free_trace - Free the trace record and the three arrays it points
- *              to, all of which were allocated in read_trace().
+ * load_trace - read a trace into memory, or open it for streaming (-S)
  */
-void free_trace(trace_t *trace)
+static trace_t *load_trace(char *tracedir, char *filename)
 {
-	free(trace->ops);         /* free the three arrays... */
-	free(trace->blocks);
-	free(trace->block_sizes);
-	free(trace);              /* and the trace record itself... */
+	if (stream_traces)
+		return open_trace_stream(tracedir, filename);
+	return read_trace(tracedir, filename);
+}
+
+/*
+ * unload_trace - release whatever load_trace set up
+ */
+static void unload_trace(trace_t *trace)
+{
+	if (trace->stream != NULL)
+		close_trace_stream(trace);
+	else
+		free_trace(trace);
+}
+
+/*
+ * start_pass - every evaluation pass calls this before its first op
+ */
+static void start_pass(trace_t *trace)
+{
+	if (trace->stream != NULL)
+		rewind_trace_stream(trace);
+}
+
+/*
+ * next_op - return op i of the trace, or NULL past the last op
+ */
+static inline traceop_t *next_op(trace_t *trace, int i)
+{
+	if (trace->stream == NULL)
+		return (i < trace->num_ops) ? &trace->ops[i] : NULL;
+	return trace_stream_op(trace, i);
+}
+
+/*
+ * lifetime_hints - the MM_HINT_* for each alloc op of an in-memory
+ *     trace (--hint). A block is short-lived if it is freed, through
+ *     any reallocs, within hint_frac of the trace's ops.
+ */
+static unsigned char *lifetime_hints(trace_t *trace)
+{
+	unsigned char *hints;
+	int *freed_at;  /* op that frees each id next, or -1 */
+	int i, id;
+	double short_ops = hint_frac * trace->num_ops;
+
+	hints = (unsigned char *)calloc(trace->num_ops, 1);
+	freed_at = (int *)malloc(trace->num_ids * sizeof(int));
+	if (hints == NULL || freed_at == NULL)
+		unix_error("malloc failed in lifetime_hints");
+	memset(freed_at, 0xff, trace->num_ids * sizeof(int));
+
+	for (i = trace->num_ops - 1; i >= 0; i--) {
+		id = trace->ops[i].index;
+		if (trace->ops[i].type == FREE)
+			freed_at[id] = i;
+		else if (trace->ops[i].type == ALLOC) {
+			hints[i] = (freed_at[id] >= 0 && freed_at[id] - i < short_ops) ?
+				MM_HINT_SHORT : MM_HINT_LONG;
+			freed_at[id] = -1;  /* an earlier use of id is another block */
+		}
+	}
+	free(freed_at);
+	return hints;
+}
+
+/*
+ * alloc_op - malloc for op i, with its --hint if the allocator takes one
+ */
+static inline void *alloc_op(backend_t *b, int i, size_t size)
+{
+	if (op_hints != NULL && b->malloc_hint != NULL)
+		return b->malloc_hint(size, op_hints[i]);
+	return b->malloc(size);
+}
+
+/*
+ * time_speed - Time one of the xxx_speed functions with fsecs. For a
+ *     streamed trace, the time the replay spent waiting on the reader
+ *     thread is averaged over the runs and taken out of the result.
+ *     The spread of the runs goes into stats->timing and, with -P, the
+ *     hardware events of the average run into stats->perf.
+ */
+static double time_speed(fsecs_test_funct f, speed_t *speed_params, stats_t *stats)
+{
+	trace_t *trace = speed_params->trace;
+	double *perf = stats->perf;
+	double secs, stall = 0;
+	perfctr_t pc;
+	int i;
+
+	speed_params->runs = 0;
+	if (trace->stream != NULL)
+		trace_stream_stall(trace); /* discard stalls from earlier passes */
+
+	for (i = 0; i < PERF_NUM_EVENTS; i++)
+		perf[i] = -1;
+	speed_params->perf = NULL;
+	if (perf_counters && perf_open(&pc) > 0)
+		speed_params->perf = &pc;
+
+	secs = fsecs(f, speed_params);
+	fsecs_last_stats(&stats->timing);
+
+	if (speed_params->perf != NULL) {
+		for (i = 0; i < PERF_NUM_EVENTS; i++)
+			if (pc.fd[i] >= 0 && speed_params->runs > 0)
+				perf[i] = pc.count[i] / speed_params->runs;
+		perf_close(&pc);
+		speed_params->perf = NULL;
+	}
+
+	if (trace->stream != NULL && speed_params->runs > 0) {
+		stall = trace_stream_stall(trace) / speed_params->runs;
+		if (verbose > 1)
+			printf("Replay waited %.6f secs per run on the trace reader\n", stall);
+		secs = (secs > stall) ? secs - stall : 0;
+		if (stats->timing.runs > 0) {
+			stats->timing.median = secs;
+			stats->timing.ci_lo = (stats->timing.ci_lo > stall) ? stats->timing.ci_lo - stall : 0;
+			stats->timing.ci_hi = (stats->timing.ci_hi > stall) ? stats->timing.ci_hi - stall : 0;
+		}
+	}
+	return secs;
+}
+
+/*
+ * time_touch - Time the trace again with payload accesses (--touch).
+ *     The caches are flushed first, so no trace starts out with data
+ *     that an earlier trace or allocator left in them.
+ */
+static double time_touch(trace_t *trace)
+{
+	speed_t speed_params;
+	touch_t touch;
+	double secs;
+
+	memset(&speed_params, 0, sizeof(speed_params));
+	touch_init(&touch, trace->num_ids, touch_frac, touch_write);
+	speed_params.trace = trace;
+	speed_params.touch = &touch;
+	fcyc_flush_cache();
+	secs = fsecs(eval_touch_speed, &speed_params);
+	touch_deinit(&touch);
+	return secs;
+}
+
+/*
+ * time_handles - Time the trace again through mm_halloc, mm_hrealloc
+ *     and mm_hfree (--handles), compaction included.
+ */
+static double time_handles(trace_t *trace)
+{
+	speed_t speed_params;
+	double secs;
+
+	memset(&speed_params, 0, sizeof(speed_params));
+	speed_params.trace = trace;
+	if ((speed_params.handles = (mm_handle_t *)malloc(trace->num_ids *
+					sizeof(mm_handle_t))) == NULL)
+		unix_error("malloc failed in time_handles");
+	secs = fsecs(eval_handle_speed, &speed_params);
+	free(speed_params.handles);
+	return secs;
+}
+
+/*
+ * use_sample - add the heap after a request to the sums in use
+ */
+static inline void use_sample(heapuse_t *use, size_t live)
+{
+	size_t heap = mem_heapsize();
+
+	use->mean_heap += heap;
+	use->mean_live += live;
+	if (heap > use->peak_heap)
+		use->peak_heap = heap;
+	if (live > use->peak_live)
+		use->peak_live = live;
+}
+
+/*
+ * use_end - turn the sums in use into means over ops requests
+ */
+static void use_end(heapuse_t *use, int ops)
+{
+	if (ops > 0) {
+		use->mean_heap /= ops;
+		use->mean_live /= ops;
+	}
+	use->end_heap = mem_heapsize();
 }
 
 /**********************************************************************
  * The following functions evaluate the correctness, space utilization,
- * and throughput of the libc and mm malloc packages.
+ * and throughput of the libc and mm malloc packages. They call the
+ * allocator through cur, so the eval_mm_* functions also run --alloc
+ * backends with the mm interface, and the eval_libc_* functions those
+ * with the malloc interface.
  **********************************************************************/
 
 /*
@@ -582,13 +1512,15 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
 	char *newp;
 	char *oldp;
 	char *p;
+	traceop_t *op;
 
 	/* Reset the heap and free any records in the range list */
 	mem_reset_brk();
 	clear_ranges(ranges);
+	start_pass(trace);
 
 	/* Call the mm package's init function */
-	if (mm_init() < 0) {
+	if (cur->init() < 0) {
 		malloc_error(tracenum, 0, "mm_init failed.");
 		return 0;
 	}
@@ -597,20 +1529,20 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
 	trace_operations = trace->ops;
 
 	/* Interpret each operation in the trace in order */
-	for (i = 0;  i < trace->num_ops;  i++) {
-		index = trace->ops[i].index;
-		size = trace->ops[i].size;
+	for (i = 0;  (op = next_op(trace, i)) != NULL;  i++) {
+		index = op->index;
+		size = op->size;
 
 		/* Set global per-trace variables for Michael and Nabil to debug with */
 		traceop_index = i;
 		traceop_ptr = index;
 
-		switch (trace->ops[i].type) {
+		switch (op->type) {
 
 			case ALLOC: /* mm_malloc */
 
 				/* Call the student's malloc */
-				if ((p = mm_malloc(size)) == NULL) {
+				if ((p = alloc_op(cur, i, size)) == NULL) {
 					malloc_error(tracenum, i, "mm_malloc failed.");
 					return 0;
 				}
@@ -639,7 +1571,7 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
 
 				/* Call the student's realloc */
 				oldp = trace->blocks[index];
-				if ((newp = mm_realloc(oldp, size)) == NULL) {
+				if ((newp = cur->realloc(oldp, size)) == NULL) {
 					malloc_error(tracenum, i, "mm_realloc failed.");
 					return 0;
 				}
@@ -659,7 +1591,7 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
 				oldsize = trace->block_sizes[index];
 				if (size < oldsize) oldsize = size;
 				for (j = 0; j < oldsize; j++) {
-					if (newp[j] != (index & 0xFF)) {
+					if ((unsigned char)newp[j] != (index & 0xFF)) {
 						malloc_error(tracenum, i, "mm_realloc did not preserve the "
 								"data from old block");
 						return 0;
@@ -677,7 +1609,7 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
 				/* Remove region from list and call student's free function */
 				p = trace->blocks[index];
 				remove_range(ranges, p);
-				mm_free(p);
+				cur->free(p);
 				break;
 
 			default:
@@ -696,12 +1628,14 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
  *   an optimal allocator, i.e., no gaps and no internal fragmentation.
  *   Utilization is the ratio hwm/heapsize, where heapsize is the
  *   size of the heap in bytes after running the student's malloc
- *   package on the trace. Note that our implementation of mem_sbrk()
- *   doesn't allow the students to decrement the brk pointer, so brk
- *   is always the high water mark of the heap.
- *
+ *   package on the trace. Note that mm.c only decrements the brk
+ *   pointer when its compactor runs, which the handle calls start and
+ *   mm_malloc and mm_free never do, so brk is always the high water
+ *   mark of the heap here. If use is not NULL, the heap over the run
+ *   is recorded in it for --handles.
  */
-static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
+static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges,
+		timeline_t *tl, heapuse_t *use)
 {
 	int i;
 	int index;
@@ -710,20 +1644,30 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
 	int total_size = 0;
 	char *p;
 	char *newp, *oldp;
+	traceop_t *op;
+	int snap = 0;  /* next entry of snap_ops; none but for the built-in mm */
 
 	/* initialize the heap and the mm malloc package */
 	mem_reset_brk();
-	if (mm_init() < 0)
+	start_pass(trace);
+	if (cur->init() < 0)
 		app_error("mm_init failed in eval_mm_util");
+	if (cur != &mm_backend)
+		snap = num_snap_ops;
+
+	for (i = 0;  (op = next_op(trace, i)) != NULL;  i++) {
+		if (TL_DUE(tl, i))
+			tl_sample(tl, i, total_size);
+		if (snap < num_snap_ops && snap_ops[snap] == i)
+			take_snapshot(tracenum, snap_ops[snap++], total_size);
 
-	for (i = 0;  i < trace->num_ops;  i++) {
-		switch (trace->ops[i].type) {
+		switch (op->type) {
 
 			case ALLOC: /* mm_alloc */
-				index = trace->ops[i].index;
-				size = trace->ops[i].size;
+				index = op->index;
+				size = op->size;
 
-				if ((p = mm_malloc(size)) == NULL)
+				if ((p = alloc_op(cur, i, size)) == NULL)
 					app_error("mm_malloc failed in eval_mm_util");
 
 				/* Remember region and size */
@@ -740,12 +1684,12 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
 				break;
 
 			case REALLOC: /* mm_realloc */
-				index = trace->ops[i].index;
-				newsize = trace->ops[i].size;
+				index = op->index;
+				newsize = op->size;
 				oldsize = trace->block_sizes[index];
 
 				oldp = trace->blocks[index];
-				if ((newp = mm_realloc(oldp,newsize)) == NULL)
+				if ((newp = cur->realloc(oldp,newsize)) == NULL)
 					app_error("mm_realloc failed in eval_mm_util");
 
 				/* Remember region and size */
@@ -762,11 +1706,11 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
 				break;
 
 			case FREE: /* mm_free */
-				index = trace->ops[i].index;
+				index = op->index;
 				size = trace->block_sizes[index];
 				p = trace->blocks[index];
 
-				mm_free(p);
+				cur->free(p);
 
 				/* Keep track of current total size
 				 * of all allocated blocks */
@@ -778,12 +1722,156 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
 				app_error("Nonexistent request type in eval_mm_util");
 
 		}
+		if (use != NULL)
+			use_sample(use, total_size);
 	}
+	if (use != NULL)
+		use_end(use, i);
+	if (tl != NULL)
+		tl_sample(tl, i, total_size);
+	if (snap < num_snap_ops)  /* "end", or past the end of this trace */
+		take_snapshot(tracenum, i, total_size);
 
 	return ((double)max_total_size / (double)mem_heapsize());
 }
 
 
+/*
+ * eval_handles - Replay the trace with relocatable blocks (--handles),
+ *     checking that every block keeps its data while the compactor
+ *     moves it, and record the heap over the replay and what the
+ *     compactor did. Returns 1 if the blocks kept their data, else 0.
+ */
+static int eval_handles(trace_t *trace, int tracenum, stats_t *stats)
+{
+	int i, j, index, size, oldsize;
+	size_t live = 0;
+	mm_handle_t *handles;
+	unsigned char *p;
+	traceop_t *op;
+
+	if ((handles = (mm_handle_t *)malloc(trace->num_ids * sizeof(mm_handle_t))) == NULL)
+		unix_error("malloc failed in eval_handles");
+	memset(&stats->handle_use, 0, sizeof(heapuse_t));
+	mem_reset_brk();
+	start_pass(trace);
+	if (mm_init() < 0)
+		app_error("mm_init failed in eval_handles");
+
+	for (i = 0;  (op = next_op(trace, i)) != NULL;  i++) {
+		index = op->index;
+		size = op->size;
+		switch (op->type) {
+			case ALLOC:
+				if ((handles[index] = mm_halloc(size)) == MM_NULL_HANDLE) {
+					malloc_error(tracenum, i, "mm_halloc failed.");
+					free(handles);
+					return 0;
+				}
+				memset(mm_hderef(handles[index]), index & 0xFF, size);
+				trace->block_sizes[index] = size;
+				live += size;
+				break;
+
+			case REALLOC:
+				if (mm_hrealloc(handles[index], size) == MM_NULL_HANDLE) {
+					malloc_error(tracenum, i, "mm_hrealloc failed.");
+					free(handles);
+					return 0;
+				}
+				oldsize = trace->block_sizes[index];
+				p = (unsigned char *)mm_hderef(handles[index]);
+				for (j = 0; j < oldsize && j < size; j++) {
+					if (p[j] != (index & 0xFF)) {
+						malloc_error(tracenum, i, "mm_hrealloc did not preserve "
+								"the data from the old block");
+						free(handles);
+						return 0;
+					}
+				}
+				memset(p, index & 0xFF, size);
+				trace->block_sizes[index] = size;
+				live += size - oldsize;
+				break;
+
+			case FREE:
+				p = (unsigned char *)mm_hderef(handles[index]);
+				for (j = 0; j < (int)trace->block_sizes[index]; j++) {
+					if (p[j] != (index & 0xFF)) {
+						malloc_error(tracenum, i, "a relocatable block lost its data");
+						free(handles);
+						return 0;
+					}
+				}
+				mm_hfree(handles[index]);
+				live -= trace->block_sizes[index];
+				break;
+
+			default:
+				app_error("Nonexistent request type in eval_handles");
+		}
+		use_sample(&stats->handle_use, live);
+	}
+	use_end(&stats->handle_use, i);
+	mm_compact_stats(&stats->compact);
+	free(handles);
+	return 1;
+}
+
+/*
+ * parse_snap_ops - Read the --snapshot list: request numbers and "end",
+ *     separated by commas. They are kept sorted and without duplicates,
+ *     so eval_mm_util only ever has to check the next one.
+ */
+static void parse_snap_ops(char *list)
+{
+	char *tok, *end;
+	int i, j, op;
+
+	for (tok = strtok(list, ","); tok != NULL; tok = strtok(NULL, ",")) {
+		if (strcmp(tok, "end") == 0)
+			op = SNAP_END;
+		else {
+			op = strtol(tok, &end, 10);
+			if (*tok == '\0' || *end != '\0' || op < 0) {
+				usage();
+				exit(1);
+			}
+		}
+		for (i = 0; i < num_snap_ops && snap_ops[i] < op; i++)
+			;
+		if (i < num_snap_ops && snap_ops[i] == op)
+			continue;
+		if ((snap_ops = realloc(snap_ops, (num_snap_ops + 1) * sizeof(int))) == NULL)
+			unix_error("realloc failed in parse_snap_ops");
+		for (j = num_snap_ops++; j > i; j--)
+			snap_ops[j] = snap_ops[j - 1];
+		snap_ops[i] = op;
+	}
+}
+
+/*
+ * take_snapshot - Dump the mm heap to <snap_dir>/<trace>.<op>.snap,
+ *     where <trace> is the trace file name without directory or .rep
+ */
+static void take_snapshot(int tracenum, int op, size_t live)
+{
+	char path[MAXLINE + 64], name[MAXLINE];
+	char *base, *dot;
+
+	base = strrchr(current_trace_name, '/');
+	strncpy(name, base ? base + 1 : current_trace_name, MAXLINE - 1);
+	name[MAXLINE - 1] = '\0';
+	if ((dot = strrchr(name, '.')) != NULL && dot != name)
+		*dot = '\0';
+
+	snprintf(path, sizeof(path), "%s/%s.%d.snap", snap_dir, name, op);
+	if (snap_write(path, tracenum, op, live) != 0)
+		unix_error("Can't write a --snapshot file");
+	if (verbose > 1)
+		printf("Wrote heap snapshot %s\n", path);
+}
+
 /*
  * eval_mm_speed - This is the function that is used by fcyc()
  *    to measure the running time of the mm malloc package.
@@ -792,43 +1880,54 @@ static void eval_mm_speed(void *ptr)
 {
 	int i, index, size, newsize;
 	char *p, *newp, *oldp, *block;
+	traceop_t *op;
 	trace_t *trace = ((speed_t *)ptr)->trace;
+	backend_t *b = cur;  /* in a register, not reloaded after each call */
+
+	((speed_t *)ptr)->runs++;
+	start_pass(trace);
 
 	/* Reset the heap and initialize the mm package */
 	mem_reset_brk();
-	if (mm_init() < 0)
+	if (b->init() < 0)
 		app_error("mm_init failed in eval_mm_speed");
 
+	if (((speed_t *)ptr)->perf != NULL)
+		perf_start(((speed_t *)ptr)->perf);
+
 	/* Interpret each trace request */
-	for (i = 0;  i < trace->num_ops;  i++)
-		switch (trace->ops[i].type) {
+	for (i = 0;  (op = next_op(trace, i)) != NULL;  i++)
+		switch (op->type) {
 
 			case ALLOC: /* mm_malloc */
-				index = trace->ops[i].index;
-				size = trace->ops[i].size;
-				if ((p = mm_malloc(size)) == NULL)
+				index = op->index;
+				size = op->size;
+				if ((p = alloc_op(b, i, size)) == NULL)
 					app_error("mm_malloc error in eval_mm_speed");
 				trace->blocks[index] = p;
 				break;
 
 			case REALLOC: /* mm_realloc */
-				index = trace->ops[i].index;
-				newsize = trace->ops[i].size;
+				index = op->index;
+				newsize = op->size;
 				oldp = trace->blocks[index];
-				if ((newp = mm_realloc(oldp,newsize)) == NULL)
+				if ((newp = b->realloc(oldp,newsize)) == NULL)
 					app_error("mm_realloc error in eval_mm_speed");
 				trace->blocks[index] = newp;
 				break;
 
 			case FREE: /* mm_free */
-				index = trace->ops[i].index;
+				index = op->index;
 				block = trace->blocks[index];
-				mm_free(block);
+				b->free(block);
 				break;
 
 			default:
 				app_error("Nonexistent request type in eval_mm_valid");
 		}
+
+	if (((speed_t *)ptr)->perf != NULL)
+		perf_stop(((speed_t *)ptr)->perf);
 }
 
 /*
@@ -841,30 +1940,32 @@ static int eval_libc_valid(trace_t *trace, int tracenum)
 {
 	int i, newsize;
 	char *p, *newp, *oldp;
+	traceop_t *op;
 
-	for (i = 0;  i < trace->num_ops;  i++) {
-		switch (trace->ops[i].type) {
+	start_pass(trace);
+	for (i = 0;  (op = next_op(trace, i)) != NULL;  i++) {
+		switch (op->type) {
 
 			case ALLOC: /* malloc */
-				if ((p = malloc(trace->ops[i].size)) == NULL) {
+				if ((p = cur->malloc(op->size)) == NULL) {
 					malloc_error(tracenum, i, "libc malloc failed");
 					unix_error("System message");
 				}
-				trace->blocks[trace->ops[i].index] = p;
+				trace->blocks[op->index] = p;
 				break;
 
 			case REALLOC: /* realloc */
-				newsize = trace->ops[i].size;
-				oldp = trace->blocks[trace->ops[i].index];
-				if ((newp = realloc(oldp, newsize)) == NULL) {
+				newsize = op->size;
+				oldp = trace->blocks[op->index];
+				if ((newp = cur->realloc(oldp, newsize)) == NULL) {
 					malloc_error(tracenum, i, "libc realloc failed");
 					unix_error("System message");
 				}
-				trace->blocks[trace->ops[i].index] = newp;
+				trace->blocks[op->index] = newp;
 				break;
 
 			case FREE: /* free */
-				free(trace->blocks[trace->ops[i].index]);
+				cur->free(trace->blocks[op->index]);
 				break;
 
 			default:
@@ -885,35 +1986,144 @@ static void eval_libc_speed(void *ptr)
 	int i;
 	int index, size, newsize;
 	char *p, *newp, *oldp, *block;
+	traceop_t *op;
 	trace_t *trace = ((speed_t *)ptr)->trace;
+	backend_t *b = cur;
 
-	for (i = 0;  i < trace->num_ops;  i++) {
-		switch (trace->ops[i].type) {
+	((speed_t *)ptr)->runs++;
+	start_pass(trace);
+
+	if (((speed_t *)ptr)->perf != NULL)
+		perf_start(((speed_t *)ptr)->perf);
+
+	for (i = 0;  (op = next_op(trace, i)) != NULL;  i++) {
+		switch (op->type) {
 			case ALLOC: /* malloc */
-				index = trace->ops[i].index;
-				size = trace->ops[i].size;
-				if ((p = malloc(size)) == NULL)
+				index = op->index;
+				size = op->size;
+				if ((p = b->malloc(size)) == NULL)
 					unix_error("malloc failed in eval_libc_speed");
 				trace->blocks[index] = p;
 				break;
 
 			case REALLOC: /* realloc */
-				index = trace->ops[i].index;
-				newsize = trace->ops[i].size;
+				index = op->index;
+				newsize = op->size;
 				oldp = trace->blocks[index];
-				if ((newp = realloc(oldp, newsize)) == NULL)
+				if ((newp = b->realloc(oldp, newsize)) == NULL)
 					unix_error("realloc failed in eval_libc_speed\n");
 
 				trace->blocks[index] = newp;
 				break;
 
 			case FREE: /* free */
-				index = trace->ops[i].index;
+				index = op->index;
 				block = trace->blocks[index];
-				free(block);
+				b->free(block);
 				break;
 		}
 	}
+
+	if (((speed_t *)ptr)->perf != NULL)
+		perf_stop(((speed_t *)ptr)->perf);
+}
+
+/*
+ * eval_touch_speed - The function fsecs times for --touch. It replays
+ *    the trace on the allocator being evaluated, writing each new block
+ *    and accessing some of the live blocks after every request.
+ */
+static void eval_touch_speed(void *ptr)
+{
+	int i, index;
+	size_t oldsize;
+	char *p;
+	traceop_t *op;
+	trace_t *trace = ((speed_t *)ptr)->trace;
+	touch_t *touch = ((speed_t *)ptr)->touch;
+	backend_t *b = cur;
+
+	((speed_t *)ptr)->runs++;
+	start_pass(trace);
+	touch_start(touch);
+
+	if (b->init != NULL) {
+		mem_reset_brk();
+		if (b->init() < 0)
+			app_error("mm_init failed in eval_touch_speed");
+	}
+
+	for (i = 0;  (op = next_op(trace, i)) != NULL;  i++) {
+		index = op->index;
+		switch (op->type) {
+			case ALLOC:
+				if ((p = alloc_op(b, i, op->size)) == NULL)
+					app_error("malloc failed in eval_touch_speed");
+				trace->blocks[index] = p;
+				trace->block_sizes[index] = op->size;
+				touch_alloc(touch, trace, index, 0);
+				break;
+
+			case REALLOC:
+				oldsize = trace->block_sizes[index];
+				if ((p = b->realloc(trace->blocks[index], op->size)) == NULL)
+					app_error("realloc failed in eval_touch_speed");
+				trace->blocks[index] = p;
+				trace->block_sizes[index] = op->size;
+				touch_alloc(touch, trace, index, oldsize);
+				break;
+
+			case FREE:
+				touch_free(touch, index);
+				b->free(trace->blocks[index]);
+				break;
+
+			default:
+				app_error("Nonexistent request type in eval_touch_speed");
+		}
+		touch_some(touch, trace);
+	}
+}
+
+/*
+ * eval_handle_speed - The function fsecs times for --handles. It
+ *     replays the trace through mm_halloc, mm_hrealloc and mm_hfree.
+ */
+static void eval_handle_speed(void *ptr)
+{
+	int i, index;
+	traceop_t *op;
+	trace_t *trace = ((speed_t *)ptr)->trace;
+	mm_handle_t *handles = ((speed_t *)ptr)->handles;
+
+	((speed_t *)ptr)->runs++;
+	start_pass(trace);
+
+	mem_reset_brk();
+	if (mm_init() < 0)
+		app_error("mm_init failed in eval_handle_speed");
+
+	for (i = 0;  (op = next_op(trace, i)) != NULL;  i++) {
+		index = op->index;
+		switch (op->type) {
+			case ALLOC:
+				if ((handles[index] = mm_halloc(op->size)) == MM_NULL_HANDLE)
+					app_error("mm_halloc failed in eval_handle_speed");
+				break;
+
+			case REALLOC:
+				if (mm_hrealloc(handles[index], op->size) == MM_NULL_HANDLE)
+					app_error("mm_hrealloc failed in eval_handle_speed");
+				break;
+
+			case FREE:
+				mm_hfree(handles[index]);
+				break;
+
+			default:
+				app_error("Nonexistent request type in eval_handle_speed");
+		}
+	}
 }
 
 /*************************************
@@ -978,6 +2188,349 @@ static void printresults(int n, stats_t *stats)
 
 }
 
+/*
+ * printperf - Print the -P hardware counters of each trace, per request.
+ *     Mcyc is the cycles of one whole run of the trace, in millions.
+ */
+static void printperf(int n, stats_t *stats)
+{
+	int i, e;
+	double sum[PERF_NUM_EVENTS];
+	double ops = 0;
+
+	for (e = 0; e < PERF_NUM_EVENTS; e++)
+		sum[e] = 0;
+
+	printf("%5s%8s", "trace", "Mcyc");
+	for (e = 0; e < PERF_NUM_EVENTS; e++)
+		printf("%10s", perf_event_names[e]);
+	printf("%6s  (per request)\n", "IPC");
+
+	for (i = 0; i < n; i++) {
+		if (!stats[i].valid) {
+			printf("%2d%11s\n", i, "-");
+			continue;
+		}
+		ops += stats[i].ops;
+		if (stats[i].perf[PERF_CYCLES] >= 0)
+			printf("%2d%11.2f", i, stats[i].perf[PERF_CYCLES] / 1e6);
+		else
+			printf("%2d%11s", i, "-");
+		for (e = 0; e < PERF_NUM_EVENTS; e++) {
+			if (stats[i].perf[e] >= 0) {
+				printf("%10.2f", stats[i].perf[e] / stats[i].ops);
+				if (sum[e] >= 0)
+					sum[e] += stats[i].perf[e];
+			} else {
+				printf("%10s", "-");
+				sum[e] = -1;
+			}
+		}
+		if (stats[i].perf[PERF_CYCLES] > 0 && stats[i].perf[PERF_INSTRUCTIONS] >= 0)
+			printf("%6.2f", stats[i].perf[PERF_INSTRUCTIONS] / stats[i].perf[PERF_CYCLES]);
+		printf("\n");
+	}
+
+	if (ops == 0)
+		return;
+	if (sum[PERF_CYCLES] >= 0)
+		printf("%-5s%8.2f", "Total", sum[PERF_CYCLES] / 1e6);
+	else
+		printf("%-5s%8s", "Total", "-");
+	for (e = 0; e < PERF_NUM_EVENTS; e++) {
+		if (sum[e] >= 0)
+			printf("%10.2f", sum[e] / ops);
+		else
+			printf("%10s", "-");
+	}
+	if (sum[PERF_CYCLES] > 0 && sum[PERF_INSTRUCTIONS] >= 0)
+		printf("%6.2f", sum[PERF_INSTRUCTIONS] / sum[PERF_CYCLES]);
+	printf("\n");
+}
+
+/*
+ * printtiming - Print how many timed runs each trace got and how much
+ *     they varied. MAD is the median absolute deviation and CI the
+ *     half-width of the 95% confidence interval for the median, both
+ *     as a percentage of the median; "out" counts the runs more than
+ *     three (scaled) MADs from the median.
+ */
+static void printtiming(int n, stats_t *stats)
+{
+	fsecs_stats_t *t;
+	int i;
+
+	for (i = 0; i < n && stats[i].timing.runs == 0; i++)
+		;
+	if (i == n)
+		return; /* the timer doesn't keep samples */
+
+	printf("%5s%6s%12s%7s%7s%5s\n", "trace", "runs", "median", "MAD", "CI", "out");
+	for (i = 0; i < n; i++) {
+		t = &stats[i].timing;
+		if (!stats[i].valid || t->runs == 0 || t->median <= 0) {
+			printf("%2d%9s\n", i, "-");
+			continue;
+		}
+		printf("%2d%9d%12.6f%6.1f%%%6.1f%%%5d\n", i, t->runs, t->median,
+				100 * t->mad / t->median,
+				100 * (t->ci_hi - t->ci_lo) / 2 / t->median,
+				t->outliers);
+	}
+}
+
+/*
+ * printfrag - Break the heap down at the sample with the most live
+ *     payload (--timeline): internal fragmentation (allocated bytes
+ *     beyond the payload), external fragmentation (free blocks), and
+ *     the largest free block as a share of all free bytes.
+ */
+static void printfrag(int n, stats_t *stats)
+{
+	tl_sample_t *f;
+	int i;
+
+	printf("%5s%9s%10s%10s%7s%7s%9s\n",
+			"trace", "op", "live", "heap", "int", "ext", "largest");
+	for (i = 0; i < n; i++) {
+		f = &stats[i].frag;
+		if (!stats[i].valid || f->heap.heap_size == 0) {
+			printf("%2d%12s\n", i, "-");
+			continue;
+		}
+		printf("%2d%12d%10lu%10lu%6.1f%%%6.1f%%", i, f->op,
+				(unsigned long)f->live, (unsigned long)f->heap.heap_size,
+				100.0 * (f->heap.alloc_bytes - f->live) / f->heap.heap_size,
+				100.0 * f->heap.free_bytes / f->heap.heap_size);
+		if (f->heap.free_bytes > 0)
+			printf("%8.0f%%\n", 100.0 * f->heap.largest_free / f->heap.free_bytes);
+		else
+			printf("%9s\n", "-");
+	}
+}
+
+/*
+ * printtouch - Throughput with payload accesses (--touch) next to the
+ *     plain throughput, and how much of the time went to the accesses
+ *     beyond the allocator's own.
+ */
+static void printtouch(char *name, int n, stats_t *stats)
+{
+	double ops = 0, secs = 0, touch_secs = 0;
+	int i, valid = 1;
+
+	printf("Throughput of %s malloc with %g%% of live blocks accessed per request:\n",
+			name, touch_frac * 100);
+	printf("%5s%10s%12s%9s\n", "trace", "Kops", "touch Kops", "slower");
+	for (i = 0; i < n; i++) {
+		if (!stats[i].valid || stats[i].touch_secs <= 0) {
+			printf("%2d%13s\n", i, "-");
+			valid = 0;
+			continue;
+		}
+		printf("%2d%13.0f%12.0f%8.1fx\n", i,
+				(stats[i].ops/1e3)/stats[i].secs,
+				(stats[i].ops/1e3)/stats[i].touch_secs,
+				stats[i].touch_secs/stats[i].secs);
+		ops += stats[i].ops;
+		secs += stats[i].secs;
+		touch_secs += stats[i].touch_secs;
+	}
+	if (valid && n > 0)
+		printf("%5s%10.0f%12.0f%8.1fx\n", "Total",
+				(ops/1e3)/secs, (ops/1e3)/touch_secs, touch_secs/secs);
+}
+
+/*
+ * printhandles - mm with plain and with relocatable blocks (--handles):
+ *     peak utilization, fragmentation averaged over the requests (the
+ *     share of the heap not holding live payload), what the compactor
+ *     moved, and throughput.
+ */
+static void printhandles(int n, stats_t *stats)
+{
+	double ops = 0, secs = 0, handle_secs = 0, frag = 0, hfrag = 0;
+	heapuse_t *u, *h;
+	int i, valid = 1;
+
+	printf("mm malloc with relocatable blocks (--handles):\n");
+	printf("%5s%7s%7s%7s%7s%10s%10s%10s%9s\n", "trace", "util", "hutil",
+			"frag", "hfrag", "moved KB", "Kops", "hKops", "slower");
+	for (i = 0; i < n; i++) {
+		if (!stats[i].valid || stats[i].handle_secs <= 0) {
+			printf("%2d%10s\n", i, "-");
+			valid = 0;
+			continue;
+		}
+		u = &stats[i].plain_use;
+		h = &stats[i].handle_use;
+		printf("%2d%9.0f%%%6.0f%%%6.0f%%%6.0f%%%10.0f%10.0f%10.0f%8.1fx\n", i,
+				stats[i].util * 100,
+				100.0 * h->peak_live / h->peak_heap,
+				100 * (1 - u->mean_live / u->mean_heap),
+				100 * (1 - h->mean_live / h->mean_heap),
+				stats[i].compact.moved_bytes / 1024.0,
+				(stats[i].ops/1e3)/stats[i].secs,
+				(stats[i].ops/1e3)/stats[i].handle_secs,
+				stats[i].handle_secs/stats[i].secs);
+		ops += stats[i].ops;
+		secs += stats[i].secs;
+		handle_secs += stats[i].handle_secs;
+		frag += 1 - u->mean_live / u->mean_heap;
+		hfrag += 1 - h->mean_live / h->mean_heap;
+	}
+	if (valid && n > 0)
+		printf("%5s%20.0f%%%6.0f%%%20.0f%10.0f%8.1fx\n", "Total",
+				100 * frag / n, 100 * hfrag / n,
+				(ops/1e3)/secs, (ops/1e3)/handle_secs, handle_secs/secs);
+}
+
+/*
+ * printcompare - One table of every allocator's utilization and
+ *     throughput on each trace (--alloc). Allocators with the malloc
+ *     interface use their own heap, so they have no utilization.
+ */
+static void printcompare(int n, results_t *res, backend_t **alloc, int nres)
+{
+	stats_t *s;
+	double util, ops, secs;
+	int i, r, valid;
+
+	if (nres > COMPARE_COLUMNS) {
+		printranking(n, res, alloc, nres);
+		return;
+	}
+
+	printf("\nComparison of util and Kops on each trace:\n");
+	printf("%5s", "trace");
+	for (r = 0; r < nres; r++)
+		printf("%15.14s", res[r].name);
+	printf("\n");
+
+	for (i = 0; i < n; i++) {
+		printf("%5d", i);
+		for (r = 0; r < nres; r++) {
+			s = &res[r].stats[i];
+			if (!s->valid)
+				printf("%7s%8s", "no", "-");
+			else if (alloc[r]->init == NULL)
+				printf("%7s%8.0f", "-", (s->ops/1e3)/s->secs);
+			else
+				printf("%6.0f%%%8.0f", s->util*100.0, (s->ops/1e3)/s->secs);
+		}
+		printf("\n");
+	}
+
+	/* Totals as in printresults: mean util, and all ops over all secs */
+	printf("%5s", "Total");
+	for (r = 0; r < nres; r++) {
+		util = ops = secs = 0;
+		valid = 1;
+		for (i = 0; i < n; i++) {
+			s = &res[r].stats[i];
+			valid = valid && s->valid;
+			util += s->util;
+			ops += s->ops;
+			secs += s->secs;
+		}
+		if (!valid)
+			printf("%7s%8s", "-", "-");
+		else if (alloc[r]->init == NULL)
+			printf("%7s%8.0f", "-", (ops/1e3)/secs);
+		else
+			printf("%6.0f%%%8.0f", (util/n)*100.0, (ops/1e3)/secs);
+	}
+	printf("\n");
+	if (touch_frac == 0)
+		return;
+
+	/* The same with payload accesses, where placement matters more */
+	printf("\nKops with %g%% of live blocks accessed per request (--touch):\n",
+			touch_frac * 100);
+	printf("%5s", "trace");
+	for (r = 0; r < nres; r++)
+		printf("%15.14s", res[r].name);
+	printf("\n");
+	for (i = 0; i < n; i++) {
+		printf("%5d", i);
+		for (r = 0; r < nres; r++) {
+			s = &res[r].stats[i];
+			if (s->valid && s->touch_secs > 0)
+				printf("%15.0f", (s->ops/1e3)/s->touch_secs);
+			else
+				printf("%15s", "-");
+		}
+		printf("\n");
+	}
+}
+
+/*
+ * printranking - printcompare for more allocators than fit across the
+ *     screen, such as the policy matrix: one row per allocator with
+ *     its totals and its worst trace, best mean utilization first.
+ *     Allocators with the malloc interface come last.
+ */
+static void printranking(int n, results_t *res, backend_t **alloc, int nres)
+{
+	stats_t *s;
+	double *util, *kops, *worst, ops, secs;
+	int *order, i, j, r, valid;
+
+	util = (double *)calloc(nres, sizeof(double));
+	kops = (double *)calloc(nres, sizeof(double));
+	worst = (double *)calloc(nres, sizeof(double));
+	order = (int *)calloc(nres, sizeof(int));
+	if (util == NULL || kops == NULL || worst == NULL || order == NULL)
+		unix_error("calloc in printranking failed");
+
+	/* Totals as in printcompare; -1 where there is no utilization */
+	for (r = 0; r < nres; r++) {
+		ops = secs = 0;
+		worst[r] = 1;
+		valid = 1;
+		for (i = 0; i < n; i++) {
+			s = &res[r].stats[i];
+			valid = valid && s->valid;
+			util[r] += s->util;
+			if (s->util < worst[r])
+				worst[r] = s->util;
+			ops += s->ops;
+			secs += s->secs;
+		}
+		util[r] /= n;
+		kops[r] = valid ? (ops/1e3)/secs : -1;
+		if (!valid || alloc[r]->init == NULL)
+			util[r] = worst[r] = -1;
+	}
+
+	/* Insertion sort by mean util; the list is short */
+	for (r = 0; r < nres; r++) {
+		for (j = r; j > 0 && util[order[j-1]] < util[r]; j--)
+			order[j] = order[j-1];
+		order[j] = r;
+	}
+
+	printf("\nAllocators ranked by mean util over %d traces:\n", n);
+	printf("%4s %-36s%8s%8s%10s\n", "rank", "allocator", "util", "worst", "Kops");
+	for (j = 0; j < nres; j++) {
+		r = order[j];
+		printf("%4d %-36.36s", j + 1, res[r].name);
+		if (util[r] < 0)
+			printf("%8s%8s", "-", "-");
+		else
+			printf("%7.0f%%%7.0f%%", util[r] * 100.0, worst[r] * 100.0);
+		if (kops[r] < 0)
+			printf("%10s\n", "-");
+		else
+			printf("%10.0f\n", kops[r]);
+	}
+
+	free(util);
+	free(kops);
+	free(worst);
+	free(order);
+}
+
 /*
  * Accumulate the aggregate statistics for the student's mm package
  */
@@ -1043,14 +2596,52 @@ void malloc_error(int tracenum, int opnum, char *msg)
  */
 static void usage(void)
 {
-	fprintf(stderr, "Usage: mdriver [-hvVal] [-f <file>] [-t <dir>]\n");
+	fprintf(stderr, "Usage: mdriver [-hvValSpLP] [-f <file>] [-t <dir>] [-j <n>] [-T <n>] [-n <n>]\n");
+	fprintf(stderr, "               [timing options] [output options]\n");
 	fprintf(stderr, "Options\n");
 	fprintf(stderr, "\t-a         Don't check the team structure.\n");
 	fprintf(stderr, "\t-f <file>  Use <file> as the trace file.\n");
 	fprintf(stderr, "\t-g         Generate summary info for autograder.\n");
 	fprintf(stderr, "\t-h         Print this message.\n");
+	fprintf(stderr, "\t-j <n>     Evaluate up to <n> traces at once in worker processes.\n");
 	fprintf(stderr, "\t-l         Run libc malloc as well.\n");
+	fprintf(stderr, "\t-L         Print per-request latency percentiles for each trace.\n");
+	fprintf(stderr, "\t-n <n>     With -L, also list the <n> slowest requests.\n");
+	fprintf(stderr, "\t-p         Pin each -j worker to its own CPU.\n");
+	fprintf(stderr, "\t-P         Count hardware events (cycles, misses) in the speed runs.\n");
+	fprintf(stderr, "\t-S         Stream traces from disk instead of loading them.\n");
 	fprintf(stderr, "\t-t <dir>   Directory to find default traces.\n");
+	fprintf(stderr, "\t-T <n>     Replay on 1..<n> threads and report scalability.\n");
 	fprintf(stderr, "\t-v         Print per-trace performance breakdowns.\n");
 	fprintf(stderr, "\t-V         Print additional debug info.\n");
+	fprintf(stderr, "\t--alloc [<name>=]<lib.so>  Also run the allocator in <lib.so>; repeatable.\n");
+	fprintf(stderr, "\t--touch <pct>  Also time each trace with <pct>%% of live blocks accessed per request.\n");
+	fprintf(stderr, "\t--touch-write <pct>  Make <pct>%% of those accesses updates (default 50).\n");
+	fprintf(stderr, "\t--hint <pct>  Tell mm_malloc_hint which blocks are freed within <pct>%% of\n");
+	fprintf(stderr, "\t              the trace's requests (short-lived) and which are not.\n");
+	fprintf(stderr, "\t--handles     Also run each trace through mm_halloc and report fragmentation\n");
+	fprintf(stderr, "\t              and the compactor's cost.\n");
+	fprintf(stderr, "Timing options\n");
+	fprintf(stderr, "\t--warmup <n>    Untimed runs of each trace before timing (default 1).\n");
+	fprintf(stderr, "\t--runs <n>      Timed runs of each trace; the median is reported (default 10).\n");
+	fprintf(stderr, "\t--ci <pct>      Keep running until the 95%% CI of the median is within <pct>%%.\n");
+	fprintf(stderr, "\t--max-runs <n>  Stop at <n> runs even if the CI is wider (default 100).\n");
+	fprintf(stderr, "\t--cpu <n>       Run on CPU <n> only.\n");
+	fprintf(stderr, "\t--timer <t>     Time runs with tsc, clock, fcyc or itimer (default auto:\n");
+	fprintf(stderr, "\t                tsc if the TSC is invariant, else clock).\n");
+	fprintf(stderr, "\t--check-freq    Warn if the CPU clock speed can change during a run.\n");
+	fprintf(stderr, "\t--libc-baseline Score throughput against libc measured in this run (implies -l).\n");
+	fprintf(stderr, "\t--fcyc-k <k>, --fcyc-maxsamples <n>, --fcyc-epsilon <e>,\n");
+	fprintf(stderr, "\t--fcyc-clear-cache 0|1, --fcyc-compensate 0|1\n");
+	fprintf(stderr, "\t                K-best settings for --timer fcyc.\n");
+	fprintf(stderr, "Output options\n");
+	fprintf(stderr, "\t--json <file>   Write all results to <file> as JSON.\n");
+	fprintf(stderr, "\t--csv <file>    Write all results to <file> as CSV.\n");
+	fprintf(stderr, "\t--baseline <file>  Compare mm with the --csv file of an earlier run;\n");
+	fprintf(stderr, "\t                exit with status 1 on any regression.\n");
+	fprintf(stderr, "\t--threshold <pct>  Smallest throughput loss counted as a regression (default 5).\n");
+	fprintf(stderr, "\t--timeline <file>  Write samples of the mm heap's fragmentation to <file>.\n");
+	fprintf(stderr, "\t--timeline-points <n>  Take about <n> samples per trace (default 100).\n");
+	fprintf(stderr, "\t--snapshot <op>,...  Dump the mm heap before these requests (or at \"end\").\n");
+	fprintf(stderr, "\t--snapshot-dir <dir>  Write the dumps to <dir> (default .).\n");
 }
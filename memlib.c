@@ -24,6 +24,15 @@ static char *mem_max_addr;   /* largest legal heap address */
  */
 void mem_init(void)
 {
+	/*
+	 * mm_init may call us again for every run of a trace; reuse the
+	 * storage then, or each timed run would leak a MAX_HEAP block
+	 */
+	if (mem_start_brk != NULL) {
+		mem_brk = mem_start_brk;
+		return;
+	}
+
 	/* allocate the storage we will use to model the available VM */
 	if ((mem_start_brk = (char *)malloc(MAX_HEAP)) == NULL) {
 		fprintf(stderr, "mem_init_vm: malloc error\n");
@@ -40,6 +49,7 @@ void mem_init(void)
 void mem_deinit(void)
 {
 	free(mem_start_brk);
+	mem_start_brk = NULL;
 }
 
 /*
@@ -52,14 +62,14 @@ void mem_reset_brk()
 
 /*
  * mem_sbrk - simple model of the sbrk function. Extends the heap
- *    by incr bytes and returns the start address of the new area. In
- *    this model, the heap cannot be shrunk.
+ *    by incr bytes and returns the start address of the new area. A
+ *    negative incr shrinks the heap, though not below its start.
  */
 void *mem_sbrk(int incr)
 {
 	char *old_brk = mem_brk;
 
-	if ( (incr < 0) || ((mem_brk + incr) > mem_max_addr)) {
+	if ((mem_brk + incr) < mem_start_brk || ((mem_brk + incr) > mem_max_addr)) {
 		errno = ENOMEM;
 		fprintf(stderr, "ERROR: mem_sbrk failed. Ran out of memory...\n");
 		return (void *)-1;
@@ -0,0 +1,141 @@
+/*
+ * memsys.c - memlib on real virtual memory. Used instead of memlib.c
+ *            when mm.c is built as the process allocator (libmm.so).
+ *
+ * mm.c needs one contiguous heap. mem_init reserves SYS_MAX_HEAP bytes
+ * of address space as an inaccessible mapping. mem_sbrk maps it in
+ * SYS_HEAP_CHUNK bytes at a time as the break moves up, so a program
+ * only pays for the heap it uses. Nothing in here may call malloc.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/mman.h>
+
+#include "memlib.h"
+#include "config.h"
+
+/* private variables */
+static char *mem_start_brk;  /* points to first byte of heap */
+static char *mem_brk;        /* points to last byte of heap */
+static char *mem_mapped;     /* end of the usable part of the reservation */
+static char *mem_max_addr;   /* largest legal heap address */
+
+static void mem_fail(char *msg);
+
+/*
+ * mem_init - reserve the address space for the heap
+ */
+void mem_init(void)
+{
+	mem_start_brk = mmap(NULL, SYS_MAX_HEAP, PROT_NONE,
+			MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if (mem_start_brk == MAP_FAILED)
+		mem_fail("mem_init: cannot reserve heap address space\n");
+
+	mem_max_addr = mem_start_brk + SYS_MAX_HEAP;
+	mem_mapped = mem_start_brk;
+	mem_brk = mem_start_brk;
+}
+
+/*
+ * mem_deinit - give the whole reservation back
+ */
+void mem_deinit(void)
+{
+	munmap(mem_start_brk, SYS_MAX_HEAP);
+}
+
+/*
+ * mem_reset_brk - reset the brk pointer to make an empty heap
+ */
+void mem_reset_brk()
+{
+	mem_brk = mem_start_brk;
+}
+
+/*
+ * mem_sbrk - Extend the heap by incr bytes and return the start of the
+ *    new area, mapping more of the reservation when the break passes
+ *    the end of the usable part. A negative incr shrinks the heap; the
+ *    whole pages above the new break are handed back to the kernel but
+ *    stay mapped, so the break can move up over them again.
+ */
+void *mem_sbrk(int incr)
+{
+	char *old_brk = mem_brk;
+	char *keep;
+	size_t grow;
+
+	if ((mem_brk + incr) < mem_start_brk || ((mem_brk + incr) > mem_max_addr)) {
+		errno = ENOMEM;
+		return (void *)-1;
+	}
+
+	if (mem_brk + incr > mem_mapped) {
+		grow = (mem_brk + incr - mem_mapped + SYS_HEAP_CHUNK - 1) &
+			~(size_t)(SYS_HEAP_CHUNK - 1);
+		if (mem_mapped + grow > mem_max_addr)
+			grow = mem_max_addr - mem_mapped;
+		if (mmap(mem_mapped, grow, PROT_READ | PROT_WRITE,
+					MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0) == MAP_FAILED) {
+			errno = ENOMEM;
+			return (void *)-1;
+		}
+		mem_mapped += grow;
+	}
+
+	if (incr < 0) {
+		keep = (char *)(((size_t)(mem_brk + incr) + mem_pagesize() - 1) &
+				~(mem_pagesize() - 1));
+		if (keep < mem_brk)
+			madvise(keep, mem_brk - keep, MADV_DONTNEED);
+	}
+
+	mem_brk += incr;
+	return (void *)old_brk;
+}
+
+/*
+ * mem_heap_lo - return address of the first heap byte
+ */
+void *mem_heap_lo()
+{
+	return (void *)mem_start_brk;
+}
+
+/*
+ * mem_heap_hi - return address of last heap byte
+ */
+void *mem_heap_hi()
+{
+	return (void *)(mem_brk - 1);
+}
+
+/*
+ * mem_heapsize() - returns the heap size in bytes
+ */
+size_t mem_heapsize()
+{
+	return (size_t)(mem_brk - mem_start_brk);
+}
+
+/*
+ * mem_pagesize() - returns the page size of the system
+ */
+size_t mem_pagesize()
+{
+	return (size_t)getpagesize();
+}
+
+/*
+ * mem_fail - Report a fatal error without stdio, which would allocate
+ */
+static void mem_fail(char *msg)
+{
+	if (write(STDERR_FILENO, msg, strlen(msg)) < 0)
+		;
+	abort();
+}
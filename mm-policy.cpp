@@ -0,0 +1,53 @@
+/*
+ * mm-policy.cpp - One combination of the policies in mmpolicy.hpp,
+ *     built as an allocator for mdriver --alloc. The Makefile picks
+ *     the combination with -DMM_FIT, -DMM_INSERT, -DMM_COALESCE,
+ *     -DMM_CLASSES and -DMM_LAYOUT; without them this is mm.c's
+ *     design: first fit, LIFO, immediate coalescing, quarter classes
+ *     and compact tags.
+ */
+#include "mmpolicy.hpp"
+
+#ifndef MM_FIT
+#define MM_FIT FirstFit<>
+#endif
+#ifndef MM_INSERT
+#define MM_INSERT LifoInsert
+#endif
+#ifndef MM_COALESCE
+#define MM_COALESCE ImmediateCoalesce
+#endif
+#ifndef MM_CLASSES
+#define MM_CLASSES QuarterClasses
+#endif
+#ifndef MM_LAYOUT
+#define MM_LAYOUT CompactTags
+#endif
+
+using namespace mmpolicy;
+
+typedef Allocator<MM_FIT, MM_INSERT, MM_COALESCE, MM_CLASSES, MM_LAYOUT> policy;
+
+extern "C" {
+
+int mm_init(void)
+{
+	return policy::init();
+}
+
+void *mm_malloc(size_t size)
+{
+	return policy::malloc(size);
+}
+
+void mm_free(void *ptr)
+{
+	policy::free(ptr);
+}
+
+void *mm_realloc(void *ptr, size_t size)
+{
+	return policy::realloc(ptr, size);
+}
+
+}
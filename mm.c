@@ -102,6 +102,7 @@ team_t team = {
 /* Bit flags for alloc fields in block headers */
 #define THISALLOC 0x01
 #define PREVALLOC 0x02
+#define MOVABLE   0x04  /* allocated by mm_halloc; its last word is its handle */
 
 /* Self-explanatory */
 #define MAX(x, y) ((x) > (y)? (x) : (y))
@@ -118,7 +119,7 @@ team_t team = {
 #define PACK(size, alloc) ((size) | (alloc))
 
 /* Read size field */
-#define GET_SIZE(p) (GETW(p) & ~(THISALLOC | PREVALLOC))
+#define GET_SIZE(p) (GETW(p) & ~(THISALLOC | PREVALLOC | MOVABLE))
 /* Read <allocated?> field */
 #define GET_ALLOC(p) (GETW(p) & THISALLOC)
 
@@ -148,9 +149,71 @@ team_t team = {
 #define ADJUST_BYTESIZE(size) (ALIGN((ADJUST_WORDCOUNT(((size) + WSIZE - 1)/WSIZE)) * WSIZE))
 
 
-/* Using size segregated explicit free lists */
-#define FREELIST_COUNT 17
-static char * free_lists[FREELIST_COUNT]; /* Segregate by word size power of 2, up to 65536 words */
+/*
+ * Using size segregated explicit free lists, CLASS_STEPS of them for
+ * each doubling of the block size from MIN_SIZE up to 2^LARGE_BITS
+ * bytes, and one more for all larger blocks. A block of s bytes, with
+ * its top bit at b, goes in list (b - 4) * CLASS_STEPS plus the
+ * CLASS_BITS bits of s below the top one, so the blocks in a list
+ * differ in size by under 1/CLASS_STEPS. Build with -DCLASS_BITS=0
+ * for one list per power of two.
+ *
+ * The blocks of the last class are not a list but a red-black tree
+ * ordered by size (then address), rooted at free_lists[TREE_INDEX],
+ * so that a large request gets the best fit among them.
+ *
+ * Built with -DMM_TUNED, the settings come from mm_tune.h, which
+ * mmtune writes from a profile of the workload (see MM_PROFILE below):
+ * CLASS_BITS, the lists of blocks up to SMALL_LIMIT (SMALL_CLASSES
+ * and MEDIUM_BASE), SPLIT_MIN and CHUNK_BYTES.
+ */
+#ifdef MM_TUNED
+#include "mm_tune.h"
+#endif
+
+#ifndef CLASS_BITS
+#define CLASS_BITS 2
+#endif
+#define CLASS_STEPS (1 << CLASS_BITS)
+#define MIN_BITS 4      /* log2 of MIN_SIZE */
+#define SMALL_BITS 10   /* log2 of SMALL_LIMIT */
+#define LARGE_BITS 16   /* blocks of 64 KB and up go in the tree */
+
+/* List of a block of size s, whose top bit is bit b */
+#define SIZE_CLASS(s, b) \
+	(((b) - MIN_BITS) * CLASS_STEPS + (((s) >> ((b) - CLASS_BITS)) & (CLASS_STEPS - 1)))
+
+/*
+ * Blocks up to SMALL_LIMIT bytes look their list up in small_class,
+ * indexed by size / ALIGNMENT, which the preprocessor fills in. Larger
+ * ones count from MEDIUM_BASE, the list of SMALL_LIMIT.
+ */
+#define SMALL_LIMIT (1 << SMALL_BITS)
+#ifndef SMALL_CLASSES
+#define SMALL_TOPBIT(s) ((s) >= 1024 ? 10 : (s) >= 512 ? 9 : (s) >= 256 ? 8 : \
+	(s) >= 128 ? 7 : (s) >= 64 ? 6 : (s) >= 32 ? 5 : 4)
+#define SC(i) ((i) * ALIGNMENT < MIN_SIZE ? 0 : \
+	SIZE_CLASS((i) * ALIGNMENT, SMALL_TOPBIT((i) * ALIGNMENT)))
+#define SC4(i) SC(i), SC((i) + 1), SC((i) + 2), SC((i) + 3)
+#define SC16(i) SC4(i), SC4((i) + 4), SC4((i) + 8), SC4((i) + 12)
+#define SC64(i) SC16(i), SC16((i) + 16), SC16((i) + 32), SC16((i) + 48)
+#define SMALL_CLASSES SC64(0), SC64(64), SC(128)
+#define MEDIUM_BASE SIZE_CLASS(SMALL_LIMIT, SMALL_BITS)
+#endif
+static const unsigned char small_class[SMALL_LIMIT / ALIGNMENT + 1] = {
+	SMALL_CLASSES
+};
+
+#define MEDIUM_CLASS(s, b) (MEDIUM_BASE + ((b) - SMALL_BITS) * CLASS_STEPS + \
+	(((s) >> ((b) - CLASS_BITS)) & (CLASS_STEPS - 1)))
+#define FREELIST_COUNT (MEDIUM_BASE + (LARGE_BITS - SMALL_BITS) * CLASS_STEPS + 1)
+#define TREE_INDEX (FREELIST_COUNT - 1)
+static char * free_lists[FREELIST_COUNT];
+
+/* A block is split when at least SPLIT_MIN bytes would be left over */
+#ifndef SPLIT_MIN
+#define SPLIT_MIN MIN_SIZE
+#endif
 
 
 /* Helper macro to get the mem_header of a payload pointer */
@@ -164,6 +227,23 @@ typedef struct {			 /* IMPORTANT!!! The next_free and prev_free fields */
 	char *prev_free;		 /* adjust if you want to set the *_free of one		*/
 } mem_header;				 /* mem_header to another mem_header.			    */
 
+/* A large free block as a tree node. Like mem_header, the links point
+	to payloads. Large blocks are far bigger than this. */
+typedef struct {
+	unsigned int size_alloc;
+	char *left;
+	char *right;
+	char *parent;
+	unsigned int red;
+} tree_node;
+
+#define NODE(bp) ((tree_node *)GET_BLOCKHDR(bp))
+#define IS_RED(bp) ((bp) != NULL && NODE(bp)->red)
+
+/* Tree order: by size, and by address between blocks of one size */
+#define TREE_BEFORE(a, b) (GET_THISSIZE(a) < GET_THISSIZE(b) || \
+	(GET_THISSIZE(a) == GET_THISSIZE(b) && (a) < (b)))
+
 
 static size_t PAGE_SIZE;
 static size_t ADJUSTED_PAGESIZE;
@@ -171,6 +251,114 @@ static size_t ADJUSTED_PAGESIZE;
 static char * heap_start = NULL;
 static char * heap_end = NULL;
 
+/*
+ * The wilderness: the free block that requests no listed block fits
+ * are cut from, or NULL. It is on no free list. Long-lived blocks are
+ * cut from its front and short-lived ones from its back, so it starts
+ * out at the end of the heap but may end up with short-lived blocks
+ * after it; blocks freed next to it merge into it. When the heap grows
+ * past such blocks, the new end of the heap takes over and the old
+ * wilderness goes on a list.
+ */
+static char * wild = NULL;
+static int listed_count = 0; /* free blocks on the lists and in the tree */
+
+/*
+ * Relocatable blocks (mm_halloc). Such a block has MOVABLE set in its
+ * header and its handle in its last word, so the compactor can find
+ * the handle of a block it moves. handles[h] is the payload of handle
+ * h's block; a free entry holds the next free handle instead, shifted
+ * up past a 1 bit, which no payload address has. The table is itself
+ * a relocatable block, with handle 0, so it moves like the rest.
+ */
+static char **handles = NULL;
+static unsigned int handle_count = 0; /* entries in the table */
+static unsigned int free_handle = 0;  /* first free entry, or 0 for none */
+
+#define HANDLE_FREE(next) ((char *)(((next) << 1) | 1))
+#define HANDLE_NEXT(entry) ((unsigned int)(entry) >> 1)
+#define FIRST_HANDLES 64
+
+/*
+ * The compactor sweeps the heap from the front, sliding each
+ * relocatable block that follows a free block down into it, so the
+ * free space moves up ahead of the sweep and merges as it goes. Each
+ * call does about a budget of work (see mm_compact) and leaves
+ * compact_at, a block boundary, for the next call to start from;
+ * file_free moves it back if a merge swallows it. At the end of a
+ * sweep, a free block at the end of the heap is cut back to one
+ * chunk and the rest returned to memlib. Handle calls pay for the
+ * sweep as they go: COMPACT_RATE bytes of work per byte they allocate
+ * or free, at least COMPACT_MIN. Visiting a block without moving it
+ * costs COMPACT_VISIT.
+ */
+#define COMPACT_RATE 2
+#define COMPACT_MIN 256
+#define COMPACT_VISIT 16
+static char *compact_at = NULL;  /* where the sweep resumes, or NULL */
+static mm_compact_stats_t compact_stats;
+
+/*
+ * Lifetime prediction for mm_malloc without a hint, built with
+ * -DPREDICT_LIFETIME. For each size
+ * class, life_allocs counts the blocks allocated and life_live those
+ * not yet freed; life_clock counts all allocations. By Little's law a
+ * class's blocks live life_live / (life_allocs / life_clock) requests
+ * on average, and a class averaging under SHORT_LIFE is short-lived.
+ * Every LIFE_WINDOW allocations the rates are halved, so the guess
+ * follows a workload that changes. Classes with fewer than LIFE_MIN
+ * allocations count as long-lived. Without it, every block that has
+ * no hint is placed as long-lived: on the traces, a size says too
+ * little about a lifetime, and wrong guesses cost more than they save.
+ */
+#ifdef PREDICT_LIFETIME
+#define SHORT_LIFE 64
+#define LIFE_WINDOW (1 << 16)
+#define LIFE_MIN 32
+static unsigned int life_allocs[FREELIST_COUNT];
+static unsigned int life_live[FREELIST_COUNT];
+static unsigned int life_clock;
+
+#define LIFETIME_ALLOC(bp) lifetime_alloc(bp)
+#define LIFETIME_FREE(bp) lifetime_free(bp)
+static void lifetime_alloc(char *bp);
+static void lifetime_free(char *bp);
+static int predict_lifetime(size_t adjusted_size);
+#else
+#define LIFETIME_ALLOC(bp)
+#define LIFETIME_FREE(bp)
+#define predict_lifetime(adjusted_size) MM_HINT_LONG
+#endif
+
+/*
+ * Built with -DMM_PROFILE, the allocator counts what it is asked for
+ * and how the lists serve it, over every heap the process sets up, and
+ * writes the counts at exit to the file named by the MM_PROFILE
+ * environment variable (mm.prof by default). mmtune turns them into
+ * mm_tune.h.
+ */
+#ifdef MM_PROFILE
+#define PROFILE_SIZES ((1 << LARGE_BITS) / ALIGNMENT)
+static struct {
+	unsigned long sizes[PROFILE_SIZES];   /* requests by block size / ALIGNMENT */
+	unsigned long large, large_bytes;     /* requests for large blocks */
+	unsigned long first_fit[FREELIST_COUNT]; /* found in the request's own list */
+	unsigned long passed[FREELIST_COUNT];    /* own list had only smaller blocks */
+	unsigned long head_fit[FREELIST_COUNT];  /* took the head of a larger list */
+	unsigned long tree_fit;               /* best fit among the large blocks */
+	unsigned long carves, extends, extend_bytes;
+	unsigned long splits, whole;          /* listed blocks split or used whole */
+	unsigned long runs, heap_bytes, min_heap; /* heaps set up, and their sizes */
+	pid_t pid;                            /* the process that writes the file */
+} prof;
+
+#define PROFILE(stmt) stmt
+static void profile_init(void);
+static void profile_request(size_t adjusted_size);
+#else
+#define PROFILE(stmt)
+#endif
+
 /* Function prototypes */
 static int calc_list_index(size_t size);
 static void *extend_heap(size_t adjusted_size);
@@ -182,6 +370,15 @@ static void add_to_list(char *bp, int list_index);
 static void remove_from_list(char *bp, int list_index);
 static void free_block(void *bp, size_t adjusted_size);
 static int get_node_listindex(void *bp);
+static void tree_insert(char *bp);
+static void tree_remove(char *bp);
+static char *tree_best_fit(size_t size);
+static void *carve_wilderness(size_t adjusted_size, int from_end);
+static int take_free(char *bp);
+static void file_free(char *bp, size_t size, int took_wild);
+static int grow_handles(void);
+static char *slide_down(char *bp);
+static void release_tail(void);
 
 
 
@@ -191,6 +388,7 @@ static int get_node_listindex(void *bp);
 int mm_init(void)
 {
 	TRACE(">>>Entering mm_init()\n");
+	PROFILE(profile_init());
 	mem_init();
 
 	#ifdef DO_MM_CHECK
@@ -200,10 +398,24 @@ int mm_init(void)
 
 	/*Each element in free_lists starts off as the empty head of a linked list*/
 	memset(free_lists, (int)NULL, sizeof(free_lists));
+	listed_count = 0;
+	handles = NULL;
+	handle_count = free_handle = 0;
+	compact_at = NULL;
+	memset(&compact_stats, 0, sizeof(compact_stats));
+#ifdef PREDICT_LIFETIME
+	memset(life_allocs, 0, sizeof(life_allocs));
+	memset(life_live, 0, sizeof(life_live));
+	life_clock = 0;
+#endif
 
 	/* Initialize write-once variables */
 	PAGE_SIZE = mem_pagesize();
+#ifdef CHUNK_BYTES
+	ADJUSTED_PAGESIZE = ADJUST_BYTESIZE(CHUNK_BYTES);
+#else
 	ADJUSTED_PAGESIZE = ADJUST_BYTESIZE((PAGE_SIZE*2));
+#endif
 
 	/* Initially allocate 1 page of memory plus room for
 		the prologue and epilogue blocks and free block header */
@@ -222,10 +434,10 @@ int mm_init(void)
 	/* Epilogue header */
 	PUTW(heap_start + ADJUSTED_PAGESIZE + 3	* WSIZE, PACK(0xEA7F00D0, THISALLOC));
 
-	/* Setup initial free block */
+	/* Setup initial free block, the wilderness */
 	PUTW(heap_start + (3 * WSIZE), PACK(ADJUSTED_PAGESIZE, PREVALLOC));
 	PUTW((heap_end - WSIZE + 1) - WSIZE, PACK(ADJUSTED_PAGESIZE, PREVALLOC));
-	add_to_list(heap_start + (4 * WSIZE), calc_list_index(ADJUSTED_PAGESIZE));
+	wild = heap_start + (4 * WSIZE);
 
 	RUN_MM_CHECK();
 	TRACE("<<<---Leaving mm_init()\n");
@@ -239,43 +451,67 @@ int mm_init(void)
  *     Always allocate a block whose size is a multiple of the alignment.
  */
 void *mm_malloc(size_t size)
+{
+	return mm_malloc_hint(size, MM_HINT_NONE);
+}
+
+/**
+ * mm_malloc_hint - Allocate a block, placed by how long it will live:
+ * MM_HINT_SHORT or MM_HINT_LONG from the caller, or for MM_HINT_NONE,
+ * what predict_lifetime expects of its size.
+ *
+ * Every block is placed in the first hole on the free lists that fits.
+ * When none does, long-lived blocks are cut from the front of the
+ * wilderness and short-lived ones from its back. The two kinds then
+ * grow apart from opposite ends instead of interleaving, and when the
+ * short-lived blocks are freed they run together and back into the
+ * wilderness rather than leaving holes between blocks that stay.
+ */
+void *mm_malloc_hint(size_t size, int hint)
 {
 	size_t adjusted_size; /* Adjusted (aligned) block size */
 	char *bp;
 	int list_index;
-	TRACE(">>>Entering mm_malloc(size=%u)\n", size);
+	TRACE(">>>Entering mm_malloc_hint(size=%u, hint=%d)\n", size, hint);
 
 	/* Ignore stupid/ugly programmers */
 	if (size == 0) {
-		TRACE("<<<---Leaving mm_malloc() because some stupid/ugly programmer asked for size 0\n");
+		TRACE("<<<---Leaving mm_malloc_hint() because some stupid/ugly programmer asked for size 0\n");
 		return NULL;
 	}
 
 	/* Adjust block size to allow for header and match alignment */
 	adjusted_size = ADJUST_BYTESIZE(size);
-
-	/* Search for a best fit */
-	if ((bp = find_fit(adjusted_size, &list_index)) != NULL) {
-		/* Mark block as allocated, write header info */
+	PROFILE(profile_request(adjusted_size));
+	if (hint == MM_HINT_NONE)
+		hint = predict_lifetime(adjusted_size);
+
+	/* Search for a best fit among the recycled blocks */
+	if (listed_count > 0 && (bp = find_fit(adjusted_size, &list_index)) != NULL) {
+		/* Mark block as allocated, write header info. This also takes
+			it off its free list */
 		allocate(bp, adjusted_size);
+		LIFETIME_ALLOC(bp);
 
-		/* Remove this block from its respective free list */
-		remove_from_list(bp, list_index);
-
-		TRACE("<<<---Leaving mm_malloc(), returning 0x%X\n", bp);
+		TRACE("<<<---Leaving mm_malloc_hint(), returning 0x%X\n", bp);
 		return bp;
 	}
 
-	/* No fit found, extend the heap */
-	if ((bp = extend_heap(MAX(adjusted_size, ADJUSTED_PAGESIZE))) == NULL) {
-		TRACE("<<<---Leaving mm_malloc(), returning NULL because extend_heap failed\n");
-		return NULL;
+	/* No fit found, so cut it from the wilderness, extending the heap
+		first if the wilderness is too small */
+	if (wild == NULL || GET_THISSIZE(wild) < adjusted_size) {
+		if (extend_heap(MAX(adjusted_size - (wild != NULL &&
+						GET_NEXTBLOCK(wild) == heap_end + 1 ? GET_THISSIZE(wild) : 0),
+						ADJUSTED_PAGESIZE)) == NULL) {
+			TRACE("<<<---Leaving mm_malloc_hint(), returning NULL because extend_heap failed\n");
+			return NULL;
+		}
 	}
-
-	allocate(bp, adjusted_size);
+	bp = carve_wilderness(adjusted_size, hint == MM_HINT_SHORT);
+	LIFETIME_ALLOC(bp);
 
 	RUN_MM_CHECK();
-	TRACE("<<<---Leaving mm_malloc() returning 0x%X\n", bp);
+	TRACE("<<<---Leaving mm_malloc_hint() returning 0x%X\n", bp);
 	return bp;
 }
 
@@ -288,6 +524,7 @@ void *mm_malloc(size_t size)
 void mm_free(void *ptr)
 {
 	TRACE(">>>Entering mm_free(ptr=0x%X)\n", (unsigned int)ptr);
+	LIFETIME_FREE(ptr);
 
 	free_block(ptr, GET_THISSIZE(ptr));
 
@@ -308,7 +545,10 @@ void *mm_realloc(void *ptr, size_t size)
 	void *newptr;
 	size_t copySize;
 
-	newptr = mm_malloc(size);
+	/* A block cut from the back of the wilderness was short-lived, and
+		stays with its kind when it moves */
+	newptr = mm_malloc_hint(size, (wild != NULL && (char *)ptr > wild) ?
+			MM_HINT_SHORT : MM_HINT_NONE);
 	if (newptr == NULL)
 		return NULL;
 
@@ -325,6 +565,277 @@ void *mm_realloc(void *ptr, size_t size)
 	return newptr;
 }
 
+/**
+ * mm_memalign - Allocate a block whose payload address is a multiple of
+ * alignment, which must be a power of two.
+ *
+ * Asks mm_malloc for enough room to slide the payload up to the next
+ * aligned address, leaving at least a minimum-sized block in front.
+ * That front part and any unused tail are split off as free blocks.
+ */
+void *mm_memalign(size_t alignment, size_t size)
+{
+	size_t adjusted_size, csize, lead, prev_alloc;
+	char *bp, *p;
+
+	TRACE(">>>Entering mm_memalign(alignment=%u, size=%u)\n", alignment, size);
+
+	if (alignment <= ALIGNMENT)
+		return mm_malloc(size);
+	if (size == 0)
+		return NULL;
+
+	adjusted_size = ADJUST_BYTESIZE(size);
+	if ((bp = mm_malloc(adjusted_size + alignment + MIN_SIZE)) == NULL)
+		return NULL;
+
+	p = bp;
+	if (((size_t)bp & (alignment - 1)) != 0) {
+		p = (char *)(((size_t)bp + MIN_SIZE + alignment - 1) & ~(alignment - 1));
+		lead = p - bp;
+		csize = GET_THISSIZE(bp);
+		prev_alloc = GET_PREVALLOC(bp);
+
+		/* The aligned block follows a free block now */
+		PUTW(GET_BLOCKHDR(p), PACK(csize - lead, THISALLOC));
+
+		PUTW(GET_BLOCKHDR(bp), PACK(lead, prev_alloc));
+		PUTW(GET_BLOCKFTR(bp), PACK(lead, prev_alloc));
+		coalesce(bp);
+	}
+
+	/* Give back the tail, as allocate() does when it splits */
+	csize = GET_THISSIZE(p);
+	if ((csize - adjusted_size) >= SPLIT_MIN) {
+		PUTW(GET_BLOCKHDR(p), PACK(adjusted_size, THISALLOC | GET_PREVALLOC(p)));
+
+		bp = GET_NEXTBLOCK(p);
+		PUTW(GET_BLOCKHDR(bp), PACK(csize - adjusted_size, PREVALLOC));
+		PUTW(GET_BLOCKFTR(bp), PACK(csize - adjusted_size, PREVALLOC));
+		coalesce(bp);
+	}
+
+	RUN_MM_CHECK();
+	TRACE("<<<---Leaving mm_memalign() returning 0x%X\n", p);
+	return p;
+}
+
+/**
+ * mm_usable_size - Number of payload bytes in an allocated block. An
+ * allocated block has no footer, so everything up to the next header
+ * belongs to the caller, but for the handle of a relocatable block.
+ */
+size_t mm_usable_size(void *ptr)
+{
+	if (GETW(GET_BLOCKHDR(ptr)) & MOVABLE)
+		return GET_THISSIZE(ptr) - 2 * WSIZE;  /* less the handle */
+	return GET_THISSIZE(ptr) - WSIZE;
+}
+
+/**
+ * mm_heap_stats - Walk the heap and add up its allocated and free blocks.
+ * Whatever is in neither (the alignment word, prologue and epilogue) is
+ * the fixed cost of the heap. This visits every block, so it is meant
+ * for sampling the heap now and then, not for every request.
+ */
+void mm_heap_stats(mm_heap_stats_t *stats)
+{
+	char *bp;
+	size_t size;
+
+	memset(stats, 0, sizeof(*stats));
+	stats->heap_size = mem_heapsize();
+
+	for (bp = heap_start + 4 * WSIZE; bp < heap_end; bp = GET_NEXTBLOCK(bp)) {
+		size = GET_THISSIZE(bp);
+		if (GET_THISALLOC(bp)) {
+			stats->alloc_bytes += size;
+			stats->alloc_blocks++;
+		} else {
+			stats->free_bytes += size;
+			stats->free_blocks++;
+			stats->largest_free = MAX(stats->largest_free, size);
+		}
+	}
+}
+
+/**
+ * mm_heap_walk - Call fn on every block, in address order, until it
+ * returns nonzero. Returns what fn returned last, or 0. A free block's
+ * list is the one calc_list_index puts it in, so this costs no list
+ * searches; the wilderness gets FREELIST_COUNT, one past the last.
+ * fn must not allocate from or free to this heap.
+ */
+int mm_heap_walk(mm_walk_fn fn, void *arg)
+{
+	mm_block_t block;
+	char *bp;
+	int ret;
+
+	for (bp = heap_start + 4 * WSIZE; bp < heap_end; bp = GET_NEXTBLOCK(bp)) {
+		block.addr = bp;
+		block.size = GET_THISSIZE(bp);
+		block.alloc = GET_THISALLOC(bp);
+		block.list = block.alloc ? -1 : (bp == wild) ? FREELIST_COUNT :
+				calc_list_index(block.size);
+		if ((ret = fn(&block, arg)) != 0)
+			return ret;
+	}
+	return 0;
+}
+
+/**
+ * mm_halloc - Allocate a relocatable block of size bytes and return its
+ * handle, or MM_NULL_HANDLE. The compactor runs first, so the block can
+ * go in the room it makes.
+ */
+mm_handle_t mm_halloc(size_t size)
+{
+	mm_handle_t h;
+	char *bp;
+
+	TRACE(">>>Entering mm_halloc(size=%u)\n", size);
+	if (size == 0)
+		return MM_NULL_HANDLE;
+	mm_compact(MAX(COMPACT_RATE * size, COMPACT_MIN));
+
+	if (free_handle == 0 && grow_handles() < 0)
+		return MM_NULL_HANDLE;
+	if ((bp = mm_malloc(size + WSIZE)) == NULL)
+		return MM_NULL_HANDLE;
+
+	h = free_handle;
+	free_handle = HANDLE_NEXT(handles[h]);
+	handles[h] = bp;
+	PUTW(GET_BLOCKHDR(bp), GETW(GET_BLOCKHDR(bp)) | MOVABLE);
+	PUTW(GET_BLOCKFTR(bp), h);
+
+	RUN_MM_CHECK();
+	TRACE("<<<---Leaving mm_halloc(), returning %u\n", h);
+	return h;
+}
+
+/**
+ * mm_hrealloc - Resize the block of handle h, which keeps its handle.
+ * Returns h, or MM_NULL_HANDLE with the block untouched if there is no
+ * room.
+ */
+mm_handle_t mm_hrealloc(mm_handle_t h, size_t size)
+{
+	char *oldp, *bp;
+	size_t copy_size;
+
+	TRACE(">>>Entering mm_hrealloc(h=%u, size=%u)\n", h, size);
+	mm_compact(MAX(COMPACT_RATE * size, COMPACT_MIN));
+	oldp = handles[h];
+	if ((bp = mm_malloc(size + WSIZE)) == NULL)
+		return MM_NULL_HANDLE;
+
+	copy_size = mm_usable_size(oldp);
+	if (size < copy_size)
+		copy_size = size;
+	memcpy(bp, oldp, copy_size);
+	mm_free(oldp);
+
+	handles[h] = bp;
+	PUTW(GET_BLOCKHDR(bp), GETW(GET_BLOCKHDR(bp)) | MOVABLE);
+	PUTW(GET_BLOCKFTR(bp), h);
+
+	RUN_MM_CHECK();
+	TRACE("<<<---Leaving mm_hrealloc()\n");
+	return h;
+}
+
+/**
+ * mm_hfree - Free the block of handle h and the handle, then let the
+ * compactor close up the heap a little.
+ */
+void mm_hfree(mm_handle_t h)
+{
+	size_t size = GET_THISSIZE(handles[h]);
+
+	TRACE(">>>Entering mm_hfree(h=%u)\n", h);
+	mm_free(handles[h]);
+	handles[h] = HANDLE_FREE(free_handle);
+	free_handle = h;
+
+	mm_compact(MAX(COMPACT_RATE * size, COMPACT_MIN));
+	TRACE("<<<---Leaving mm_hfree()\n");
+}
+
+/**
+ * mm_hderef - Where the block of handle h is now.
+ */
+void *mm_hderef(mm_handle_t h)
+{
+	return handles[h];
+}
+
+/**
+ * mm_compact - Continue the compactor's sweep for about budget bytes of
+ * work, a byte moved counting one and a block passed COMPACT_VISIT. A
+ * block is only moved whole, so a call that starts with a block larger
+ * than budget moves it anyway. Returns 1 if the sweep reached the end
+ * of the heap, else 0.
+ *
+ * There is nothing to do while no free block is listed and none sits
+ * at the end of the heap beyond the chunk it keeps; then no sweep is
+ * started.
+ */
+int mm_compact(size_t budget)
+{
+	char *bp = compact_at;
+	char *next;
+	size_t work = 0, size;
+
+	if (bp == NULL) {
+		if (listed_count == 0 && (wild == NULL ||
+					GET_NEXTBLOCK(wild) != heap_end + 1 ||
+					GET_THISSIZE(wild) <= 2 * ADJUSTED_PAGESIZE))
+			return 0;
+		bp = heap_start + 4 * WSIZE;
+	}
+	TRACE(">>>Entering mm_compact(budget=%u) at 0x%X\n", budget, bp);
+	compact_stats.steps++;
+
+	while (bp != heap_end + 1) {
+		next = GET_NEXTBLOCK(bp);
+		if (GET_THISALLOC(bp) || !(GETW(GET_BLOCKHDR(next)) & MOVABLE)) {
+			/* Nothing to move here; a free block followed by one that
+				can't move stays a hole */
+			if ((work += COMPACT_VISIT) > budget) {
+				compact_at = next;
+				return 0;
+			}
+			bp = next;
+			continue;
+		}
+
+		size = GET_THISSIZE(next);
+		if (work > 0 && work + size > budget) {
+			compact_at = bp;
+			return 0;
+		}
+		work += size;
+		bp = slide_down(bp);
+	}
+
+	release_tail();
+	compact_at = NULL;
+	compact_stats.sweeps++;
+	RUN_MM_CHECK();
+	TRACE("<<<---Leaving mm_compact() at the end of a sweep\n");
+	return 1;
+}
+
+/**
+ * mm_compact_stats - Copy out the compactor's counts.
+ */
+void mm_compact_stats(mm_compact_stats_t *stats)
+{
+	*stats = compact_stats;
+}
+
 
 /**
  * extend_heap - Extend the heap by number of bytes adjusted_size.
@@ -345,6 +856,8 @@ static void *extend_heap(size_t adjusted_size)
 
 	if ((long)(bp = mem_sbrk(adjusted_size)) == -1)
 		return NULL;
+	PROFILE(prof.extends++);
+	PROFILE(prof.extend_bytes += adjusted_size);
 
 	/* Initialize free block header/footer and the epilogue header.
 		heap_end points to one byte before the next payload, so reading
@@ -382,12 +895,13 @@ static void *coalesce(void *bp)
 	size_t size = GET_THISSIZE(bp);
 	char *next_block = GET_NEXTBLOCK(bp);
 	char *prev_block = GET_PREVBLOCK(bp);
+	int took_wild = 0;
 
 	TRACE(">>>Entering coalesce(bp=0x%X)\n", (unsigned int)bp);
 
 	/* Case 1, Both blocks allocated, does not need its own if statement */
 	if (prev_alloc && !next_alloc) { /* Case 2: only next_block is free */
-		remove_from_list(next_block, calc_list_index(GET_THISSIZE(next_block)));
+		took_wild = take_free(next_block);
 
 		/* Only need to update the size field */
 		size += GET_SIZE(GET_BLOCKHDR(next_block));
@@ -397,7 +911,7 @@ static void *coalesce(void *bp)
 	}
 
 	else if (!prev_alloc && next_alloc) { /* Case 3: only prev_block is free */
-		remove_from_list(prev_block, calc_list_index(GET_THISSIZE(prev_block)));
+		took_wild = take_free(prev_block);
 
 		/* Need to update the size and prev_alloc field */
 		size += GET_THISSIZE(prev_block);
@@ -409,8 +923,8 @@ static void *coalesce(void *bp)
 	}
 
 	else if (!prev_alloc && !next_alloc) { /* Case 4: Both blocks are free */
-		remove_from_list(next_block, calc_list_index(GET_THISSIZE(next_block)));
-		remove_from_list(prev_block, calc_list_index(GET_THISSIZE(prev_block)));
+		took_wild = take_free(next_block);
+		took_wild |= take_free(prev_block);
 
 		/* Need to update the size and prev_alloc field */
 		size += GET_THISSIZE(prev_block) + GET_THISSIZE(next_block);
@@ -421,13 +935,207 @@ static void *coalesce(void *bp)
 		bp = GET_PREVBLOCK(bp);
 	}
 
+	/* The block after a free block must not claim an allocated
+		neighbour, or it would never coalesce with bp */
+	next_block = GET_BLOCKHDR(GET_NEXTBLOCK(bp));
+	PUTW(next_block, GETW(next_block) & ~PREVALLOC);
+
 	/* coalesce() is always called after a block is marked free
 		so it needs to add the block to the appropriate free list */
-	add_to_list(bp, calc_list_index(size));
+	file_free(bp, size, took_wild);
 	TRACE("<<<---Leaving coalesce()\n");
 	return bp;
 }
 
+/**
+ * file_free - Put free block bp, of size bytes, on its list, unless it
+ * took in the wilderness, or is at the end of the heap and larger than
+ * the wilderness: then it is the wilderness. A compactor position the
+ * block swallowed moves to its start.
+ */
+static void file_free(char *bp, size_t size, int took_wild)
+{
+	if (compact_at > bp && compact_at < bp + size)
+		compact_at = bp;
+
+	if (took_wild || (bp + size == heap_end + 1 &&
+				(wild == NULL || GET_THISSIZE(wild) < size))) {
+		if (wild != NULL)
+			add_to_list(wild, calc_list_index(GET_THISSIZE(wild)));
+		wild = bp;
+	}
+	else
+		add_to_list(bp, calc_list_index(size));
+}
+
+/**
+ * take_free - Take a free neighbour that coalesce is about to absorb
+ * off its free list, or stop treating it as the wilderness. Returns
+ * whether it was the wilderness.
+ */
+static int take_free(char *bp)
+{
+	if (bp == wild) {
+		wild = NULL;
+		return 1;
+	}
+	remove_from_list(bp, calc_list_index(GET_THISSIZE(bp)));
+	return 0;
+}
+
+/**
+ * carve_wilderness - Allocate from the front of the wilderness, or from
+ * its back if from_end, which must hold adjusted_size bytes. This is a
+ * pointer bump: a header for the new block and a header and footer for
+ * the rest, with no list updates.
+ */
+static void *carve_wilderness(size_t adjusted_size, int from_end)
+{
+	char *bp = wild;
+	size_t wsize = GET_THISSIZE(bp);
+	size_t is_prev_alloc = GET_PREVALLOC(bp);
+	char *next;
+
+	TRACE(">>>Entering carve_wilderness(adjusted_size=%u, from_end=%d)\n",
+			adjusted_size, from_end);
+	PROFILE(prof.carves++);
+
+	/* Too little would be left over, so take all of it */
+	if (wsize - adjusted_size < MIN_SIZE) {
+		PUTW(GET_BLOCKHDR(bp), PACK(wsize, THISALLOC | is_prev_alloc));
+		next = GET_BLOCKHDR(GET_NEXTBLOCK(bp));
+		PUTW(next, GETW(next) | PREVALLOC);
+		wild = NULL;
+		TRACE("<<<---Leaving carve_wilderness(), used it up\n");
+		return bp;
+	}
+
+	if (from_end) {
+		/* The wilderness keeps its front; the block after the new one
+			now follows an allocated block */
+		PUTW(GET_BLOCKHDR(bp), PACK(wsize - adjusted_size, is_prev_alloc));
+		PUTW(GET_BLOCKFTR(bp), PACK(wsize - adjusted_size, is_prev_alloc));
+		bp = GET_NEXTBLOCK(bp);
+		PUTW(GET_BLOCKHDR(bp), PACK(adjusted_size, THISALLOC));
+		next = GET_BLOCKHDR(GET_NEXTBLOCK(bp));
+		PUTW(next, GETW(next) | PREVALLOC);
+		TRACE("<<<---Leaving carve_wilderness()\n");
+		return bp;
+	}
+
+	PUTW(GET_BLOCKHDR(bp), PACK(adjusted_size, THISALLOC | is_prev_alloc));
+	wild = bp + adjusted_size;
+	PUTW(GET_BLOCKHDR(wild), PACK(wsize - adjusted_size, PREVALLOC));
+	PUTW(GET_BLOCKFTR(wild), PACK(wsize - adjusted_size, PREVALLOC));
+	TRACE("<<<---Leaving carve_wilderness()\n");
+	return bp;
+}
+
+
+/**
+ * grow_handles - Double the handle table in a new block and chain the
+ * new entries onto the free handles, which are all used up. Returns 0,
+ * or -1 if there is no room.
+ */
+static int grow_handles(void)
+{
+	unsigned int count = handle_count ? 2 * handle_count : FIRST_HANDLES;
+	unsigned int first = handle_count ? handle_count : 1;
+	unsigned int i;
+	char **table;
+
+	if ((table = mm_malloc(count * sizeof(char *) + WSIZE)) == NULL)
+		return -1;
+	if (handles != NULL) {
+		memcpy(table, handles, handle_count * sizeof(char *));
+		mm_free(handles);
+	}
+	for (i = first; i < count - 1; i++)
+		table[i] = HANDLE_FREE(i + 1);
+	table[count - 1] = HANDLE_FREE(0);
+
+	handles = table;
+	handles[0] = (char *)table;
+	handle_count = count;
+	free_handle = first;
+	PUTW(GET_BLOCKHDR(table), GETW(GET_BLOCKHDR(table)) | MOVABLE);
+	PUTW(GET_BLOCKFTR(table), 0);
+	return 0;
+}
+
+/**
+ * slide_down - Move the relocatable block after free block bp down to
+ * where bp starts, and point its handle there. The free space ends up
+ * after the block, merged with the free block after that if there is
+ * one, and is returned.
+ */
+static char *slide_down(char *bp)
+{
+	char *mp = GET_NEXTBLOCK(bp);
+	char *next = GET_NEXTBLOCK(mp);
+	size_t fsize = GET_THISSIZE(bp);
+	size_t msize = GET_THISSIZE(mp);
+	unsigned int h = GETW(GET_BLOCKFTR(mp));
+	int took_wild = take_free(bp);
+
+	TRACE(">>>Entering slide_down(bp=0x%X), moving %u bytes\n", bp, msize);
+
+	/* Header, payload and handle word in one go. A free block always
+		follows an allocated one, so the moved block does now too. */
+	memmove(GET_BLOCKHDR(bp), GET_BLOCKHDR(mp), msize);
+	PUTW(GET_BLOCKHDR(bp), PACK(msize, THISALLOC | PREVALLOC | MOVABLE));
+	if (h == 0)
+		handles = (char **)bp;
+	handles[h] = bp;
+	compact_stats.moved_blocks++;
+	compact_stats.moved_bytes += msize;
+
+	if (!GET_THISALLOC(next)) {
+		took_wild |= take_free(next);
+		fsize += GET_THISSIZE(next);
+	}
+	else
+		PUTW(GET_BLOCKHDR(next), GETW(GET_BLOCKHDR(next)) & ~PREVALLOC);
+
+	bp += msize;
+	PUTW(GET_BLOCKHDR(bp), PACK(fsize, PREVALLOC));
+	PUTW(GET_BLOCKFTR(bp), PACK(fsize, PREVALLOC));
+	file_free(bp, fsize, took_wild);
+
+	TRACE("<<<---Leaving slide_down()\n");
+	return bp;
+}
+
+/**
+ * release_tail - Cut a free block at the end of the heap back to one
+ * chunk, and give the rest back to memlib, if that is at least another
+ * chunk.
+ */
+static void release_tail(void)
+{
+	char *bp;
+	size_t size, cut;
+	int took_wild;
+
+	if (GET_PREVALLOC(heap_end + 1))
+		return;
+	bp = GET_PREVBLOCK(heap_end + 1);
+	size = GET_THISSIZE(bp);
+	if (size <= 2 * ADJUSTED_PAGESIZE)
+		return;
+
+	cut = size - ADJUSTED_PAGESIZE;
+	took_wild = take_free(bp);
+	if ((long)mem_sbrk(-(int)cut) != -1) {
+		size -= cut;
+		PUTW(GET_BLOCKHDR(bp), PACK(size, PREVALLOC));
+		PUTW(GET_BLOCKFTR(bp), PACK(size, PREVALLOC));
+		heap_end = mem_heap_hi();
+		PUTW(GET_BLOCKHDR(heap_end + 1), PACK(0xEA7F00D0, THISALLOC));
+		compact_stats.released += cut;
+	}
+	file_free(bp, size, took_wild);
+}
 
 /**
  * free_block - Mark block at specified address as free.
@@ -463,7 +1171,8 @@ static void allocate(void *bp, size_t adjusted_size)
 	remove_from_list(bp, calc_list_index(csize));
 
 	/* See if there's room to split this block into two */
-	if ((csize - adjusted_size) >= (MIN_SIZE)) {
+	if ((csize - adjusted_size) >= (SPLIT_MIN)) {
+		PROFILE(prof.splits++);
 		PUTW(GET_BLOCKHDR(bp), PACK(adjusted_size, THISALLOC | is_prev_alloc));
 		PUTW(GET_BLOCKFTR(bp), PACK(adjusted_size, THISALLOC | is_prev_alloc));
 
@@ -477,6 +1186,7 @@ static void allocate(void *bp, size_t adjusted_size)
 	}
 	else {/* If there's not room to create split the block, just extend the
 		 	amount to allocated */
+		PROFILE(prof.whole++);
 		PUTW(GET_BLOCKHDR(bp), PACK(csize, THISALLOC | is_prev_alloc));
 		PUTW(GET_BLOCKFTR(bp), PACK(csize, THISALLOC | is_prev_alloc));
 
@@ -502,18 +1212,45 @@ static void * find_fit(size_t block_size, int *result_index)
 
 	TRACE(">>>Entering find_fit(block_size=%u, [retval result_index])\n", block_size);
 
-	/* Look at the free list with the minimum size needed to hold block_size */
-	for (list_index = min_index; list_index < FREELIST_COUNT; list_index++) {
+	if (min_index == TREE_INDEX)
+		goto large;
+
+	/* Blocks in the smallest list that can hold block_size may still be
+		too small, so take the first one there that fits */
+	for (fitptr = free_lists[min_index]; fitptr != NULL;
+			fitptr = MEMHEADER_FROM_PAYLOAD(fitptr)->next_free) {
+		if (GET_THISSIZE(fitptr) >= block_size) {
+			PROFILE(prof.first_fit[min_index]++);
+			*result_index = min_index;
+			TRACE("<<<---Leaving find_fit, result_index=%d\n", *result_index);
+			return fitptr;
+		}
+	}
+
+	PROFILE(if (free_lists[min_index] != NULL) prof.passed[min_index]++);
+
+	/* Any block in a larger list fits, so its head will do */
+	for (list_index = min_index + 1; list_index < TREE_INDEX; list_index++) {
 		fitptr = free_lists[list_index];
 
 		/* If the head of the list is not null, we can use it */
 		if (fitptr != NULL && GET_THISSIZE(fitptr) >= block_size) {
+			PROFILE(prof.head_fit[list_index]++);
 			*result_index = list_index;
 			TRACE("<<<---Leaving find_fit, result_index=%d\n", *result_index);
 			return (void *)fitptr;
 		}
 		/* Otherwise, we can't */
 	}
+
+large:
+	/* Best fit among the large blocks */
+	if ((fitptr = tree_best_fit(block_size)) != NULL) {
+		PROFILE(prof.tree_fit++);
+		*result_index = TREE_INDEX;
+		TRACE("<<<---Leaving find_fit, result_index=%d\n", *result_index);
+		return fitptr;
+	}
 	TRACE("<<<---Leaving find_fit()\n");
 	return NULL;
 }
@@ -568,13 +1305,18 @@ static int get_node_listindex(void *bp)
  */
 static int calc_list_index(size_t size)
 {
-	int bits = 0;
+	int bits;
 	TRACE(">>>Entering calc_list_index(size=%u)\n", size);
-	while ((size >> bits > 1) && (bits + 1 < FREELIST_COUNT)) {
-		bits++;
-	}
-	TRACE("<<<---Leaving calc_list_index(), returning %d\n", bits);
-	return bits;
+
+	if (size <= SMALL_LIMIT)
+		return small_class[size / ALIGNMENT];
+	if (size >= (1 << LARGE_BITS))
+		return FREELIST_COUNT - 1;
+
+	/* Medium sizes: find the top bit, then take the bits under it */
+	bits = 31 - __builtin_clz((unsigned int)size);
+	TRACE("<<<---Leaving calc_list_index(), returning %d\n", MEDIUM_CLASS(size, bits));
+	return MEDIUM_CLASS(size, bits);
 }
 
 
@@ -589,6 +1331,13 @@ static void remove_from_list(char *bp, int list_index)
 	mem_header *prev_header;
 
 	TRACE(">>>Entering remove_from_list(bp=0x%X, list_index=%d)\n", (unsigned int)bp, list_index);
+
+	listed_count--;
+	if (list_index == TREE_INDEX) {
+		tree_remove(bp);
+		TRACE("<<<---Leaving remove_from_list(), removed from the tree\n");
+		return;
+	}
 	TRACE("        Removing data block of size %u\n", header->size_alloc);
 	TRACE("        header->next_free = %0x%X\n", header->next_free);
 	TRACE("        header->prev_free = %0x%X\n", header->prev_free);
@@ -622,6 +1371,13 @@ static void add_to_list(char *bp, int list_index)
 
 	TRACE(">>>Entering add_to_list(bp=0x%X, list_index=%d)\n", (unsigned int)bp, list_index);
 
+	listed_count++;
+	if (list_index == TREE_INDEX) {
+		tree_insert(bp);
+		TRACE("<<<---Leaving add_to_list(), added to the tree\n");
+		return;
+	}
+
 	current->next_free = NULL;
 
 	tail_payload = find_end_of_list(list_index);
@@ -643,6 +1399,247 @@ static void add_to_list(char *bp, int list_index)
 
 
 
+/**
+ * tree_rotate_left - Make x the left child of its right child.
+ */
+static void tree_rotate_left(char *x)
+{
+	char *y = NODE(x)->right;
+
+	NODE(x)->right = NODE(y)->left;
+	if (NODE(y)->left != NULL)
+		NODE(NODE(y)->left)->parent = x;
+	NODE(y)->parent = NODE(x)->parent;
+	if (NODE(x)->parent == NULL)
+		free_lists[TREE_INDEX] = y;
+	else if (x == NODE(NODE(x)->parent)->left)
+		NODE(NODE(x)->parent)->left = y;
+	else
+		NODE(NODE(x)->parent)->right = y;
+	NODE(y)->left = x;
+	NODE(x)->parent = y;
+}
+
+/**
+ * tree_rotate_right - Make x the right child of its left child.
+ */
+static void tree_rotate_right(char *x)
+{
+	char *y = NODE(x)->left;
+
+	NODE(x)->left = NODE(y)->right;
+	if (NODE(y)->right != NULL)
+		NODE(NODE(y)->right)->parent = x;
+	NODE(y)->parent = NODE(x)->parent;
+	if (NODE(x)->parent == NULL)
+		free_lists[TREE_INDEX] = y;
+	else if (x == NODE(NODE(x)->parent)->right)
+		NODE(NODE(x)->parent)->right = y;
+	else
+		NODE(NODE(x)->parent)->left = y;
+	NODE(y)->right = x;
+	NODE(x)->parent = y;
+}
+
+/**
+ * tree_insert - Add the large free block bp to the tree.
+ */
+static void tree_insert(char *bp)
+{
+	char *parent = NULL, *cur = free_lists[TREE_INDEX], *grand, *uncle;
+
+	while (cur != NULL) {
+		parent = cur;
+		cur = TREE_BEFORE(bp, cur) ? NODE(cur)->left : NODE(cur)->right;
+	}
+	NODE(bp)->parent = parent;
+	NODE(bp)->left = NODE(bp)->right = NULL;
+	NODE(bp)->red = 1;
+	if (parent == NULL)
+		free_lists[TREE_INDEX] = bp;
+	else if (TREE_BEFORE(bp, parent))
+		NODE(parent)->left = bp;
+	else
+		NODE(parent)->right = bp;
+
+	/* A red node may not have a red parent; the root is never red,
+		so a red parent always has a parent of its own */
+	while (IS_RED(parent = NODE(bp)->parent)) {
+		grand = NODE(parent)->parent;
+		if (parent == NODE(grand)->left) {
+			uncle = NODE(grand)->right;
+			if (IS_RED(uncle)) {
+				NODE(parent)->red = NODE(uncle)->red = 0;
+				NODE(grand)->red = 1;
+				bp = grand;
+				continue;
+			}
+			if (bp == NODE(parent)->right) {
+				bp = parent;
+				tree_rotate_left(bp);
+				parent = NODE(bp)->parent;
+			}
+			NODE(parent)->red = 0;
+			NODE(grand)->red = 1;
+			tree_rotate_right(grand);
+		}
+		else {
+			uncle = NODE(grand)->left;
+			if (IS_RED(uncle)) {
+				NODE(parent)->red = NODE(uncle)->red = 0;
+				NODE(grand)->red = 1;
+				bp = grand;
+				continue;
+			}
+			if (bp == NODE(parent)->left) {
+				bp = parent;
+				tree_rotate_right(bp);
+				parent = NODE(bp)->parent;
+			}
+			NODE(parent)->red = 0;
+			NODE(grand)->red = 1;
+			tree_rotate_left(grand);
+		}
+	}
+	NODE(free_lists[TREE_INDEX])->red = 0;
+}
+
+/**
+ * tree_replace - Put the subtree v where the subtree u was.
+ */
+static void tree_replace(char *u, char *v)
+{
+	char *parent = NODE(u)->parent;
+
+	if (parent == NULL)
+		free_lists[TREE_INDEX] = v;
+	else if (u == NODE(parent)->left)
+		NODE(parent)->left = v;
+	else
+		NODE(parent)->right = v;
+	if (v != NULL)
+		NODE(v)->parent = parent;
+}
+
+/**
+ * tree_remove - Take the large free block bp out of the tree.
+ */
+static void tree_remove(char *bp)
+{
+	char *y = bp, *x, *parent, *w;
+	int removed_red = NODE(bp)->red;
+
+	/* Unlink bp, or the next node after it when it has two children */
+	if (NODE(bp)->left == NULL) {
+		x = NODE(bp)->right;
+		parent = NODE(bp)->parent;
+		tree_replace(bp, x);
+	}
+	else if (NODE(bp)->right == NULL) {
+		x = NODE(bp)->left;
+		parent = NODE(bp)->parent;
+		tree_replace(bp, x);
+	}
+	else {
+		for (y = NODE(bp)->right; NODE(y)->left != NULL; y = NODE(y)->left)
+			;
+		removed_red = NODE(y)->red;
+		x = NODE(y)->right;
+		if (NODE(y)->parent == bp)
+			parent = y;
+		else {
+			parent = NODE(y)->parent;
+			tree_replace(y, x);
+			NODE(y)->right = NODE(bp)->right;
+			NODE(NODE(y)->right)->parent = y;
+		}
+		tree_replace(bp, y);
+		NODE(y)->left = NODE(bp)->left;
+		NODE(NODE(y)->left)->parent = y;
+		NODE(y)->red = NODE(bp)->red;
+	}
+	if (removed_red)
+		return;
+
+	/* x, which may be NULL, is one black node short; fix that going up */
+	while (x != free_lists[TREE_INDEX] && !IS_RED(x)) {
+		if (x == NODE(parent)->left) {
+			w = NODE(parent)->right;
+			if (IS_RED(w)) {
+				NODE(w)->red = 0;
+				NODE(parent)->red = 1;
+				tree_rotate_left(parent);
+				w = NODE(parent)->right;
+			}
+			if (!IS_RED(NODE(w)->left) && !IS_RED(NODE(w)->right)) {
+				NODE(w)->red = 1;
+				x = parent;
+				parent = NODE(x)->parent;
+				continue;
+			}
+			if (!IS_RED(NODE(w)->right)) {
+				NODE(NODE(w)->left)->red = 0;
+				NODE(w)->red = 1;
+				tree_rotate_right(w);
+				w = NODE(parent)->right;
+			}
+			NODE(w)->red = NODE(parent)->red;
+			NODE(parent)->red = 0;
+			NODE(NODE(w)->right)->red = 0;
+			tree_rotate_left(parent);
+		}
+		else {
+			w = NODE(parent)->left;
+			if (IS_RED(w)) {
+				NODE(w)->red = 0;
+				NODE(parent)->red = 1;
+				tree_rotate_right(parent);
+				w = NODE(parent)->left;
+			}
+			if (!IS_RED(NODE(w)->left) && !IS_RED(NODE(w)->right)) {
+				NODE(w)->red = 1;
+				x = parent;
+				parent = NODE(x)->parent;
+				continue;
+			}
+			if (!IS_RED(NODE(w)->left)) {
+				NODE(NODE(w)->right)->red = 0;
+				NODE(w)->red = 1;
+				tree_rotate_left(w);
+				w = NODE(parent)->left;
+			}
+			NODE(w)->red = NODE(parent)->red;
+			NODE(parent)->red = 0;
+			NODE(NODE(w)->left)->red = 0;
+			tree_rotate_right(parent);
+		}
+		x = free_lists[TREE_INDEX];
+	}
+	if (x != NULL)
+		NODE(x)->red = 0;
+}
+
+/**
+ * tree_best_fit - Return the smallest large free block of at least
+ * size bytes (the lowest addressed of equals), or NULL.
+ */
+static char *tree_best_fit(size_t size)
+{
+	char *cur = free_lists[TREE_INDEX], *best = NULL;
+
+	while (cur != NULL) {
+		if (GET_THISSIZE(cur) >= size) {
+			best = cur;
+			cur = NODE(cur)->left;
+		}
+		else
+			cur = NODE(cur)->right;
+	}
+	return best;
+}
+
+
+
 
 /************************  Welcome to testing land!  **************************/
 /*																			  */
@@ -677,7 +1674,168 @@ static void add_to_list(char *bp, int list_index)
 
 
 
+#ifdef PREDICT_LIFETIME
+/**
+ * predict_lifetime - MM_HINT_SHORT if blocks of this size have lived
+ * under SHORT_LIFE allocations on average so far, else MM_HINT_LONG.
+ */
+static int predict_lifetime(size_t adjusted_size)
+{
+	int c = calc_list_index(adjusted_size);
+
+	if (life_allocs[c] < LIFE_MIN)
+		return MM_HINT_LONG;
+	return ((unsigned long long)life_live[c] * life_clock <
+			(unsigned long long)SHORT_LIFE * life_allocs[c]) ? MM_HINT_SHORT : MM_HINT_LONG;
+}
+
+/**
+ * lifetime_alloc - Count block bp, just allocated, in its size class.
+ */
+static void lifetime_alloc(char *bp)
+{
+	int c = calc_list_index(GET_THISSIZE(bp));
+
+	life_allocs[c]++;
+	life_live[c]++;
+	if (++life_clock == LIFE_WINDOW) {
+		for (c = 0; c < FREELIST_COUNT; c++)
+			life_allocs[c] /= 2;
+		life_clock /= 2;
+	}
+}
+
+/**
+ * lifetime_free - Count block bp, about to be freed, out of its class.
+ * mm_memalign trims blocks after they are counted, so the class may
+ * have none left.
+ */
+static void lifetime_free(char *bp)
+{
+	int c = calc_list_index(GET_THISSIZE(bp));
+
+	if (life_live[c] > 0)
+		life_live[c]--;
+}
+#endif
+
+#ifdef MM_PROFILE
+/**
+ * profile_heap - Count the heap of the run that just ended, if any. The
+ * driver has reset memlib by the time mm_init runs, so the size comes
+ * from our own bounds.
+ */
+static void profile_heap(void)
+{
+	size_t size;
+
+	if (heap_start == NULL)
+		return;
+	size = heap_end + 1 - heap_start;
+	prof.runs++;
+	prof.heap_bytes += size;
+	if (prof.min_heap == 0 || size < prof.min_heap)
+		prof.min_heap = size;
+	heap_start = NULL;
+}
+
+/**
+ * profile_write - Write the counts to the profile file. Runs at exit,
+ * and only in the process that registered it, not in forked children.
+ */
+static void profile_write(void)
+{
+	char *path = getenv("MM_PROFILE");
+	FILE *fp;
+	size_t size;
+	int i, list;
+
+	if (getpid() != prof.pid)
+		return;
+	profile_heap();
+	if (path == NULL || *path == '\0')
+		path = "mm.prof";
+	if ((fp = fopen(path, "w")) == NULL) {
+		fprintf(stderr, "mm: can't write profile %s\n", path);
+		return;
+	}
+
+	fprintf(fp, "mmprofile 1\n");
+	fprintf(fp, "config %d %d %d %d\n", CLASS_BITS, MEDIUM_BASE,
+			SPLIT_MIN, (int)ADJUSTED_PAGESIZE);
+	fprintf(fp, "heap %lu %lu %lu\n", prof.runs, prof.heap_bytes, prof.min_heap);
+	for (i = 0; i < PROFILE_SIZES; i++)
+		if (prof.sizes[i] != 0)
+			fprintf(fp, "size %d %lu\n", i * ALIGNMENT, prof.sizes[i]);
+	fprintf(fp, "large %lu %lu\n", prof.large, prof.large_bytes);
+
+	/* Each list with the smallest block size it holds */
+	for (list = -1, size = MIN_SIZE; size < (1 << LARGE_BITS); size += ALIGNMENT) {
+		if (calc_list_index(size) == list)
+			continue;
+		list = calc_list_index(size);
+		fprintf(fp, "list %d %u %lu %lu %lu\n", list, (unsigned)size,
+				prof.first_fit[list], prof.passed[list], prof.head_fit[list]);
+	}
+	fprintf(fp, "tree %lu\n", prof.tree_fit);
+	fprintf(fp, "wild %lu %lu %lu\n", prof.carves, prof.extends, prof.extend_bytes);
+	fprintf(fp, "split %lu %lu\n", prof.splits, prof.whole);
+	fclose(fp);
+}
+
+/**
+ * profile_init - Count the previous heap, which mm_init is about to
+ * throw away, and arrange for the counts to be written at exit.
+ */
+static void profile_init(void)
+{
+	profile_heap();
+	if (prof.pid == 0) {
+		prof.pid = getpid();
+		atexit(profile_write);
+	}
+}
+
+/**
+ * profile_request - Count a request for a block of adjusted_size bytes.
+ */
+static void profile_request(size_t adjusted_size)
+{
+	if (adjusted_size < (1 << LARGE_BITS))
+		prof.sizes[adjusted_size / ALIGNMENT]++;
+	else {
+		prof.large++;
+		prof.large_bytes += adjusted_size;
+	}
+}
+#endif
+
 #ifdef DO_MM_CHECK
+/**
+ * check_tree - Check the subtree at bp and return its black height.
+ */
+static int check_tree(char *bp, char *parent)
+{
+	int left_height, right_height;
+
+	if (bp == NULL)
+		return 1;
+	assert(!GET_THISALLOC(bp));
+	assert(GET_THISSIZE(bp) >= (1 << LARGE_BITS));
+	assert(NODE(bp)->parent == parent);
+	if (NODE(bp)->left != NULL)
+		assert(TREE_BEFORE(NODE(bp)->left, bp));
+	if (NODE(bp)->right != NULL)
+		assert(TREE_BEFORE(bp, NODE(bp)->right));
+	if (IS_RED(bp))
+		assert(!IS_RED(NODE(bp)->left) && !IS_RED(NODE(bp)->right));
+
+	left_height = check_tree(NODE(bp)->left, bp);
+	right_height = check_tree(NODE(bp)->right, bp);
+	assert(left_height == right_height);
+	return left_height + !IS_RED(bp);
+}
+
 /**
  * mm_check - Check the consistency of the heap.
  */
@@ -703,7 +1861,7 @@ void mm_check()
 	#endif
 
 	/* Then, make sure the blocks in our free lists are actually free. */
-	for (i = 0; i < FREELIST_COUNT; i++) {
+	for (i = 0; i < TREE_INDEX; i++) {
 		bp = free_lists[i];
 		while (bp != NULL) {
 			assert(!GET_THISALLOC(bp));
@@ -711,6 +1869,10 @@ void mm_check()
 			bp = MEMHEADER_FROM_PAYLOAD(bp)->next_free;
 		}
 	}
+	/* The same for the tree, which must also be in order and balanced */
+	assert(!IS_RED(free_lists[TREE_INDEX]));
+	check_tree(free_lists[TREE_INDEX], NULL);
+
 	/* Finally, make sure we haven't misaligned our headers and payload.
 		If a payload is misinterpreted as a header, its size will be
 		over 1 million (discounting the first block which is all zeroes). */
@@ -718,6 +1880,9 @@ void mm_check()
 
 	while (bp < heap_end) {
 		assert(GET_THISSIZE(bp) < MAX_BLOCK_ALLOCSIZE);
+		/* A relocatable block's handle leads back to it */
+		if (GETW(GET_BLOCKHDR(bp)) & MOVABLE)
+			assert(handles[GETW(GET_BLOCKFTR(bp))] == bp);
 		bp = GET_NEXTBLOCK(bp);
 	}
 }
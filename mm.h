@@ -1,9 +1,73 @@
+#ifndef __MM_H_
+#define __MM_H_
+
 #include <stdio.h>
 
 extern int mm_init (void);
 extern void *mm_malloc (size_t size);
+
+/* How long a block from mm_malloc_hint is expected to live */
+#define MM_HINT_NONE  0  /* unknown; see PREDICT_LIFETIME in mm.c */
+#define MM_HINT_SHORT 1  /* freed soon after it is allocated */
+#define MM_HINT_LONG  2  /* outlives most blocks allocated after it */
+
+extern void *mm_malloc_hint(size_t size, int hint);
 extern void mm_free (void *ptr);
 extern void *mm_realloc(void *ptr, size_t size);
+extern void *mm_memalign(size_t alignment, size_t size);
+extern size_t mm_usable_size(void *ptr);
+
+/* Where the bytes of the heap are, for fragmentation reports */
+typedef struct {
+	size_t heap_size;    /* bytes obtained with mem_sbrk */
+	size_t alloc_bytes;  /* in allocated blocks, headers included */
+	size_t alloc_blocks;
+	size_t free_bytes;   /* in free blocks */
+	size_t free_blocks;
+	size_t largest_free; /* size of the largest free block */
+} mm_heap_stats_t;
+
+extern void mm_heap_stats(mm_heap_stats_t *stats);
+
+/* One block of the heap, as mm_heap_walk sees it */
+typedef struct {
+	void *addr;          /* payload address */
+	size_t size;         /* block size, header included */
+	int alloc;           /* allocated? */
+	int list;            /* free list of a free block; -1 if allocated,
+	                        one past the last list for the wilderness */
+} mm_block_t;
+
+/* Called for each block; a nonzero return stops the walk */
+typedef int (*mm_walk_fn)(mm_block_t *block, void *arg);
+
+extern int mm_heap_walk(mm_walk_fn fn, void *arg);
+
+/*
+ * Relocatable blocks. mm.c may move a block from mm_halloc to close
+ * up the holes below it, so the block is reached through its handle.
+ * A pointer from mm_hderef is good until the next call to mm_halloc,
+ * mm_hrealloc, mm_hfree or mm_compact.
+ */
+typedef unsigned int mm_handle_t;
+#define MM_NULL_HANDLE 0
+
+extern mm_handle_t mm_halloc(size_t size);
+extern mm_handle_t mm_hrealloc(mm_handle_t h, size_t size);
+extern void mm_hfree(mm_handle_t h);
+extern void *mm_hderef(mm_handle_t h);
+extern int mm_compact(size_t budget);
+
+/* What the compactor has done since mm_init */
+typedef struct {
+	size_t steps;        /* calls that did some work */
+	size_t moved_blocks; /* relocatable blocks slid toward heap_start */
+	size_t moved_bytes;  /* their bytes, headers included */
+	size_t sweeps;       /* passes that reached the end of the heap */
+	size_t released;     /* bytes given back with a negative mem_sbrk */
+} mm_compact_stats_t;
+
+extern void mm_compact_stats(mm_compact_stats_t *stats);
 
 
 /* 
@@ -21,3 +85,4 @@ typedef struct {
 
 extern team_t team;
 
+#endif /* __MM_H_ */
@@ -0,0 +1,218 @@
+/*
+ * mmbench.c - A small, fixed allocation workload for comparing the
+ *             system malloc with libmm.so (see mmbench.sh).
+ *
+ * Each phase imitates a common way programs use the heap:
+ *     strings  - a hash table of strdup'd keys, half deleted and refilled
+ *     vectors  - arrays grown by doubling with realloc, then trimmed
+ *     tree     - a binary search tree of small nodes, built and torn down
+ *     mixed    - random sizes freed in random order, like the random traces
+ *
+ * The sequence of requests depends only on the seed, so every run of the
+ * benchmark makes the same requests.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#define SEED         12345
+#define NUM_STRINGS  200000
+#define HASH_BUCKETS 65536
+#define NUM_VECTORS  2000
+#define VECTOR_LEN   4096
+#define NUM_NODES    300000
+#define NUM_MIXED    400000
+#define MIXED_LIVE   20000
+
+/* Hash table entry */
+typedef struct entry {
+	struct entry *next;
+	char *key;
+	int value;
+} entry_t;
+
+/* Binary search tree node */
+typedef struct node {
+	struct node *left, *right;
+	unsigned key;
+} node_t;
+
+static unsigned long rand_state = SEED;
+
+static unsigned rand_next(void);
+static double secs_since(struct timeval *t0);
+static double phase_strings(void);
+static double phase_vectors(void);
+static double phase_tree(void);
+static double phase_mixed(void);
+static void free_tree(node_t *t);
+
+int main(void)
+{
+	double s, total = 0;
+
+	printf("%-8s %8s\n", "phase", "secs");
+	total += (s = phase_strings());
+	printf("%-8s %8.3f\n", "strings", s);
+	total += (s = phase_vectors());
+	printf("%-8s %8.3f\n", "vectors", s);
+	total += (s = phase_tree());
+	printf("%-8s %8.3f\n", "tree", s);
+	total += (s = phase_mixed());
+	printf("%-8s %8.3f\n", "mixed", s);
+	printf("%-8s %8.3f\n", "total", total);
+	return 0;
+}
+
+/*
+ * phase_strings - hash table of strdup'd keys
+ */
+static double phase_strings(void)
+{
+	entry_t **table = calloc(HASH_BUCKETS, sizeof(entry_t *));
+	entry_t *e, **pe;
+	struct timeval t0;
+	char key[32];
+	int i, pass;
+
+	gettimeofday(&t0, NULL);
+	for (pass = 0; pass < 2; pass++) {
+		for (i = 0; i < NUM_STRINGS; i++) {
+			sprintf(key, "key-%u-%d", rand_next() % 1000000, i);
+			e = malloc(sizeof(entry_t));
+			e->key = strdup(key);
+			e->value = i;
+			pe = &table[rand_next() % HASH_BUCKETS];
+			e->next = *pe;
+			*pe = e;
+		}
+		/* Delete about half of the entries */
+		for (i = 0; i < HASH_BUCKETS; i++)
+			for (pe = &table[i]; (e = *pe) != NULL; )
+				if (rand_next() & 1) {
+					*pe = e->next;
+					free(e->key);
+					free(e);
+				} else
+					pe = &e->next;
+	}
+	for (i = 0; i < HASH_BUCKETS; i++)
+		while ((e = table[i]) != NULL) {
+			table[i] = e->next;
+			free(e->key);
+			free(e);
+		}
+	free(table);
+	return secs_since(&t0);
+}
+
+/*
+ * phase_vectors - arrays grown by doubling, then trimmed to size
+ */
+static double phase_vectors(void)
+{
+	int *v[NUM_VECTORS];
+	struct timeval t0;
+	int i, j, len, cap;
+
+	gettimeofday(&t0, NULL);
+	for (i = 0; i < NUM_VECTORS; i++) {
+		len = rand_next() % VECTOR_LEN + 1;
+		cap = 1;
+		v[i] = malloc(cap * sizeof(int));
+		for (j = 0; j < len; j++) {
+			if (j == cap) {
+				cap *= 2;
+				v[i] = realloc(v[i], cap * sizeof(int));
+			}
+			v[i][j] = j;
+		}
+		v[i] = realloc(v[i], len * sizeof(int));
+
+		/* Keep a window of vectors alive */
+		if (i >= 64) {
+			free(v[i - 64]);
+			v[i - 64] = NULL;
+		}
+	}
+	for (i = 0; i < NUM_VECTORS; i++)
+		free(v[i]);
+	return secs_since(&t0);
+}
+
+/*
+ * phase_tree - unbalanced binary search tree on random keys
+ */
+static double phase_tree(void)
+{
+	node_t *root = NULL, *n, **pn;
+	struct timeval t0;
+	int i;
+
+	gettimeofday(&t0, NULL);
+	for (i = 0; i < NUM_NODES; i++) {
+		n = malloc(sizeof(node_t));
+		n->left = n->right = NULL;
+		n->key = rand_next();
+		for (pn = &root; *pn != NULL; )
+			pn = (n->key < (*pn)->key) ? &(*pn)->left : &(*pn)->right;
+		*pn = n;
+	}
+	free_tree(root);
+	return secs_since(&t0);
+}
+
+static void free_tree(node_t *t)
+{
+	if (t == NULL)
+		return;
+	free_tree(t->left);
+	free_tree(t->right);
+	free(t);
+}
+
+/*
+ * phase_mixed - random sizes, random lifetimes
+ */
+static double phase_mixed(void)
+{
+	char *live[MIXED_LIVE];
+	struct timeval t0;
+	int i, k;
+	size_t size;
+
+	memset(live, 0, sizeof(live));
+	gettimeofday(&t0, NULL);
+	for (i = 0; i < NUM_MIXED; i++) {
+		k = rand_next() % MIXED_LIVE;
+		free(live[k]);
+		/* Mostly small, sometimes a few KB */
+		size = (rand_next() % 8 == 0) ? rand_next() % 8192 + 1 : rand_next() % 128 + 1;
+		live[k] = malloc(size);
+		live[k][0] = live[k][size - 1] = (char)i;
+	}
+	for (k = 0; k < MIXED_LIVE; k++)
+		free(live[k]);
+	return secs_since(&t0);
+}
+
+/*
+ * rand_next - 31-bit linear congruential generator; the same on every libc
+ */
+static unsigned rand_next(void)
+{
+	rand_state = (rand_state * 1103515245 + 12345) & 0x7fffffff;
+	return (unsigned)rand_state;
+}
+
+/*
+ * secs_since - wall clock seconds since t0
+ */
+static double secs_since(struct timeval *t0)
+{
+	struct timeval now;
+
+	gettimeofday(&now, NULL);
+	return (now.tv_sec - t0->tv_sec) + 1E-6*(now.tv_usec - t0->tv_usec);
+}
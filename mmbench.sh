@@ -0,0 +1,45 @@
+#!/bin/sh
+#
+# mmbench.sh - Time a workload on the system malloc and again with
+#              libmm.so preloaded.
+#
+#     unix> make bench                 (runs ./mmbench)
+#     unix> ./mmbench.sh sort -n big.txt
+#
+# The command runs RUNS times in each configuration and the best wall
+# time is reported. Its output is discarded.
+#
+RUNS=${RUNS:-3}
+LIB=${LIB:-./libmm.so}
+
+if [ $# -eq 0 ]; then
+	set -- ./mmbench
+fi
+case "$LIB" in
+	/*) ;;
+	*) LIB=$(pwd)/$LIB ;;
+esac
+if [ ! -f "$LIB" ]; then
+	echo "mmbench.sh: $LIB not found; run \"make libmm.so\" first" >&2
+	exit 1
+fi
+
+# best - best wall time in seconds of RUNS runs of "$@"
+best() {
+	b=""
+	i=0
+	while [ $i -lt $RUNS ]; do
+		s=$(date +%s.%N)
+		"$@" > /dev/null || return 1
+		e=$(date +%s.%N)
+		b=$(echo "$s $e $b" | awk '{t = $2 - $1; if ($3 == "" || t < $3) print t; else print $3}')
+		i=$((i + 1))
+	done
+	echo $b
+}
+
+libc=$(best "$@") || { echo "mmbench.sh: $* failed" >&2; exit 1; }
+mm=$(best env LD_PRELOAD="$LIB" "$@") || { echo "mmbench.sh: $* failed under $LIB" >&2; exit 1; }
+
+echo "workload: $*"
+echo "$libc $mm" | awk '{printf "libc malloc  %8.3f secs\nlibmm.so     %8.3f secs  (%.2fx)\n", $1, $2, $2 / $1}'
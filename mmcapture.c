@@ -0,0 +1,660 @@
+/*
+ * mmcapture.c - LD_PRELOAD shim that records a program's allocations
+ *               as a .rep trace that mdriver can replay.
+ *
+ *     unix> make libmmcapture.so
+ *     unix> MMCAPTURE_FILE=ls.rep LD_PRELOAD=./libmmcapture.so ls -l
+ *     unix> mdriver -V -f ls.rep
+ *
+ * malloc, free, realloc, calloc, memalign, posix_memalign and
+ * aligned_alloc are intercepted and forwarded to the next definition
+ * (normally libc). Every live block is mapped to a trace id in a small
+ * hash table. A realloc keeps its block's id, so the trace replays it
+ * as "r <id> <bytes>".
+ *
+ * The id map and a global sequence number are updated under one lock,
+ * so the recorded order is consistent with the order in which libc
+ * handed out and took back addresses. Records go into a buffer owned
+ * by the calling thread. Full buffers are queued to a background writer
+ * thread, which appends them to <file>.tmp. The thread that calls
+ * malloc never does I/O. At exit the records are sorted by sequence
+ * number and written out as <file> with the usual 4-line header and a
+ * "t <tid>" line wherever the recording thread changes.
+ *
+ * Environment:
+ *     MMCAPTURE_FILE     output trace (default mmcapture.%p.rep); a %p
+ *                        is replaced by the process id, so that every
+ *                        program a script execs gets its own trace
+ *     MMCAPTURE_BALANCE  if 0, don't append frees for blocks still live
+ *                        at exit (default 1, giving a balanced trace)
+ *
+ * Alignment requests are recorded as plain allocations; mdriver has no
+ * way to replay them. Blocks allocated before the shim started, and
+ * the allocations of forked children, are not recorded. A process that
+ * leaves through _exit or exec never runs our destructor, so its
+ * records stay behind in the .tmp file.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "trace.h"
+
+#define CAP_BUF_RECS   4096        /* records per thread buffer */
+#define BOOTSTRAP_SIZE (64 * 1024) /* heap for dlsym while we start up */
+#define MAP_MIN_SLOTS  (1 << 16)   /* initial size of the id map */
+#define MAXLINE        1024        /* max string size */
+
+/* One recorded request */
+typedef struct {
+	unsigned long long seq;  /* global order of the request */
+	int type;                /* ALLOC, FREE or REALLOC */
+	int id;                  /* trace id of the block */
+	unsigned size;           /* payload bytes (ALLOC and REALLOC) */
+	int tid;                 /* recording thread */
+} caprec_t;
+
+/* A buffer of records, owned by a thread until it is queued */
+typedef struct capbuf {
+	struct capbuf *next;
+	int n;
+	caprec_t recs[CAP_BUF_RECS];
+} capbuf_t;
+
+/* Per-thread recording state */
+typedef struct tstate {
+	struct tstate *next;   /* all live threads, for the final flush */
+	struct tstate *prev;
+	capbuf_t *buf;
+	int tid;
+} tstate_t;
+
+/* One slot of the open-addressed pointer -> id map */
+typedef struct {
+	void *ptr;             /* NULL marks an empty slot */
+	int id;
+} mapslot_t;
+
+/* The functions we forward to */
+static void *(*real_malloc)(size_t);
+static void (*real_free)(void *);
+static void *(*real_realloc)(void *, size_t);
+static void *(*real_calloc)(size_t, size_t);
+static void *(*real_memalign)(size_t, size_t);
+static int (*real_posix_memalign)(void **, size_t, size_t);
+static void *(*real_aligned_alloc)(size_t, size_t);
+
+/* Start-up state */
+static int initializing = 0;
+static char bootstrap[BOOTSTRAP_SIZE] __attribute__((aligned(16)));
+static size_t bootstrap_used = 0;
+
+/* Everything below is protected by lock */
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static int capturing = 0;
+static unsigned long long next_seq = 0;
+static int next_id = 0;
+static int next_tid = 0;
+static mapslot_t *map = NULL;
+static size_t map_slots = 0, map_used = 0;
+static tstate_t *threads = NULL;
+static capbuf_t *queue_head = NULL, *queue_tail = NULL;
+static int writer_stop = 0;
+static unsigned long long num_records = 0;
+
+/* Writer thread */
+static pthread_t writer;
+static pthread_cond_t queue_cond = PTHREAD_COND_INITIALIZER;
+static int tmp_fd = -1;
+static char out_path[MAXLINE];
+static char tmp_path[MAXLINE + 8];
+static pthread_key_t tstate_key;
+
+/* Set while this thread is inside the shim, so our own calls aren't recorded */
+static __thread int in_hook __attribute__((tls_model("initial-exec")));
+static __thread tstate_t *my_ts __attribute__((tls_model("initial-exec")));
+
+static void capture_init(void) __attribute__((constructor));
+static void capture_fini(void) __attribute__((destructor));
+static void *writer_main(void *arg);
+static void note_alloc(void *p, size_t size);
+static void note_free(void *p);
+static void record(int type, int id, size_t size);
+static void map_put(void *ptr, int id);
+static int map_take(void *ptr);
+static void flush_tstate(void *arg);
+static void child_after_fork(void);
+static void write_trace(void);
+static int cmp_seq(const void *a, const void *b);
+
+/*****************
+ * Interposed API
+ *****************/
+
+void *malloc(size_t size)
+{
+	void *p;
+
+	if (real_malloc == NULL) {
+		if (initializing) { /* dlsym needs memory before we have malloc */
+			size = (size + 15) & ~(size_t)15;
+			if (bootstrap_used + size > BOOTSTRAP_SIZE)
+				return NULL;
+			p = bootstrap + bootstrap_used;
+			bootstrap_used += size;
+			return p;
+		}
+		capture_init();
+	}
+	p = real_malloc(size);
+	if (p != NULL && capturing && !in_hook)
+		note_alloc(p, size);
+	return p;
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+	void *p;
+
+	if (real_calloc == NULL) {
+		if (initializing) /* bootstrap memory is static, so already zero */
+			return malloc(nmemb * size);
+		capture_init();
+	}
+	p = real_calloc(nmemb, size);
+	if (p != NULL && capturing && !in_hook)
+		note_alloc(p, nmemb * size);
+	return p;
+}
+
+void free(void *ptr)
+{
+	if (ptr == NULL ||
+			((char *)ptr >= bootstrap && (char *)ptr < bootstrap + BOOTSTRAP_SIZE))
+		return;
+	if (real_free == NULL)
+		capture_init();
+
+	/* Forget the id before libc can hand the address out again */
+	if (capturing && !in_hook)
+		note_free(ptr);
+	real_free(ptr);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+	void *newp;
+	int id;
+
+	if (real_realloc == NULL)
+		capture_init();
+	if (ptr == NULL)
+		return malloc(size);
+	if (size == 0) {
+		free(ptr);
+		return NULL;
+	}
+	if (!capturing || in_hook)
+		return real_realloc(ptr, size);
+
+	in_hook = 1;
+	pthread_mutex_lock(&lock);
+	id = map_take(ptr);
+	pthread_mutex_unlock(&lock);
+
+	newp = real_realloc(ptr, size);
+
+	pthread_mutex_lock(&lock);
+	if (capturing) {
+		if (newp == NULL) {
+			if (id >= 0)
+				map_put(ptr, id); /* the old block is still live */
+		} else if (id >= 0) {
+			map_put(newp, id);
+			record(REALLOC, id, size);
+		} else {
+			/* A block from before we started: replay it as a new one */
+			id = next_id++;
+			map_put(newp, id);
+			record(ALLOC, id, size);
+		}
+	}
+	pthread_mutex_unlock(&lock);
+	in_hook = 0;
+	return newp;
+}
+
+void *memalign(size_t alignment, size_t size)
+{
+	void *p;
+
+	if (real_memalign == NULL)
+		capture_init();
+	p = real_memalign(alignment, size);
+	if (p != NULL && capturing && !in_hook)
+		note_alloc(p, size);
+	return p;
+}
+
+int posix_memalign(void **memptr, size_t alignment, size_t size)
+{
+	int ret;
+
+	if (real_posix_memalign == NULL)
+		capture_init();
+	ret = real_posix_memalign(memptr, alignment, size);
+	if (ret == 0 && capturing && !in_hook)
+		note_alloc(*memptr, size);
+	return ret;
+}
+
+void *aligned_alloc(size_t alignment, size_t size)
+{
+	void *p;
+
+	if (real_aligned_alloc == NULL)
+		capture_init();
+	p = real_aligned_alloc(alignment, size);
+	if (p != NULL && capturing && !in_hook)
+		note_alloc(p, size);
+	return p;
+}
+
+/**********************
+ * Start-up and exit
+ **********************/
+
+/*
+ * capture_init - find the real allocator and start the writer thread.
+ *     Runs as a constructor, or earlier if another library's
+ *     constructor allocates first.
+ */
+static void capture_init(void)
+{
+	char *env, *pct;
+
+	if (real_malloc != NULL || initializing)
+		return;
+	initializing = 1;
+	in_hook = 1;
+
+	real_malloc = dlsym(RTLD_NEXT, "malloc");
+	real_free = dlsym(RTLD_NEXT, "free");
+	real_realloc = dlsym(RTLD_NEXT, "realloc");
+	real_calloc = dlsym(RTLD_NEXT, "calloc");
+	real_memalign = dlsym(RTLD_NEXT, "memalign");
+	real_posix_memalign = dlsym(RTLD_NEXT, "posix_memalign");
+	real_aligned_alloc = dlsym(RTLD_NEXT, "aligned_alloc");
+	if (!real_malloc || !real_free || !real_realloc || !real_calloc ||
+			!real_memalign || !real_posix_memalign || !real_aligned_alloc) {
+		fprintf(stderr, "mmcapture: cannot find the real allocator\n");
+		_exit(1);
+	}
+	initializing = 0;
+
+	if ((env = getenv("MMCAPTURE_FILE")) == NULL || *env == '\0')
+		env = "mmcapture.%p.rep";
+	if ((pct = strstr(env, "%p")) != NULL)
+		snprintf(out_path, sizeof(out_path), "%.*s%d%s",
+				(int)(pct - env), env, (int)getpid(), pct + 2);
+	else
+		snprintf(out_path, sizeof(out_path), "%s", env);
+	snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", out_path);
+
+	if ((tmp_fd = open(tmp_path, O_RDWR | O_CREAT | O_TRUNC, 0644)) < 0) {
+		fprintf(stderr, "mmcapture: cannot create %s: %s\n", tmp_path, strerror(errno));
+		in_hook = 0;
+		return; /* run the program without capturing */
+	}
+
+	map_slots = MAP_MIN_SLOTS;
+	map = (mapslot_t *)real_calloc(map_slots, sizeof(mapslot_t));
+	pthread_key_create(&tstate_key, flush_tstate);
+	pthread_atfork(NULL, NULL, child_after_fork);
+	if (map == NULL || pthread_create(&writer, NULL, writer_main, NULL) != 0) {
+		fprintf(stderr, "mmcapture: cannot start the writer thread\n");
+		in_hook = 0;
+		return;
+	}
+
+	capturing = 1;
+	in_hook = 0;
+}
+
+/*
+ * capture_fini - at exit, flush every buffer and write the .rep file
+ */
+static void capture_fini(void)
+{
+	tstate_t *ts;
+	char *env;
+	size_t i;
+
+	if (!capturing)
+		return;
+	in_hook = 1;
+
+	pthread_mutex_lock(&lock);
+	/* Blocks the program never freed get a free at the end of the trace */
+	if ((env = getenv("MMCAPTURE_BALANCE")) == NULL || atoi(env) != 0)
+		for (i = 0; i < map_slots; i++)
+			if (map[i].ptr != NULL)
+				record(FREE, map[i].id, 0);
+	capturing = 0;
+
+	for (ts = threads; ts != NULL; ts = ts->next)
+		if (ts->buf != NULL && ts->buf->n > 0) {
+			ts->buf->next = NULL;
+			if (queue_tail != NULL)
+				queue_tail->next = ts->buf;
+			else
+				queue_head = ts->buf;
+			queue_tail = ts->buf;
+			ts->buf = NULL;
+		}
+	writer_stop = 1;
+	pthread_cond_signal(&queue_cond);
+	pthread_mutex_unlock(&lock);
+
+	pthread_join(writer, NULL);
+	write_trace();
+}
+
+/*
+ * child_after_fork - the writer thread did not survive the fork, so
+ *     the child runs uncaptured (an exec'd program starts its own capture)
+ */
+static void child_after_fork(void)
+{
+	capturing = 0;
+	pthread_mutex_init(&lock, NULL);
+	pthread_cond_init(&queue_cond, NULL);
+}
+
+/*****************
+ * Recording
+ *****************/
+
+/*
+ * note_alloc - give a new block the next id and record its allocation
+ */
+static void note_alloc(void *p, size_t size)
+{
+	int id;
+
+	in_hook = 1;
+	pthread_mutex_lock(&lock);
+	if (capturing) {
+		id = next_id++;
+		map_put(p, id);
+		record(ALLOC, id, size);
+	}
+	pthread_mutex_unlock(&lock);
+	in_hook = 0;
+}
+
+/*
+ * note_free - record the free of a block we know about
+ */
+static void note_free(void *p)
+{
+	int id;
+
+	in_hook = 1;
+	pthread_mutex_lock(&lock);
+	if (capturing && (id = map_take(p)) >= 0)
+		record(FREE, id, 0);
+	pthread_mutex_unlock(&lock);
+	in_hook = 0;
+}
+
+/*
+ * record - Append a request to this thread's buffer. Called with lock
+ *     held, so sequence numbers follow the order of the map updates.
+ */
+static void record(int type, int id, size_t size)
+{
+	tstate_t *ts = my_ts;
+	caprec_t *r;
+
+	if (ts == NULL) {
+		if ((ts = (tstate_t *)real_calloc(1, sizeof(tstate_t))) == NULL)
+			return;
+		ts->tid = next_tid++;
+		ts->next = threads;
+		if (threads != NULL)
+			threads->prev = ts;
+		threads = ts;
+		my_ts = ts;
+		pthread_setspecific(tstate_key, ts);
+	}
+
+	/* Hand a full buffer to the writer and start a new one */
+	if (ts->buf != NULL && ts->buf->n == CAP_BUF_RECS) {
+		ts->buf->next = NULL;
+		if (queue_tail != NULL)
+			queue_tail->next = ts->buf;
+		else
+			queue_head = ts->buf;
+		queue_tail = ts->buf;
+		ts->buf = NULL;
+		pthread_cond_signal(&queue_cond);
+	}
+	if (ts->buf == NULL) {
+		if ((ts->buf = (capbuf_t *)real_malloc(sizeof(capbuf_t))) == NULL)
+			return;
+		ts->buf->n = 0;
+	}
+
+	r = &ts->buf->recs[ts->buf->n++];
+	r->seq = next_seq++;
+	r->type = type;
+	r->id = id;
+	r->size = (size > 0) ? size : 1; /* mdriver can't replay 0-byte blocks */
+	r->tid = ts->tid;
+}
+
+/*
+ * flush_tstate - thread exit: queue the thread's last buffer
+ */
+static void flush_tstate(void *arg)
+{
+	tstate_t *ts = (tstate_t *)arg;
+
+	in_hook = 1;
+	pthread_mutex_lock(&lock);
+	if (ts->buf != NULL && ts->buf->n > 0) {
+		ts->buf->next = NULL;
+		if (queue_tail != NULL)
+			queue_tail->next = ts->buf;
+		else
+			queue_head = ts->buf;
+		queue_tail = ts->buf;
+		pthread_cond_signal(&queue_cond);
+	} else if (ts->buf != NULL)
+		real_free(ts->buf);
+
+	if (ts->prev != NULL)
+		ts->prev->next = ts->next;
+	else
+		threads = ts->next;
+	if (ts->next != NULL)
+		ts->next->prev = ts->prev;
+	pthread_mutex_unlock(&lock);
+
+	real_free(ts);
+	my_ts = NULL;
+	in_hook = 0;
+}
+
+/*
+ * writer_main - the writer thread: append queued buffers to the temp file
+ */
+static void *writer_main(void *arg)
+{
+	capbuf_t *buf, *next;
+	size_t len, done;
+	ssize_t n;
+
+	in_hook = 1;
+	pthread_mutex_lock(&lock);
+	for (;;) {
+		while (queue_head == NULL && !writer_stop)
+			pthread_cond_wait(&queue_cond, &lock);
+		if (queue_head == NULL)
+			break;
+		buf = queue_head;
+		queue_head = queue_tail = NULL;
+		pthread_mutex_unlock(&lock);
+
+		for (; buf != NULL; buf = next) {
+			next = buf->next;
+			len = buf->n * sizeof(caprec_t);
+			for (done = 0; done < len; done += n)
+				if ((n = write(tmp_fd, (char *)buf->recs + done, len - done)) <= 0) {
+					fprintf(stderr, "mmcapture: write to %s failed\n", tmp_path);
+					_exit(1);
+				}
+			num_records += buf->n;
+			real_free(buf);
+		}
+		pthread_mutex_lock(&lock);
+	}
+	pthread_mutex_unlock(&lock);
+	return NULL;
+}
+
+/*
+ * write_trace - sort the records by sequence number and write the .rep
+ */
+static void write_trace(void)
+{
+	caprec_t *recs = NULL;
+	size_t len = num_records * sizeof(caprec_t);
+	unsigned long long i;
+	FILE *out;
+	int tid = 0;
+
+	if (len > 0) {
+		recs = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE, tmp_fd, 0);
+		if (recs == MAP_FAILED) {
+			fprintf(stderr, "mmcapture: cannot map %s\n", tmp_path);
+			return;
+		}
+		/* Each buffer is already in order; the buffers interleave */
+		qsort(recs, num_records, sizeof(caprec_t), cmp_seq);
+	}
+
+	if ((out = fopen(out_path, "w")) == NULL) {
+		fprintf(stderr, "mmcapture: cannot create %s: %s\n", out_path, strerror(errno));
+		return;
+	}
+	fprintf(out, "%d\n%d\n%llu\n%d\n", 0, next_id, num_records, 1);
+	for (i = 0; i < num_records; i++) {
+		if (recs[i].tid != tid) {
+			tid = recs[i].tid;
+			fprintf(out, "t %d\n", tid);
+		}
+		switch (recs[i].type) {
+			case ALLOC:
+				fprintf(out, "a %d %u\n", recs[i].id, recs[i].size);
+				break;
+			case REALLOC:
+				fprintf(out, "r %d %u\n", recs[i].id, recs[i].size);
+				break;
+			case FREE:
+				fprintf(out, "f %d\n", recs[i].id);
+				break;
+		}
+	}
+	fclose(out);
+
+	if (recs != NULL)
+		munmap(recs, len);
+	close(tmp_fd);
+	unlink(tmp_path);
+}
+
+static int cmp_seq(const void *a, const void *b)
+{
+	unsigned long long sa = ((const caprec_t *)a)->seq;
+	unsigned long long sb = ((const caprec_t *)b)->seq;
+
+	return (sa > sb) - (sa < sb);
+}
+
+/***********************************************
+ * Pointer -> id map (linear probing, with
+ * backward-shift deletion so there are no
+ * tombstones). Called with lock held.
+ ***********************************************/
+
+static size_t map_hash(void *ptr)
+{
+	return (size_t)(((uintptr_t)ptr >> 4) * 0x9E3779B97F4A7C15ULL) & (map_slots - 1);
+}
+
+static void map_put(void *ptr, int id)
+{
+	mapslot_t *old;
+	size_t old_slots, i, h;
+
+	/* Keep the table at most half full */
+	if (2 * (map_used + 1) > map_slots) {
+		old = map;
+		old_slots = map_slots;
+		map = (mapslot_t *)real_calloc(2 * old_slots, sizeof(mapslot_t));
+		if (map == NULL) {
+			fprintf(stderr, "mmcapture: out of memory for the id map\n");
+			_exit(1);
+		}
+		map_slots = 2 * old_slots;
+		for (i = 0; i < old_slots; i++)
+			if (old[i].ptr != NULL) {
+				for (h = map_hash(old[i].ptr); map[h].ptr != NULL; h = (h + 1) & (map_slots - 1))
+					;
+				map[h] = old[i];
+			}
+		real_free(old);
+	}
+
+	for (h = map_hash(ptr); map[h].ptr != NULL; h = (h + 1) & (map_slots - 1))
+		if (map[h].ptr == ptr)
+			break;
+	if (map[h].ptr == NULL)
+		map_used++;
+	map[h].ptr = ptr;
+	map[h].id = id;
+}
+
+static int map_take(void *ptr)
+{
+	size_t h, j, k;
+	int id;
+
+	for (h = map_hash(ptr); map[h].ptr != ptr; h = (h + 1) & (map_slots - 1))
+		if (map[h].ptr == NULL)
+			return -1;
+	id = map[h].id;
+
+	/* Shift later entries of the probe run back into the hole */
+	for (j = (h + 1) & (map_slots - 1); map[j].ptr != NULL; j = (j + 1) & (map_slots - 1)) {
+		k = map_hash(map[j].ptr);
+		if ((j > h && (k <= h || k > j)) || (j < h && (k <= h && k > j))) {
+			map[h] = map[j];
+			h = j;
+		}
+	}
+	map[h].ptr = NULL;
+	map_used--;
+	return id;
+}
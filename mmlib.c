@@ -0,0 +1,223 @@
+/*
+ * mmlib.c - The C library's malloc interface on top of the mm package.
+ *           Built together with mm.c and memsys.c into libmm.so, which
+ *           replaces the system allocator of an unmodified program:
+ *
+ *     unix> make libmm.so
+ *     unix> LD_PRELOAD=./libmm.so ./prog
+ *
+ * mm.c is not thread safe, so every call takes one lock. The heap is
+ * set up by whichever call comes first. That is often a constructor in
+ * some library, long before main, so there is no init hook to rely on.
+ *
+ * Every glibc entry point that hands out heap memory is defined here,
+ * so that no block from the glibc heap ever reaches mm_free.
+ */
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "mm.h"
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static int initialized = 0;   /* mm_init has run */
+static int atfork_done = 0;   /* fork handlers are registered */
+
+static int lock_heap(void);
+static void unlock_heap(void);
+static void before_fork(void);
+static void after_fork_parent(void);
+static void after_fork_child(void);
+
+void *malloc(size_t size)
+{
+	void *p;
+
+	if (size == 0)
+		size = 1; /* malloc(0) must return a unique pointer */
+	if (!lock_heap())
+		return NULL;
+	p = mm_malloc(size);
+	unlock_heap();
+
+	if (p == NULL)
+		errno = ENOMEM;
+	return p;
+}
+
+void free(void *ptr)
+{
+	if (ptr == NULL)
+		return;
+	if (!lock_heap())
+		return;
+	mm_free(ptr);
+	unlock_heap();
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+	void *p;
+
+	if (size != 0 && nmemb > SIZE_MAX / size) {
+		errno = ENOMEM;
+		return NULL;
+	}
+	size *= nmemb;
+
+	/*
+	 * Not malloc() then memset(): the compiler turns that pair back
+	 * into a call to calloc, which would recurse forever
+	 */
+	if (!lock_heap())
+		return NULL;
+	p = mm_malloc(size > 0 ? size : 1);
+	unlock_heap();
+
+	if (p == NULL)
+		errno = ENOMEM;
+	else
+		memset(p, 0, size);
+	return p;
+}
+
+void *realloc(void *ptr, size_t size)
+{
+	void *p;
+
+	if (ptr == NULL)
+		return malloc(size);
+	if (size == 0) {
+		free(ptr);
+		return NULL;
+	}
+	if (!lock_heap())
+		return NULL;
+	p = mm_realloc(ptr, size);
+	unlock_heap();
+
+	if (p == NULL)
+		errno = ENOMEM;
+	return p;
+}
+
+void *reallocarray(void *ptr, size_t nmemb, size_t size)
+{
+	if (size != 0 && nmemb > SIZE_MAX / size) {
+		errno = ENOMEM;
+		return NULL;
+	}
+	return realloc(ptr, nmemb * size);
+}
+
+void *memalign(size_t alignment, size_t size)
+{
+	void *p;
+
+	if (alignment == 0 || (alignment & (alignment - 1)) != 0) {
+		errno = EINVAL;
+		return NULL;
+	}
+	if (size == 0)
+		size = 1;
+	if (!lock_heap())
+		return NULL;
+	p = mm_memalign(alignment, size);
+	unlock_heap();
+
+	if (p == NULL)
+		errno = ENOMEM;
+	return p;
+}
+
+int posix_memalign(void **memptr, size_t alignment, size_t size)
+{
+	void *p;
+
+	if (alignment % sizeof(void *) != 0 || (alignment & (alignment - 1)) != 0)
+		return EINVAL;
+	if ((p = memalign(alignment, size)) == NULL)
+		return ENOMEM;
+	*memptr = p;
+	return 0;
+}
+
+void *aligned_alloc(size_t alignment, size_t size)
+{
+	return memalign(alignment, size);
+}
+
+void *valloc(size_t size)
+{
+	return memalign(getpagesize(), size);
+}
+
+void *pvalloc(size_t size)
+{
+	size_t page = getpagesize();
+
+	return memalign(page, (size + page - 1) & ~(page - 1));
+}
+
+size_t malloc_usable_size(void *ptr)
+{
+	size_t size;
+
+	if (ptr == NULL)
+		return 0;
+	if (!lock_heap())
+		return 0;
+	size = mm_usable_size(ptr);
+	unlock_heap();
+	return size;
+}
+
+/*
+ * lock_heap - Take the heap lock, setting up the heap on the first call.
+ *     Returns 0 if the heap could not be set up.
+ */
+static int lock_heap(void)
+{
+	pthread_mutex_lock(&lock);
+	if (!initialized) {
+		if (mm_init() < 0) {
+			pthread_mutex_unlock(&lock);
+			errno = ENOMEM;
+			return 0;
+		}
+		initialized = 1;
+	}
+	return 1;
+}
+
+/*
+ * unlock_heap - Release the heap lock. The first time through, also make
+ *     fork safe. pthread_atfork may allocate, so it is called here,
+ *     without the lock, rather than from lock_heap.
+ */
+static void unlock_heap(void)
+{
+	pthread_mutex_unlock(&lock);
+	if (!__atomic_exchange_n(&atfork_done, 1, __ATOMIC_ACQ_REL))
+		pthread_atfork(before_fork, after_fork_parent, after_fork_child);
+}
+
+/* The child must not inherit the lock held by a thread that isn't there */
+static void before_fork(void)
+{
+	pthread_mutex_lock(&lock);
+}
+
+static void after_fork_parent(void)
+{
+	pthread_mutex_unlock(&lock);
+}
+
+static void after_fork_child(void)
+{
+	pthread_mutex_init(&lock, NULL);
+}
@@ -0,0 +1,247 @@
+/*
+ * mmpmrbench.cpp - Standard containers on mm.c through mm_resource
+ *                  (mmresource.hpp), against the default memory
+ *                  resource and plain malloc.
+ *
+ * Each phase is a common way for containers to use the heap:
+ *     churn    - a std::map of random keys, erased and refilled
+ *     rehash   - unordered_maps filled from empty, rehashing as they grow
+ *     vectors  - vectors grown by push_back, a window of them alive
+ *     strings  - strings built by appending, half of them dropped
+ *
+ * Every phase runs on each resource RUNS times, with the same seed and
+ * so the same requests, and the best wall time is reported. The
+ * resources are
+ *     mm       - mm_resource, with its per-size caches
+ *     mm-nc    - mm_resource with no caching, every block from mm.c
+ *     default  - std::pmr::new_delete_resource, the default resource
+ *     libc     - malloc and free called directly
+ */
+#include <cstdio>
+#include <cstdlib>
+#include <chrono>
+#include <map>
+#include <unordered_map>
+#include <vector>
+#include <string>
+#include <memory_resource>
+
+#include "mmresource.hpp"
+
+#define SEED         12345
+#define RUNS         3
+#define CHURN_KEYS   100000
+#define CHURN_OPS    400000
+#define REHASH_MAPS  20
+#define REHASH_KEYS  50000
+#define NUM_VECTORS  2000
+#define VECTOR_LEN   4096
+#define VECTOR_LIVE  64
+#define NUM_STRINGS  200000
+#define STRING_PARTS 8
+
+/* The C library's malloc as a memory resource */
+class malloc_resource : public std::pmr::memory_resource {
+	void *do_allocate(std::size_t bytes, std::size_t alignment) override
+	{
+		void *p;
+
+		if (alignment <= alignof(std::max_align_t))
+			p = std::malloc(bytes > 0 ? bytes : 1);
+		else
+			p = std::aligned_alloc(alignment, (bytes + alignment - 1) & ~(alignment - 1));
+		if (p == NULL)
+			throw std::bad_alloc();
+		return p;
+	}
+
+	void do_deallocate(void *p, std::size_t, std::size_t) override
+	{
+		std::free(p);
+	}
+
+	bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override
+	{
+		return this == &other;
+	}
+};
+
+typedef void (*phase_fn)(std::pmr::memory_resource *res);
+
+static unsigned long rand_state = SEED;
+
+static unsigned rand_next(void);
+static double best_secs(phase_fn phase, std::pmr::memory_resource *res);
+static void phase_churn(std::pmr::memory_resource *res);
+static void phase_rehash(std::pmr::memory_resource *res);
+static void phase_vectors(std::pmr::memory_resource *res);
+static void phase_strings(std::pmr::memory_resource *res);
+
+int main(void)
+{
+	static const struct {
+		const char *name;
+		phase_fn fn;
+	} phases[] = {
+		{"churn", phase_churn},
+		{"rehash", phase_rehash},
+		{"vectors", phase_vectors},
+		{"strings", phase_strings},
+	};
+	const int nphases = sizeof(phases) / sizeof(phases[0]);
+	mm_resource mm, mm_nc(0);
+	malloc_resource libc;
+	struct {
+		const char *name;
+		std::pmr::memory_resource *res;
+		double total;
+	} resources[] = {
+		{"mm", &mm, 0},
+		{"mm-nc", &mm_nc, 0},
+		{"default", std::pmr::new_delete_resource(), 0},
+		{"libc", &libc, 0},
+	};
+	const int nres = sizeof(resources) / sizeof(resources[0]);
+	mm_heap_stats_t hs;
+	double s;
+	int i, r;
+
+	printf("%-8s", "phase");
+	for (r = 0; r < nres; r++)
+		printf("%10s", resources[r].name);
+	printf("\n");
+	for (i = 0; i < nphases; i++) {
+		printf("%-8s", phases[i].name);
+		for (r = 0; r < nres; r++) {
+			resources[r].total += (s = best_secs(phases[i].fn, resources[r].res));
+			printf("%10.3f", s);
+		}
+		printf("\n");
+	}
+	printf("%-8s", "total");
+	for (r = 0; r < nres; r++)
+		printf("%10.3f", resources[r].total);
+	printf("\n");
+
+	mm.trim();
+	mm_heap_stats(&hs);
+	printf("\nmm heap: %zu KB, largest free block %zu KB\n",
+			hs.heap_size / 1024, hs.largest_free / 1024);
+	return 0;
+}
+
+/*
+ * best_secs - best wall time of RUNS runs of a phase on res
+ */
+static double best_secs(phase_fn phase, std::pmr::memory_resource *res)
+{
+	std::chrono::duration<double> best(0);
+	int run;
+
+	for (run = 0; run < RUNS; run++) {
+		rand_state = SEED;
+		auto t0 = std::chrono::steady_clock::now();
+		phase(res);
+		auto secs = std::chrono::steady_clock::now() - t0;
+		if (run == 0 || secs < best)
+			best = secs;
+	}
+	return best.count();
+}
+
+/*
+ * phase_churn - ordered map of random keys, erased and refilled
+ */
+static void phase_churn(std::pmr::memory_resource *res)
+{
+	std::pmr::map<unsigned, unsigned> m(res);
+	int i;
+
+	for (i = 0; i < CHURN_KEYS; i++)
+		m.emplace(rand_next(), i);
+	for (i = 0; i < CHURN_OPS; i++) {
+		auto it = m.lower_bound(rand_next());
+		if (it != m.end())
+			m.erase(it);
+		m.emplace(rand_next(), i);
+	}
+}
+
+/*
+ * phase_rehash - unordered maps filled without reserve(), so the bucket
+ *     array is reallocated each time the load factor is passed
+ */
+static void phase_rehash(std::pmr::memory_resource *res)
+{
+	int i, k;
+
+	for (i = 0; i < REHASH_MAPS; i++) {
+		std::pmr::unordered_map<unsigned, unsigned> u(res);
+
+		for (k = 0; k < REHASH_KEYS; k++)
+			u[rand_next()] = k;
+	}
+}
+
+/*
+ * phase_vectors - vectors grown one element at a time, then trimmed,
+ *     with the last VECTOR_LIVE of them alive
+ */
+static void phase_vectors(std::pmr::memory_resource *res)
+{
+	std::pmr::vector<std::pmr::vector<int>> v(res);
+	int i, j, len;
+
+	v.resize(NUM_VECTORS);
+	for (i = 0; i < NUM_VECTORS; i++) {
+		len = rand_next() % VECTOR_LEN + 1;
+		for (j = 0; j < len; j++)
+			v[i].push_back(j);
+		v[i].shrink_to_fit();
+		if (i >= VECTOR_LIVE) {
+			v[i - VECTOR_LIVE].clear();
+			v[i - VECTOR_LIVE].shrink_to_fit();
+		}
+	}
+}
+
+/*
+ * phase_strings - strings built by appending a few parts each, with
+ *     about half of them dropped twice along the way
+ */
+static void phase_strings(std::pmr::memory_resource *res)
+{
+	std::pmr::vector<std::pmr::string> strs(res);
+	char part[32];
+	int i, j, k, n;
+
+	for (i = 0; i < NUM_STRINGS; i++) {
+		std::pmr::string s(res);
+
+		n = rand_next() % STRING_PARTS + 1;
+		for (j = 0; j < n; j++) {
+			snprintf(part, sizeof(part), "part-%u-", rand_next() % 1000000);
+			s += part;
+		}
+		strs.push_back(std::move(s));
+
+		/* Drop about half, at random, twice */
+		if (i == NUM_STRINGS / 3 || i == 2 * NUM_STRINGS / 3)
+			for (k = strs.size() / 2; k > 0; k--) {
+				std::size_t victim = rand_next() % strs.size();
+
+				if (victim != strs.size() - 1)
+					strs[victim] = std::move(strs.back());
+				strs.pop_back();
+			}
+	}
+}
+
+/*
+ * rand_next - 31-bit linear congruential generator; the same on every libc
+ */
+static unsigned rand_next(void)
+{
+	rand_state = (rand_state * 1103515245 + 12345) & 0x7fffffff;
+	return (unsigned)rand_state;
+}
@@ -0,0 +1,469 @@
+#ifndef __MMPOLICY_HPP_
+#define __MMPOLICY_HPP_
+
+/*
+ * mmpolicy.hpp - mm.c's segregated free list allocator as a template,
+ *                with each of its decisions a policy class:
+ *
+ *     Fit        which listed block a request gets, and when the
+ *                rest of it is split off (FirstFit, BestFit)
+ *     Insert     where a free block goes in its list (LifoInsert,
+ *                FifoInsert, AddressOrder)
+ *     Coalesce   when free neighbours merge (ImmediateCoalesce,
+ *                DeferredCoalesce)
+ *     Classes    which list a block size goes in (PowerOfTwoClasses,
+ *                QuarterClasses, OneClass)
+ *     Layout     the boundary tags (CompactTags as in mm.c, FullTags
+ *                as in CS:APP)
+ *
+ * Allocator<Fit, Insert, Coalesce, Classes, Layout> has only static
+ * members and the policies only static functions, so every call is
+ * resolved at compile time and inlined: there are no virtual functions
+ * and no function pointers. Each instantiation has a heap of its own.
+ * mm-policy.cpp builds one combination as an --alloc object; see
+ * "Allocator policies" in README.
+ *
+ * The heap comes from memlib, laid out as in mm.c: an alignment word,
+ * an allocated 8-byte prologue, the blocks, and a zero-sized allocated
+ * epilogue header. A block's header word holds its size, a multiple
+ * of 8, and two flag bits. Payloads are 8-byte aligned.
+ */
+#include <cstddef>
+#include <cstring>
+#include <stdint.h>
+
+extern "C" {
+#include "memlib.h"
+}
+
+namespace mmpolicy {
+
+typedef uint32_t word_t;
+
+const std::size_t WSIZE = 4;          /* header and footer word */
+const std::size_t ALIGNMENT = 8;
+const std::size_t CHUNK = 1 << 13;    /* least the heap grows by */
+const word_t THISALLOC = 0x1;
+const word_t PREVALLOC = 0x2;
+
+/* Block access by payload pointer, shared by the layouts */
+struct Block {
+	static word_t &hdr(char *bp) { return *(word_t *)(bp - WSIZE); }
+	static std::size_t size(char *bp) { return hdr(bp) & ~(word_t)0x7; }
+	static bool is_alloc(char *bp) { return hdr(bp) & THISALLOC; }
+	static word_t &ftr(char *bp) { return *(word_t *)(bp + size(bp) - 2 * WSIZE); }
+	static char *next(char *bp) { return bp + size(bp); }
+	static std::size_t align(std::size_t n) { return (n + ALIGNMENT - 1) & ~(ALIGNMENT - 1); }
+};
+
+/*
+ * The smallest block: a header, the two list links of a free block,
+ * and its footer.
+ */
+const std::size_t MIN_BLOCK = (2 * WSIZE + 2 * sizeof(char *) + ALIGNMENT - 1) &
+	~(ALIGNMENT - 1);
+
+/*********************************************************************
+ * Layout: the boundary tags. set_alloc and set_free write a block's
+ * tags and whatever its neighbour needs to know about it; prev_alloc
+ * says whether the block before bp is allocated.
+ ********************************************************************/
+
+/*
+ * As in mm.c: only free blocks have a footer. The PREVALLOC bit of a
+ * header says whether the block before it is allocated, so the footer
+ * of an allocated block is never needed.
+ */
+struct CompactTags {
+	static const std::size_t overhead = WSIZE;
+
+	static bool prev_alloc(char *bp) { return Block::hdr(bp) & PREVALLOC; }
+
+	static void set_alloc(char *bp, std::size_t size)
+	{
+		Block::hdr(bp) = size | THISALLOC | (Block::hdr(bp) & PREVALLOC);
+		Block::hdr(bp + size) |= PREVALLOC;
+	}
+
+	static void set_free(char *bp, std::size_t size, bool prev_alloc)
+	{
+		Block::hdr(bp) = size | (prev_alloc ? PREVALLOC : 0);
+		Block::ftr(bp) = Block::hdr(bp);
+		Block::hdr(bp + size) &= ~PREVALLOC;
+	}
+};
+
+/*
+ * As in CS:APP: every block has a header and a footer, and a block
+ * looks at the footer before it to see whether that block is free.
+ */
+struct FullTags {
+	static const std::size_t overhead = 2 * WSIZE;
+
+	static bool prev_alloc(char *bp) { return *(word_t *)(bp - 2 * WSIZE) & THISALLOC; }
+
+	static void set_alloc(char *bp, std::size_t size)
+	{
+		Block::hdr(bp) = size | THISALLOC;
+		Block::ftr(bp) = size | THISALLOC;
+	}
+
+	static void set_free(char *bp, std::size_t size, bool)
+	{
+		Block::hdr(bp) = size;
+		Block::ftr(bp) = size;
+	}
+};
+
+/*********************************************************************
+ * Classes: the size class map, count lists and the list of a size
+ ********************************************************************/
+
+/*
+ * 2^Bits lists for each doubling of the block size from 16 bytes, as
+ * mm.c's CLASS_BITS, up to blocks of 2^31 bytes.
+ */
+template <unsigned Bits>
+struct Log2Classes {
+	static const unsigned count = (31 - 4 + 1) << Bits;
+
+	static unsigned index(std::size_t size)
+	{
+		unsigned b = 31 - __builtin_clz((unsigned)size);
+
+		return ((b - 4) << Bits) + (((unsigned)size >> (b - Bits)) & ((1u << Bits) - 1));
+	}
+};
+
+typedef Log2Classes<0> PowerOfTwoClasses;
+typedef Log2Classes<2> QuarterClasses;
+
+/* One list for every size */
+struct OneClass {
+	static const unsigned count = 1;
+	static unsigned index(std::size_t) { return 0; }
+};
+
+/*********************************************************************
+ * The free lists. The links live in the payload of a free block.
+ ********************************************************************/
+
+struct FreeList {
+	char *head;
+	char *tail;
+
+	static char *&next(char *bp) { return ((char **)bp)[0]; }
+	static char *&prev(char *bp) { return ((char **)bp)[1]; }
+
+	/* Link bp in before pos, or at the tail if pos is NULL */
+	void insert_before(char *pos, char *bp)
+	{
+		char *before = pos ? prev(pos) : tail;
+
+		next(bp) = pos;
+		prev(bp) = before;
+		(before ? next(before) : head) = bp;
+		(pos ? prev(pos) : tail) = bp;
+	}
+
+	void remove(char *bp)
+	{
+		(prev(bp) ? next(prev(bp)) : head) = next(bp);
+		(next(bp) ? prev(next(bp)) : tail) = prev(bp);
+	}
+};
+
+/*********************************************************************
+ * Insert: where a freed block goes in its list
+ ********************************************************************/
+
+/* At the head: the block freed last is reused first */
+struct LifoInsert {
+	static void insert(FreeList &list, char *bp) { list.insert_before(list.head, bp); }
+};
+
+/* At the tail: a freed block waits its turn */
+struct FifoInsert {
+	static void insert(FreeList &list, char *bp) { list.insert_before(NULL, bp); }
+};
+
+/* In address order, so first fit favours the bottom of the heap */
+struct AddressOrder {
+	static void insert(FreeList &list, char *bp)
+	{
+		char *pos = list.head;
+
+		while (pos != NULL && pos < bp)
+			pos = FreeList::next(pos);
+		list.insert_before(pos, bp);
+	}
+};
+
+/*********************************************************************
+ * Fit: find a listed block of at least size bytes. A list holds only
+ * blocks from its class up, so the search can start at the class of
+ * the request. split_min is the smallest remainder worth splitting
+ * off; a smaller one stays with the block.
+ ********************************************************************/
+
+/* The first block that fits, searching the classes upwards */
+template <std::size_t SplitMin = MIN_BLOCK>
+struct FirstFit {
+	static const std::size_t split_min = SplitMin;
+
+	template <class Classes>
+	static char *find(FreeList *lists, std::size_t size)
+	{
+		for (unsigned c = Classes::index(size); c < Classes::count; c++)
+			for (char *bp = lists[c].head; bp != NULL; bp = FreeList::next(bp))
+				if (Block::size(bp) >= size)
+					return bp;
+		return NULL;
+	}
+};
+
+/*
+ * The smallest block that fits, from the first class that has one:
+ * every block in a higher class is larger.
+ */
+template <std::size_t SplitMin = MIN_BLOCK>
+struct BestFit {
+	static const std::size_t split_min = SplitMin;
+
+	template <class Classes>
+	static char *find(FreeList *lists, std::size_t size)
+	{
+		char *best = NULL;
+
+		for (unsigned c = Classes::index(size); c < Classes::count; c++) {
+			for (char *bp = lists[c].head; bp != NULL; bp = FreeList::next(bp)) {
+				if (Block::size(bp) == size)
+					return bp;
+				if (Block::size(bp) > size && (best == NULL || Block::size(bp) < Block::size(best)))
+					best = bp;
+			}
+			if (best != NULL)
+				return best;
+		}
+		return NULL;
+	}
+};
+
+/*********************************************************************
+ * Coalesce: freed(bp) returns the block a just-freed bp should be
+ * listed as; missed() is called when no listed block fits, and says
+ * whether it is worth searching again before the heap grows.
+ ********************************************************************/
+
+/* Merge with free neighbours as soon as a block is freed, as mm.c does */
+struct ImmediateCoalesce {
+	template <class A> static char *freed(char *bp) { return A::coalesce(bp); }
+	template <class A> static bool missed() { return false; }
+};
+
+/*
+ * List freed blocks as they are, and merge all neighbours in one pass
+ * over the heap only when a request finds nothing.
+ */
+struct DeferredCoalesce {
+	template <class A> static char *freed(char *bp) { return bp; }
+	template <class A> static bool missed() { return A::coalesce_all(); }
+};
+
+/*********************************************************************
+ * The allocator
+ ********************************************************************/
+
+template <class Fit, class Insert, class Coalesce, class Classes, class Layout>
+class Allocator {
+	typedef Allocator<Fit, Insert, Coalesce, Classes, Layout> self;
+	friend struct ImmediateCoalesce;
+	friend struct DeferredCoalesce;
+
+	static FreeList lists[Classes::count];
+	static char *heap_first;  /* payload of the first block */
+
+	static const std::size_t split_min = Fit::split_min > MIN_BLOCK ?
+		Fit::split_min : MIN_BLOCK;
+
+	static void list_add(char *bp) { Insert::insert(lists[Classes::index(Block::size(bp))], bp); }
+	static void list_remove(char *bp) { lists[Classes::index(Block::size(bp))].remove(bp); }
+
+	/* Block size for a request of n bytes */
+	static std::size_t block_size(std::size_t n)
+	{
+		std::size_t size = Block::align(n + Layout::overhead);
+
+		return size < MIN_BLOCK ? MIN_BLOCK : size;
+	}
+
+	/* Merge free bp, not on a list, with its free neighbours */
+	static char *coalesce(char *bp)
+	{
+		std::size_t size = Block::size(bp);
+		char *next = Block::next(bp);
+
+		if (!Block::is_alloc(next)) {
+			list_remove(next);
+			size += Block::size(next);
+		}
+		if (!Layout::prev_alloc(bp)) {
+			bp -= Block::size(bp - WSIZE);  /* the footer before bp */
+			list_remove(bp);
+			size += Block::size(bp);
+		}
+		Layout::set_free(bp, size, true);
+		return bp;
+	}
+
+	/* Merge every run of free blocks; returns whether any merged */
+	static bool coalesce_all()
+	{
+		bool merged = false;
+		char *bp, *next;
+		std::size_t size;
+
+		for (bp = heap_first; Block::size(bp) > 0; bp = Block::next(bp)) {
+			if (Block::is_alloc(bp) || Block::is_alloc(next = Block::next(bp)))
+				continue;
+			list_remove(bp);
+			size = Block::size(bp);
+			do {
+				list_remove(next);
+				size += Block::size(next);
+				next = Block::next(next);
+			} while (!Block::is_alloc(next));
+			Layout::set_free(bp, size, true);
+			list_add(bp);
+			merged = true;
+		}
+		return merged;
+	}
+
+	/* Size of the free block at the end of the heap, 0 if there is none */
+	static std::size_t end_free()
+	{
+		char *end = (char *)mem_heap_hi() + 1;  /* past the epilogue */
+
+		return Layout::prev_alloc(end) ? 0 : Block::size(end - WSIZE);
+	}
+
+	/*
+	 * Grow the heap by size bytes and return the new free block, merged
+	 * with the free block at the end of the heap whatever the Coalesce
+	 * policy, so that growing by a shortfall is enough
+	 */
+	static char *extend(std::size_t size)
+	{
+		char *bp = (char *)mem_sbrk((int)size);
+		bool prev_alloc;
+
+		if (bp == (char *)-1)
+			return NULL;
+		/* The old epilogue header becomes the new block's header */
+		prev_alloc = Layout::prev_alloc(bp);
+		if (!prev_alloc) {
+			bp -= Block::size(bp - WSIZE);
+			list_remove(bp);
+			size += Block::size(bp);
+			prev_alloc = Layout::prev_alloc(bp);
+		}
+		Layout::set_free(bp, size, prev_alloc);
+		Block::hdr(Block::next(bp)) = THISALLOC;
+		list_add(bp);
+		return bp;
+	}
+
+	/* Allocate size bytes at the front of free block bp */
+	static void place(char *bp, std::size_t size)
+	{
+		std::size_t csize = Block::size(bp);
+
+		list_remove(bp);
+		if (csize - size >= split_min) {
+			Layout::set_alloc(bp, size);
+			Layout::set_free(bp + size, csize - size, true);
+			list_add(bp + size);
+		}
+		else
+			Layout::set_alloc(bp, csize);
+	}
+
+public:
+	static int init()
+	{
+		char *p;
+
+		std::memset(lists, 0, sizeof(lists));
+		if ((p = (char *)mem_sbrk(4 * WSIZE)) == (char *)-1)
+			return -1;
+		*(word_t *)p = 0;                                   /* alignment */
+		*(word_t *)(p + WSIZE) = ALIGNMENT | THISALLOC | PREVALLOC; /* prologue */
+		*(word_t *)(p + 2 * WSIZE) = ALIGNMENT | THISALLOC | PREVALLOC;
+		*(word_t *)(p + 3 * WSIZE) = THISALLOC | PREVALLOC; /* epilogue */
+		heap_first = p + 4 * WSIZE;
+		return extend(CHUNK) == NULL ? -1 : 0;
+	}
+
+	static void *malloc(std::size_t n)
+	{
+		std::size_t size;
+		char *bp;
+
+		if (n == 0)
+			return NULL;
+		size = block_size(n);
+		bp = Fit::template find<Classes>(lists, size);
+		if (bp == NULL && Coalesce::template missed<self>())
+			bp = Fit::template find<Classes>(lists, size);
+		if (bp == NULL) {
+			/* Grow only by what the free block at the end lacks, as mm.c does */
+			std::size_t grow = size - end_free();
+
+			if ((bp = extend(grow > CHUNK ? grow : CHUNK)) == NULL)
+				return NULL;
+		}
+		place(bp, size);
+		return bp;
+	}
+
+	static void free(void *ptr)
+	{
+		char *bp = (char *)ptr;
+
+		if (bp == NULL)
+			return;
+		Layout::set_free(bp, Block::size(bp), Layout::prev_alloc(bp));
+		list_add(Coalesce::template freed<self>(bp));
+	}
+
+	/* As in mm.c: a new block, the data copied, the old one freed */
+	static void *realloc(void *ptr, std::size_t n)
+	{
+		std::size_t copy;
+		void *p;
+
+		if (ptr == NULL)
+			return malloc(n);
+		if (n == 0) {
+			free(ptr);
+			return NULL;
+		}
+		if ((p = malloc(n)) == NULL)
+			return NULL;
+		copy = Block::size((char *)ptr) - Layout::overhead;
+		std::memcpy(p, ptr, copy < n ? copy : n);
+		free(ptr);
+		return p;
+	}
+};
+
+template <class Fit, class Insert, class Coalesce, class Classes, class Layout>
+FreeList Allocator<Fit, Insert, Coalesce, Classes, Layout>::lists[Classes::count];
+
+template <class Fit, class Insert, class Coalesce, class Classes, class Layout>
+char *Allocator<Fit, Insert, Coalesce, Classes, Layout>::heap_first;
+
+} /* namespace mmpolicy */
+
+#endif /* __MMPOLICY_HPP_ */
@@ -0,0 +1,134 @@
+#ifndef __MMRESOURCE_HPP_
+#define __MMRESOURCE_HPP_
+
+/*
+ * mmresource.hpp - A std::pmr::memory_resource on the mm package, so
+ *                  that C++ containers can use mm.c without replacing
+ *                  the process allocator as libmm.so does:
+ *
+ *     mm_resource mm;
+ *     std::pmr::vector<int> v(&mm);
+ *
+ * mm.c has one heap per process. The first mm_resource to be created
+ * sets it up, and every mm_resource after that shares it. Neither mm.c
+ * nor the resource is thread safe, as with
+ * std::pmr::unsynchronized_pool_resource.
+ *
+ * A pmr deallocation passes back the size and alignment that the block
+ * was allocated with. mm_free has no use for them: it must read the
+ * block's header for its PREVALLOC bit and real size, and its
+ * neighbours' tags to coalesce. The resource uses them itself. A block
+ * of at most CACHE_MAX bytes with the default alignment goes on a
+ * cache of blocks of its size, 8 bytes to a class. The next request of
+ * that size takes it back without calling mm.c at all. Each cache is
+ * allocated in class-sized blocks, so any block on it fits any request
+ * of its class. A cache holds at most `depth` blocks, and blocks past
+ * that go back to mm_free. An over-aligned block comes from
+ * mm_memalign, which returns an ordinary block, so it is freed
+ * directly. There is no original pointer to look up.
+ */
+#include <cstddef>
+#include <new>
+#include <memory_resource>
+
+extern "C" {
+#include "mm.h"
+}
+
+class mm_resource : public std::pmr::memory_resource {
+public:
+	static const std::size_t ALIGN = 8;      /* mm.c's payload alignment */
+	static const std::size_t CACHE_MAX = 256; /* largest cached block */
+	static const std::size_t CLASSES = CACHE_MAX / ALIGN;
+
+	/* depth is the most blocks kept per size class; 0 caches none */
+	explicit mm_resource(std::size_t depth = 64) : depth(depth)
+	{
+		static bool heap_ready = false;
+
+		if (!heap_ready) {
+			if (mm_init() < 0)
+				throw std::bad_alloc();
+			heap_ready = true;
+		}
+		for (std::size_t c = 0; c < CLASSES; c++) {
+			cache[c] = NULL;
+			cached[c] = 0;
+		}
+	}
+
+	mm_resource(const mm_resource &) = delete;
+	mm_resource &operator=(const mm_resource &) = delete;
+
+	~mm_resource() { trim(); }
+
+	/* Give every cached block back to mm.c */
+	void trim()
+	{
+		for (std::size_t c = 0; c < CLASSES; c++) {
+			while (cache[c] != NULL) {
+				void *p = cache[c];
+
+				cache[c] = *(void **)p;
+				mm_free(p);
+			}
+			cached[c] = 0;
+		}
+	}
+
+private:
+	std::size_t depth;
+	void *cache[CLASSES];          /* blocks linked through their first word */
+	std::size_t cached[CLASSES];   /* and how many are on each */
+
+	static std::size_t size_class(std::size_t bytes)
+	{
+		return bytes == 0 ? 0 : (bytes - 1) / ALIGN;
+	}
+
+	void *do_allocate(std::size_t bytes, std::size_t alignment) override
+	{
+		void *p;
+
+		if (alignment > ALIGN)
+			p = mm_memalign(alignment, bytes > 0 ? bytes : 1);
+		else if (bytes <= CACHE_MAX) {
+			std::size_t c = size_class(bytes);
+
+			if ((p = cache[c]) != NULL) {
+				cache[c] = *(void **)p;
+				cached[c]--;
+				return p;
+			}
+			p = mm_malloc((c + 1) * ALIGN);
+		}
+		else
+			p = mm_malloc(bytes);
+		if (p == NULL)
+			throw std::bad_alloc();
+		return p;
+	}
+
+	void do_deallocate(void *p, std::size_t bytes, std::size_t alignment) override
+	{
+		if (alignment <= ALIGN && bytes <= CACHE_MAX) {
+			std::size_t c = size_class(bytes);
+
+			if (cached[c] < depth) {
+				*(void **)p = cache[c];
+				cache[c] = p;
+				cached[c]++;
+				return;
+			}
+		}
+		mm_free(p);
+	}
+
+	/* Any mm_resource can free another's blocks: they share the heap */
+	bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override
+	{
+		return dynamic_cast<const mm_resource *>(&other) != NULL;
+	}
+};
+
+#endif /* __MMRESOURCE_HPP_ */
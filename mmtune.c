@@ -0,0 +1,363 @@
+/*
+ * mmtune.c - Turn a profile of mm.c into mm_tune.h.
+ *
+ *     unix> make mm-prof.so mmtune
+ *     unix> MM_PROFILE=mm.prof ./mdriver -f server.rep --alloc ./mm-prof.so
+ *     unix> ./mmtune -o mm_tune.h mm.prof
+ *     unix> make mm-tuned.so
+ *     unix> ./mdriver -f server.rep --alloc ./mm-prof.so --alloc tuned=./mm-tuned.so
+ *
+ * mm.c built with -DMM_PROFILE counts the block sizes it is asked for,
+ * how its free lists serve them and how large its heaps get. From the
+ * counts this picks:
+ *
+ *   SMALL_CLASSES  The lists of blocks under SMALL_LIMIT. Each of the
+ *                  commonest sizes gets a list of its own (an exact
+ *                  list), where any block fits and the first one is
+ *                  taken. A class with under MERGE_PCT percent of the
+ *                  requests joins the class below it, as long as that
+ *                  class spans less than a doubling, since every empty
+ *                  list costs a look at its head when a request moves
+ *                  on to larger lists. A class still holding over
+ *                  SPLIT_PCT percent of the requests is split at its
+ *                  median.
+ *   SPLIT_MIN      The smallest remainder worth splitting off: below
+ *                  it, too few requests would fit the remainder.
+ *   CHUNK_BYTES    How much the heap grows at a time. Whatever the last
+ *                  chunk leaves unused counts against util, so this is
+ *                  at most 1/CHUNK_SHARE of the smallest heap seen.
+ *
+ * The lists above SMALL_LIMIT keep the profiled CLASS_BITS: eight lists
+ * per doubling there made the compiler traces slower, the extra empty
+ * lists costing more than the first-fit scans they save. The header
+ * comment reports how often medium requests passed over their list.
+ *
+ * The header goes to the standard output unless -o is given.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <getopt.h>
+
+#include "config.h"
+
+#define MIN_SIZE    16       /* smallest block of mm.c */
+#define SMALL_LIMIT 1024     /* mm.c's SMALL_LIMIT */
+#define LARGE_LIMIT 65536    /* blocks this large go in mm.c's tree */
+#define NSIZES      (LARGE_LIMIT / ALIGNMENT)
+#define NSMALL      (SMALL_LIMIT / ALIGNMENT)
+#define SPLIT_PCT   10       /* split small classes with more requests */
+#define MERGE_PCT   0.5      /* merge small classes with fewer requests */
+#define EXACT_PCT   2        /* least share of an exact list */
+#define CHUNK_MIN   8192     /* mm.c's default, two pages */
+#define CHUNK_MAX   (1 << 20)
+#define CHUNK_SHARE 256      /* of the smallest heap, at most one chunk */
+
+/* What the profile says */
+typedef struct {
+	int class_bits, medium_base, split_min, chunk;  /* the profiled build */
+	unsigned long runs, heap_bytes, min_heap;
+	unsigned long sizes[NSIZES];    /* requests by block size / ALIGNMENT */
+	unsigned long large, large_bytes;
+	unsigned long medium_fit, medium_passed;  /* in the lists above SMALL_LIMIT */
+	unsigned long carves, extends, extend_bytes, splits, whole, tree;
+} profile_t;
+
+static int max_exact = 8;     /* most exact lists (-k) */
+static profile_t prof;
+
+static void usage(void);
+static void read_profile(char *path);
+static int exact_lists(int *start, unsigned long small, int *exact);
+static void merge_classes(int *start, unsigned long small, int *exact, int nexact);
+static void split_classes(int *start, unsigned long small);
+static void write_header(FILE *fp, char *path, int *start, int *exact, int nexact);
+static double pct(unsigned long part, unsigned long whole);
+
+int main(int argc, char **argv)
+{
+	char *out_path = NULL;
+	FILE *out = stdout;
+	int start[NSMALL + 1];   /* start[i]: the class of size i * ALIGNMENT begins there */
+	int exact[NSMALL];
+	unsigned long small, total;
+	int c, i, nexact;
+
+	while ((c = getopt(argc, argv, "k:o:h")) != EOF) {
+		switch (c) {
+			case 'k':
+				max_exact = atoi(optarg);
+				break;
+			case 'o':
+				out_path = optarg;
+				break;
+			case 'h':
+			default:
+				usage();
+				exit(c == 'h' ? 0 : 1);
+		}
+	}
+	if (max_exact < 0 || optind != argc - 1) {
+		usage();
+		exit(1);
+	}
+	read_profile(argv[optind]);
+
+	for (i = 0, small = 0; i < NSMALL; i++)
+		small += prof.sizes[i];
+	for (total = small + prof.large; i < NSIZES; i++)
+		total += prof.sizes[i];
+	if (total == 0) {
+		fprintf(stderr, "mmtune: %s has no requests in it\n", argv[optind]);
+		exit(1);
+	}
+
+	/* Start from mm.c's own classes: four per doubling, on ALIGNMENT */
+	memset(start, 0, sizeof(start));
+	for (i = MIN_SIZE; i < SMALL_LIMIT; i *= 2) {
+		start[i / ALIGNMENT] = 1;
+		for (c = 1; c < 4; c++)
+			if ((i * c / 4) % ALIGNMENT == 0)
+				start[(i + i * c / 4) / ALIGNMENT] = 1;
+	}
+	nexact = exact_lists(start, small, exact);
+	merge_classes(start, small, exact, nexact);
+	split_classes(start, small);
+
+	if (out_path != NULL && (out = fopen(out_path, "w")) == NULL) {
+		fprintf(stderr, "mmtune: cannot create %s: %s\n", out_path, strerror(errno));
+		exit(1);
+	}
+	write_header(out, argv[optind], start, exact, nexact);
+	if (out != stdout && fclose(out) != 0) {
+		fprintf(stderr, "mmtune: cannot write %s: %s\n", out_path, strerror(errno));
+		exit(1);
+	}
+	exit(0);
+}
+
+/*
+ * usage - print the command line options
+ */
+static void usage(void)
+{
+	fprintf(stderr, "Usage: mmtune [-h] [-k <n>] [-o <file>] <profile>\n");
+	fprintf(stderr, "Options\n");
+	fprintf(stderr, "\t-h         Print this message.\n");
+	fprintf(stderr, "\t-k <n>     Give at most <n> sizes a list of their own (default 8).\n");
+	fprintf(stderr, "\t-o <file>  Write the header to <file> instead of the standard output.\n");
+	fprintf(stderr, "The profile is written by mm.c built with -DMM_PROFILE.\n");
+}
+
+/*
+ * read_profile - read the counts of mm.c built with -DMM_PROFILE
+ */
+static void read_profile(char *path)
+{
+	FILE *fp;
+	char line[256], key[16];
+	unsigned long a, b, c, d, e;
+	int version = 0, n;
+
+	if ((fp = fopen(path, "r")) == NULL) {
+		fprintf(stderr, "mmtune: cannot open %s: %s\n", path, strerror(errno));
+		exit(1);
+	}
+	memset(&prof, 0, sizeof(prof));
+	while (fgets(line, sizeof(line), fp) != NULL) {
+		n = sscanf(line, "%15s %lu %lu %lu %lu %lu", key, &a, &b, &c, &d, &e);
+		if (n < 2)
+			continue;
+		if (strcmp(key, "mmprofile") == 0)
+			version = a;
+		else if (strcmp(key, "config") == 0 && n == 5) {
+			prof.class_bits = a;
+			prof.medium_base = b;
+			prof.split_min = c;
+			prof.chunk = d;
+		}
+		else if (strcmp(key, "heap") == 0 && n == 4) {
+			prof.runs = a;
+			prof.heap_bytes = b;
+			prof.min_heap = c;
+		}
+		else if (strcmp(key, "size") == 0 && n == 3 && a < LARGE_LIMIT)
+			prof.sizes[a / ALIGNMENT] += b;
+		else if (strcmp(key, "large") == 0 && n == 3) {
+			prof.large = a;
+			prof.large_bytes = b;
+		}
+		else if (strcmp(key, "list") == 0 && n == 6 && b >= SMALL_LIMIT) {
+			prof.medium_fit += c;
+			prof.medium_passed += d;
+		}
+		else if (strcmp(key, "tree") == 0)
+			prof.tree = a;
+		else if (strcmp(key, "wild") == 0 && n == 4) {
+			prof.carves = a;
+			prof.extends = b;
+			prof.extend_bytes = c;
+		}
+		else if (strcmp(key, "split") == 0 && n == 3) {
+			prof.splits = a;
+			prof.whole = b;
+		}
+	}
+	fclose(fp);
+	if (version != 1) {
+		fprintf(stderr, "mmtune: %s is not an mm.c profile\n", path);
+		exit(1);
+	}
+}
+
+/*
+ * exact_lists - give the commonest small sizes a list of their own, and
+ *     return how many did, in exact[]
+ */
+static int exact_lists(int *start, unsigned long small, int *exact)
+{
+	int i, j, best, n;
+
+	for (n = 0; n < max_exact; n++) {
+		for (i = MIN_SIZE / ALIGNMENT, best = -1; i < NSMALL; i++) {
+			for (j = 0; j < n && exact[j] != i; j++)
+				;
+			if (j == n && (best < 0 || prof.sizes[i] > prof.sizes[best]))
+				best = i;
+		}
+		if (best < 0 || pct(prof.sizes[best], small) < EXACT_PCT)
+			break;
+		exact[n] = best;
+		start[best] = 1;
+		start[best + 1] = 1;
+	}
+	return n;
+}
+
+/*
+ * merge_classes - fold the classes hardly anything asks for into the
+ *     class below, leaving the exact lists alone
+ */
+static void merge_classes(int *start, unsigned long small, int *exact, int nexact)
+{
+	unsigned long count;
+	int prev, lo, hi, i;
+
+	for (prev = -1, lo = MIN_SIZE / ALIGNMENT; lo < NSMALL; lo = hi) {
+		for (hi = lo + 1; hi < NSMALL && !start[hi]; hi++)
+			;
+		for (i = lo, count = 0; i < hi; i++)
+			count += prof.sizes[i];
+		for (i = 0; i < nexact && exact[i] != lo && exact[i] != prev; i++)
+			;
+		if (prev >= 0 && i == nexact && hi <= 2 * prev && pct(count, small) < MERGE_PCT)
+			start[lo] = 0;
+		else
+			prev = lo;
+	}
+}
+
+/*
+ * split_classes - split the busiest small classes at their median size
+ *     until none holds more than SPLIT_PCT percent of the requests
+ */
+static void split_classes(int *start, unsigned long small)
+{
+	unsigned long count, half;
+	int lo, hi, i, split;
+
+	do {
+		split = 0;
+		for (lo = MIN_SIZE / ALIGNMENT; lo < NSMALL; lo = hi) {
+			for (hi = lo + 1; hi < NSMALL && !start[hi]; hi++)
+				;
+			for (i = lo, count = 0; i < hi; i++)
+				count += prof.sizes[i];
+			if (hi - lo < 2 || pct(count, small) <= SPLIT_PCT)
+				continue;
+
+			/* The median, kept off lo so that both halves have sizes */
+			for (i = lo, half = 0; i < hi - 1 && half < count / 2; i++)
+				half += prof.sizes[i];
+			if (i == lo)
+				i++;
+			start[i] = 1;
+			split = 1;
+		}
+	} while (split);
+}
+
+/*
+ * write_header - write mm_tune.h, with what it was made from
+ */
+static void write_header(FILE *fp, char *path, int *start, int *exact, int nexact)
+{
+	unsigned long total, small = 0, medium = 0, below;
+	int split_min, chunk, nlists, i, list;
+
+	for (i = 0; i < NSMALL; i++)
+		small += prof.sizes[i];
+	for (i = NSMALL; i < NSIZES; i++)
+		medium += prof.sizes[i];
+	total = small + medium + prof.large;
+
+	/* Split off what at least 99% of the requests could use */
+	for (split_min = MIN_SIZE, below = 0;
+			split_min < 64 && pct(below + prof.sizes[split_min / ALIGNMENT], total) <= 1;
+			split_min += ALIGNMENT)
+		below += prof.sizes[split_min / ALIGNMENT];
+
+	for (chunk = CHUNK_MIN; chunk < CHUNK_MAX &&
+			(unsigned long)chunk * 2 <= prof.min_heap / CHUNK_SHARE; chunk *= 2)
+		;
+
+	for (i = MIN_SIZE / ALIGNMENT, nlists = 0; i < NSMALL; i++)
+		nlists += start[i];
+
+	fprintf(fp, "/*\n");
+	fprintf(fp, " * mm_tune.h - Written by mmtune; mm.c reads it when built with\n");
+	fprintf(fp, " * -DMM_TUNED. Profile: %s\n", path);
+	fprintf(fp, " *\n");
+	fprintf(fp, " * %lu requests over %lu heaps: %.1f%% under %d bytes, %.1f%% up to\n",
+			total, prof.runs, pct(small, total), SMALL_LIMIT, pct(medium, total));
+	fprintf(fp, " * %d KB, %.1f%% larger (in blocks, header included).\n",
+			LARGE_LIMIT / 1024, pct(prof.large, total));
+	fprintf(fp, " * Exact lists, with their share of the requests under %d bytes:\n *", SMALL_LIMIT);
+	for (i = 0; i < nexact; i++)
+		fprintf(fp, "%s %d (%.1f%%)", i > 0 && i % 5 == 0 ? "\n *" : "",
+				exact[i] * ALIGNMENT, pct(prof.sizes[exact[i]], small));
+	fprintf(fp, "%s\n", nexact == 0 ? " none" : "");
+	fprintf(fp, " * Lists below %d bytes: %d.\n", SMALL_LIMIT, nlists);
+	fprintf(fp, " * Medium requests passing over their own list: %.1f%%.\n",
+			pct(prof.medium_passed, prof.medium_fit + prof.medium_passed));
+	fprintf(fp, " * Listed blocks split: %.1f%%. Heap grown %lu times, smallest\n",
+			pct(prof.splits, prof.splits + prof.whole), prof.extends);
+	fprintf(fp, " * heap %lu bytes, mean %lu.\n", prof.min_heap,
+			prof.runs ? prof.heap_bytes / prof.runs : 0);
+	fprintf(fp, " * Profiled with SPLIT_MIN %d and %d-byte chunks.\n", prof.split_min, prof.chunk);
+	fprintf(fp, " */\n");
+	fprintf(fp, "#define CLASS_BITS %d\n", prof.class_bits);
+	fprintf(fp, "#define SPLIT_MIN %d\n", split_min);
+	fprintf(fp, "#define CHUNK_BYTES %d\n", chunk);
+	fprintf(fp, "#define MEDIUM_BASE %d\n", nlists);
+
+	/* The list of each size / ALIGNMENT up to SMALL_LIMIT */
+	fprintf(fp, "#define SMALL_CLASSES \\\n\t");
+	for (i = 0, list = -1; i <= NSMALL; i++) {
+		if (i == NSMALL)
+			list = nlists;
+		else if (i * ALIGNMENT >= MIN_SIZE && start[i])
+			list++;
+		fprintf(fp, "%d%s", list < 0 ? 0 : list,
+				i == NSMALL ? "\n" : i % 16 == 15 ? ", \\\n\t" : ", ");
+	}
+}
+
+/*
+ * pct - part as a percentage of whole
+ */
+static double pct(unsigned long part, unsigned long whole)
+{
+	return whole == 0 ? 0 : 100.0 * part / whole;
+}
@@ -0,0 +1,195 @@
+/*
+ * mtreplay.c - Multithreaded trace replay.
+ *
+ * Each trace thread (the 't' lines of a .rep file) is assigned to replay
+ * thread tid % nthreads. A trace recorded on a single thread is split by
+ * block id instead, so that it still offers parallel work.
+ *
+ * Ops on one block id must run in trace order even when different
+ * threads issue them, e.g. a free of a block some other thread
+ * allocated. Before the replay, every op is linked to the previous op
+ * on the same id. A thread waits until that op is marked done before it
+ * runs its own, and marks its op done afterwards. This is the per-id
+ * handoff. The earliest unfinished op never waits, so the replay
+ * cannot deadlock.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/time.h>
+
+#include "mtreplay.h"
+
+#define SPINS_BEFORE_YIELD 64 /* busy-wait this long before sched_yield */
+
+/* Shared state for one replay */
+typedef struct {
+	trace_t *trace;
+	mt_alloc_t *alloc;
+	int *prev;                 /* previous op on the same id, or -1 */
+	volatile char *done;       /* done[i] is set once op i has run */
+	int **thread_ops;          /* indices of the ops each thread runs */
+	pthread_barrier_t start;   /* lines all threads up before timing */
+	struct timeval t0;         /* time the replay started */
+	int failed;                /* some allocation returned NULL */
+	mt_result_t *res;
+} replay_t;
+
+/* Per-thread argument */
+typedef struct {
+	replay_t *r;
+	int id;
+} worker_arg_t;
+
+static void *replay_thread(void *arg);
+static double secs_since(struct timeval *t0);
+
+/*
+ * mt_replay - run the trace on nthreads threads and time it
+ */
+int mt_replay(trace_t *trace, int nthreads, mt_alloc_t *alloc, mt_result_t *res)
+{
+	replay_t r;
+	pthread_t *threads;
+	worker_arg_t *args;
+	int *last;     /* last op seen on each id while linking */
+	int *fill;
+	int i, t;
+
+	memset(&r, 0, sizeof(r));
+	r.trace = trace;
+	r.alloc = alloc;
+	r.res = res;
+	res->nthreads = nthreads;
+
+	if ((r.prev = (int *)malloc(trace->num_ops * sizeof(int))) == NULL ||
+			(r.done = (volatile char *)calloc(trace->num_ops, 1)) == NULL ||
+			(r.thread_ops = (int **)calloc(nthreads, sizeof(int *))) == NULL ||
+			(last = (int *)malloc(trace->num_ids * sizeof(int))) == NULL ||
+			(fill = (int *)calloc(nthreads, sizeof(int))) == NULL ||
+			(threads = (pthread_t *)malloc(nthreads * sizeof(pthread_t))) == NULL ||
+			(args = (worker_arg_t *)malloc(nthreads * sizeof(worker_arg_t))) == NULL) {
+		fprintf(stderr, "mt_replay: out of memory\n");
+		exit(1);
+	}
+
+	/* Link each op to the previous op on its id, and count ops per thread */
+	for (i = 0; i < trace->num_ids; i++)
+		last[i] = -1;
+	memset(res->thread_ops, 0, nthreads * sizeof(int));
+	for (i = 0; i < trace->num_ops; i++) {
+		traceop_t *op = &trace->ops[i];
+		r.prev[i] = last[op->index];
+		last[op->index] = i;
+		t = (trace->num_threads > 1) ? op->tid % nthreads : op->index % nthreads;
+		res->thread_ops[t]++;
+	}
+
+	for (t = 0; t < nthreads; t++)
+		if ((r.thread_ops[t] = (int *)malloc((res->thread_ops[t] + 1) * sizeof(int))) == NULL) {
+			fprintf(stderr, "mt_replay: out of memory\n");
+			exit(1);
+		}
+	for (i = 0; i < trace->num_ops; i++) {
+		traceop_t *op = &trace->ops[i];
+		t = (trace->num_threads > 1) ? op->tid % nthreads : op->index % nthreads;
+		r.thread_ops[t][fill[t]++] = i;
+	}
+
+	/* The main thread joins the barrier too, and starts the clock */
+	pthread_barrier_init(&r.start, NULL, nthreads + 1);
+	for (t = 0; t < nthreads; t++) {
+		args[t].r = &r;
+		args[t].id = t;
+		if (pthread_create(&threads[t], NULL, replay_thread, &args[t]) != 0) {
+			fprintf(stderr, "mt_replay: pthread_create failed\n");
+			exit(1);
+		}
+	}
+	gettimeofday(&r.t0, NULL);
+	pthread_barrier_wait(&r.start);
+
+	for (t = 0; t < nthreads; t++)
+		pthread_join(threads[t], NULL);
+	res->secs = secs_since(&r.t0);
+
+	pthread_barrier_destroy(&r.start);
+	for (t = 0; t < nthreads; t++)
+		free(r.thread_ops[t]);
+	free(r.thread_ops);
+	free(r.prev);
+	free((void *)r.done);
+	free(last);
+	free(fill);
+	free(threads);
+	free(args);
+
+	return r.failed ? -1 : 0;
+}
+
+/*
+ * replay_thread - run this thread's ops, waiting on each op's predecessor
+ */
+static void *replay_thread(void *arg)
+{
+	replay_t *r = ((worker_arg_t *)arg)->r;
+	int id = ((worker_arg_t *)arg)->id;
+	trace_t *trace = r->trace;
+	int n = r->res->thread_ops[id];
+	int k, i, spins;
+	traceop_t *op;
+	char *p;
+
+	pthread_barrier_wait(&r->start);
+
+	for (k = 0; k < n; k++) {
+		i = r->thread_ops[id][k];
+		op = &trace->ops[i];
+
+		/* Per-id handoff: wait for the op that must come before us */
+		if (r->prev[i] >= 0) {
+			spins = 0;
+			while (!__atomic_load_n(&r->done[r->prev[i]], __ATOMIC_ACQUIRE))
+				if (++spins >= SPINS_BEFORE_YIELD) {
+					sched_yield();
+					spins = 0;
+				}
+		}
+
+		switch (op->type) {
+			case ALLOC:
+				if ((p = r->alloc->malloc(op->size)) == NULL)
+					r->failed = 1;
+				trace->blocks[op->index] = p;
+				break;
+			case REALLOC:
+				if ((p = r->alloc->realloc(trace->blocks[op->index], op->size)) == NULL)
+					r->failed = 1;
+				else
+					trace->blocks[op->index] = p;
+				break;
+			case FREE:
+				if (trace->blocks[op->index] != NULL)
+					r->alloc->free(trace->blocks[op->index]);
+				break;
+		}
+
+		__atomic_store_n(&r->done[i], 1, __ATOMIC_RELEASE);
+	}
+
+	r->res->thread_secs[id] = secs_since(&r->t0);
+	return NULL;
+}
+
+/*
+ * secs_since - wall clock seconds since t0
+ */
+static double secs_since(struct timeval *t0)
+{
+	struct timeval now;
+
+	gettimeofday(&now, NULL);
+	return (now.tv_sec - t0->tv_sec) + 1E-6*(now.tv_usec - t0->tv_usec);
+}
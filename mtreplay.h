@@ -0,0 +1,32 @@
+#ifndef __MTREPLAY_H_
+#define __MTREPLAY_H_
+
+/*
+ * mtreplay.h - Replay a trace on several threads to measure how an
+ *              allocator scales.
+ */
+#include "trace.h"
+
+/* The allocator under test; it must be safe to call from any thread */
+typedef struct {
+	void *(*malloc)(size_t size);
+	void (*free)(void *ptr);
+	void *(*realloc)(void *ptr, size_t size);
+} mt_alloc_t;
+
+/* Results of one threaded replay */
+typedef struct {
+	int nthreads;        /* replay threads used */
+	double secs;         /* wall time from start to the last op */
+	double *thread_secs; /* per thread: wall time until its own last op */
+	int *thread_ops;     /* per thread: number of ops it ran */
+} mt_result_t;
+
+/*
+ * Replay trace on nthreads threads. Returns 0 on success, -1 if an
+ * allocation failed. res->thread_secs and res->thread_ops must have
+ * room for nthreads entries.
+ */
+int mt_replay(trace_t *trace, int nthreads, mt_alloc_t *alloc, mt_result_t *res);
+
+#endif /* __MTREPLAY_H_ */
@@ -0,0 +1,163 @@
+/*
+ * perfctr.c - Count hardware events with perf_event_open(2).
+ *
+ * Each event is opened on its own, not as a group, so that a CPU
+ * without, say, a dTLB event still reports the rest. When there are
+ * more events than hardware counters, the kernel time-slices them.
+ * Every counter is therefore read together with its enabled and running
+ * times and scaled up, the same estimate perf stat makes.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "perfctr.h"
+
+#ifdef __linux__
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+
+char *perf_event_names[PERF_NUM_EVENTS] = {
+	"cycles", "instrs", "L1d-miss", "LLC-miss", "dTLB-miss", "br-miss"
+};
+
+#ifdef __linux__
+
+#define CACHE_EVENT(cache, op, result) \
+	((cache) | ((op) << 8) | ((result) << 16))
+
+/* perf_event_attr type and config for each event */
+static struct {
+	unsigned type;
+	unsigned long long config;
+} events[PERF_NUM_EVENTS] = {
+	{PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+	{PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+	{PERF_TYPE_HW_CACHE, CACHE_EVENT(PERF_COUNT_HW_CACHE_L1D,
+			PERF_COUNT_HW_CACHE_OP_READ, PERF_COUNT_HW_CACHE_RESULT_MISS)},
+	{PERF_TYPE_HW_CACHE, CACHE_EVENT(PERF_COUNT_HW_CACHE_LL,
+			PERF_COUNT_HW_CACHE_OP_READ, PERF_COUNT_HW_CACHE_RESULT_MISS)},
+	{PERF_TYPE_HW_CACHE, CACHE_EVENT(PERF_COUNT_HW_CACHE_DTLB,
+			PERF_COUNT_HW_CACHE_OP_READ, PERF_COUNT_HW_CACHE_RESULT_MISS)},
+	{PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+};
+
+/*
+ * perf_open - open a disabled counter for each event
+ */
+int perf_open(perfctr_t *pc)
+{
+	struct perf_event_attr attr;
+	int i, opened = 0, first_errno = 0;
+
+	memset(pc, 0, sizeof(*pc));
+	for (i = 0; i < PERF_NUM_EVENTS; i++) {
+		memset(&attr, 0, sizeof(attr));
+		attr.size = sizeof(attr);
+		attr.type = events[i].type;
+		attr.config = events[i].config;
+		attr.disabled = 1;
+		attr.exclude_kernel = 1; /* allowed at perf_event_paranoid <= 2 */
+		attr.exclude_hv = 1;
+		attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED |
+			PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+		pc->fd[i] = syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+		if (pc->fd[i] >= 0)
+			opened++;
+		else if (first_errno == 0)
+			first_errno = errno;
+	}
+
+	if (opened == 0)
+		errno = first_errno;
+	return opened;
+}
+
+/*
+ * perf_start - zero and enable the open counters
+ */
+void perf_start(perfctr_t *pc)
+{
+	int i;
+
+	for (i = 0; i < PERF_NUM_EVENTS; i++)
+		if (pc->fd[i] >= 0) {
+			ioctl(pc->fd[i], PERF_EVENT_IOC_RESET, 0);
+			ioctl(pc->fd[i], PERF_EVENT_IOC_ENABLE, 0);
+		}
+	pc->running = 1;
+}
+
+/*
+ * perf_stop - disable the counters and add their scaled values
+ */
+void perf_stop(perfctr_t *pc)
+{
+	unsigned long long val[3]; /* value, time enabled, time running */
+	int i;
+
+	if (!pc->running)
+		return;
+	for (i = 0; i < PERF_NUM_EVENTS; i++)
+		if (pc->fd[i] >= 0)
+			ioctl(pc->fd[i], PERF_EVENT_IOC_DISABLE, 0);
+
+	for (i = 0; i < PERF_NUM_EVENTS; i++) {
+		if (pc->fd[i] < 0)
+			continue;
+		if (read(pc->fd[i], val, sizeof(val)) != sizeof(val))
+			continue;
+		if (val[2] > 0 && val[2] < val[1])
+			pc->count[i] += (double)val[0] * val[1] / val[2];
+		else
+			pc->count[i] += val[0];
+	}
+	pc->running = 0;
+}
+
+/*
+ * perf_close - close every open counter
+ */
+void perf_close(perfctr_t *pc)
+{
+	int i;
+
+	for (i = 0; i < PERF_NUM_EVENTS; i++)
+		if (pc->fd[i] >= 0) {
+			close(pc->fd[i]);
+			pc->fd[i] = -1;
+		}
+}
+
+#else /* !__linux__ */
+
+/* No perf_event_open: every counter is unavailable */
+int perf_open(perfctr_t *pc)
+{
+	int i;
+
+	memset(pc, 0, sizeof(*pc));
+	for (i = 0; i < PERF_NUM_EVENTS; i++)
+		pc->fd[i] = -1;
+	errno = ENOSYS;
+	return 0;
+}
+
+void perf_start(perfctr_t *pc)
+{
+}
+
+void perf_stop(perfctr_t *pc)
+{
+}
+
+void perf_close(perfctr_t *pc)
+{
+}
+
+#endif /* __linux__ */
@@ -0,0 +1,47 @@
+#ifndef __PERFCTR_H_
+#define __PERFCTR_H_
+
+/*
+ * perfctr.h - Hardware performance counters (Linux perf_event_open)
+ *             around the driver's speed runs (-P).
+ *
+ * Counters count user-mode events of the calling thread only. A
+ * counter that the kernel or the CPU cannot provide is left closed and
+ * reported as unavailable; the others still work.
+ */
+
+/* The events we count, in report order */
+enum {
+	PERF_CYCLES,
+	PERF_INSTRUCTIONS,
+	PERF_L1D_MISSES,
+	PERF_LLC_MISSES,
+	PERF_DTLB_MISSES,
+	PERF_BRANCH_MISSES,
+	PERF_NUM_EVENTS
+};
+
+/* Open counters for one trace */
+typedef struct {
+	int fd[PERF_NUM_EVENTS];           /* -1 if the event is unavailable */
+	double count[PERF_NUM_EVENTS];     /* accumulated since perf_open */
+	int running;                       /* between perf_start and perf_stop */
+} perfctr_t;
+
+/* Short column names for the report, indexed like the events */
+extern char *perf_event_names[PERF_NUM_EVENTS];
+
+/*
+ * Open every event for the calling thread. Returns the number that
+ * could be opened; if that is 0, errno says why the first one failed.
+ */
+int perf_open(perfctr_t *pc);
+
+/* Start counting, or stop and add what was counted to pc->count */
+void perf_start(perfctr_t *pc);
+void perf_stop(perfctr_t *pc);
+
+/* Close the counters */
+void perf_close(perfctr_t *pc);
+
+#endif /* __PERFCTR_H_ */
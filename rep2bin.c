@@ -0,0 +1,39 @@
+/*
+ * rep2bin.c - Convert an ASCII .rep trace into the binary trace format
+ *
+ * The binary form (see trace.h) is mmap'd by mdriver and used in place,
+ * which removes fscanf parsing from the startup cost of large traces.
+ *
+ *     unix> rep2bin traces/amptjp-bal.rep amptjp-bal.bin
+ *     unix> mdriver -f amptjp-bal.bin
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "trace.h"
+
+int verbose = 0; /* read by trace.c */
+
+int main(int argc, char **argv)
+{
+	trace_t *trace;
+
+	if (argc != 3) {
+		fprintf(stderr, "Usage: rep2bin <in.rep> <out.bin>\n");
+		exit(1);
+	}
+
+	/* read_trace checks that num_ids matches the largest id in the trace */
+	trace = read_trace("", argv[1]);
+
+	if (write_trace_bin(trace, argv[2]) < 0) {
+		printf("Could not write %s: %s\n", argv[2], strerror(errno));
+		exit(1);
+	}
+
+	printf("%s: %d ids, %d ops\n", argv[2], trace->num_ids, trace->num_ops);
+	free_trace(trace);
+	exit(0);
+}
@@ -0,0 +1,435 @@
+/*
+ * results.c - Write the driver's results as JSON or CSV, and compare
+ *             them with the CSV of an earlier run.
+ *
+ * Values that weren't measured (an invalid trace, no -P, -L or
+ * --timeline) are null in JSON and empty in CSV. The baseline is read
+ * by column name, so a CSV from a driver with more or fewer columns
+ * still works.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "results.h"
+
+#define CSV_LINE    8192  /* longest CSV row we read */
+#define CSV_FIELDS  128   /* most fields per row */
+#define UTIL_SLACK  1e-4  /* utilization is exact; this only covers rounding */
+
+static char *op_names[3] = {"malloc", "free", "realloc"};
+
+static void json_string(FILE *fp, char *s);
+static void json_number(FILE *fp, double x, int defined);
+static void csv_number(FILE *fp, double x, int defined);
+static int csv_split(char *line, char **fields);
+static int csv_column(char **header, int n, char *name);
+
+/*
+ * kops - throughput of one trace, or -1 if it has none
+ */
+static double kops(stats_t *st)
+{
+	return (st->valid && st->secs > 0) ? st->ops / 1e3 / st->secs : -1;
+}
+
+/*
+ * write_results_json - One object for the run, with the perf index and
+ *     a "traces" array and totals for each allocator
+ */
+int write_results_json(char *path, results_t *res, int nres,
+		perfindex_t *pi, int errors)
+{
+	FILE *fp;
+	stats_t *st;
+	lat_summary_t *ls;
+	double ops, secs, util;
+	int r, i, e, t, all_valid;
+
+	if ((fp = fopen(path, "w")) == NULL)
+		return -1;
+
+	fprintf(fp, "{\n  \"errors\": %d,\n", errors);
+	if (pi != NULL)
+		fprintf(fp, "  \"perfindex\": {\"util\": %.3f, \"thru\": %.3f, \"total\": %.3f, "
+				"\"ref_kops\": %.3f, \"ref_measured\": %s},\n",
+				pi->util, pi->thru, pi->total, pi->ref_tput / 1e3,
+				pi->measured_ref ? "true" : "false");
+	else
+		fprintf(fp, "  \"perfindex\": null,\n");
+
+	fprintf(fp, "  \"allocators\": {");
+	for (r = 0; r < nres; r++) {
+		fprintf(fp, "%s\n    ", r ? "," : "");
+		json_string(fp, res[r].name);
+		fprintf(fp, ": {\n      \"traces\": [");
+
+		ops = secs = util = 0;
+		all_valid = 1;
+		for (i = 0; i < res[r].n; i++) {
+			st = &res[r].stats[i];
+			fprintf(fp, "%s\n        {\"trace\": %d, \"file\": ", i ? "," : "", i);
+			json_string(fp, res[r].tracefiles[i]);
+			fprintf(fp, ", \"valid\": %s, \"util\": ", st->valid ? "true" : "false");
+			json_number(fp, st->util, st->valid);
+			fprintf(fp, ", \"ops\": %.0f, \"secs\": ", st->ops);
+			json_number(fp, st->secs, st->valid);
+			fprintf(fp, ", \"kops\": ");
+			json_number(fp, kops(st), kops(st) >= 0);
+			if (st->valid && st->touch_secs > 0)
+				fprintf(fp, ", \"touch_secs\": %.9g, \"touch_kops\": %.6g",
+						st->touch_secs, st->ops / 1e3 / st->touch_secs);
+			if (st->valid && st->handle_secs > 0)
+				fprintf(fp, ",\n         \"handles\": {\"mean_heap\": %.0f, "
+						"\"mean_live\": %.0f, \"handle_mean_heap\": %.0f, "
+						"\"handle_peak_heap\": %lu, \"handle_end_heap\": %lu, "
+						"\"moved_blocks\": %lu, \"moved_bytes\": %lu, "
+						"\"handle_secs\": %.9g, \"handle_kops\": %.6g}",
+						st->plain_use.mean_heap, st->plain_use.mean_live,
+						st->handle_use.mean_heap,
+						(unsigned long)st->handle_use.peak_heap,
+						(unsigned long)st->handle_use.end_heap,
+						(unsigned long)st->compact.moved_blocks,
+						(unsigned long)st->compact.moved_bytes,
+						st->handle_secs, st->ops / 1e3 / st->handle_secs);
+
+			if (st->valid && st->timing.runs > 0)
+				fprintf(fp, ",\n         \"timing\": {\"runs\": %d, \"median\": %.9g, "
+						"\"mad\": %.9g, \"ci_lo\": %.9g, \"ci_hi\": %.9g, \"outliers\": %d}",
+						st->timing.runs, st->timing.median, st->timing.mad,
+						st->timing.ci_lo, st->timing.ci_hi, st->timing.outliers);
+
+			for (e = 0; e < PERF_NUM_EVENTS && st->perf[e] < 0; e++)
+				;
+			if (st->valid && e < PERF_NUM_EVENTS) {
+				fprintf(fp, ",\n         \"perf\": {");
+				for (e = 0; e < PERF_NUM_EVENTS; e++) {
+					fprintf(fp, "%s", e ? ", " : "");
+					json_string(fp, perf_event_names[e]);
+					fprintf(fp, ": ");
+					json_number(fp, st->perf[e], st->perf[e] >= 0);
+				}
+				fprintf(fp, "}");
+			}
+
+			if (st->valid && st->frag.heap.heap_size > 0)
+				fprintf(fp, ",\n         \"fragmentation\": {\"op\": %d, \"live\": %lu, "
+						"\"heap\": %lu, \"internal\": %lu, \"external\": %lu, "
+						"\"largest_free\": %lu}",
+						st->frag.op, (unsigned long)st->frag.live,
+						(unsigned long)st->frag.heap.heap_size,
+						(unsigned long)(st->frag.heap.alloc_bytes - st->frag.live),
+						(unsigned long)st->frag.heap.free_bytes,
+						(unsigned long)st->frag.heap.largest_free);
+
+			for (t = 0; t < 3 && st->lat[t].count == 0; t++)
+				;
+			if (t < 3) {
+				fprintf(fp, ",\n         \"latency_ns\": {");
+				for (t = 0; t < 3; t++) {
+					ls = &st->lat[t];
+					fprintf(fp, "%s\"%s\": ", t ? ", " : "", op_names[t]);
+					if (ls->count == 0) {
+						fprintf(fp, "null");
+						continue;
+					}
+					fprintf(fp, "{\"count\": %llu, \"mean\": %.1f, \"p50\": %.1f, "
+							"\"p99\": %.1f, \"p99.9\": %.1f, \"max\": %.1f}",
+							ls->count, ls->mean, ls->p50, ls->p99, ls->p999, ls->max);
+				}
+				fprintf(fp, "}");
+			}
+			fprintf(fp, "}");
+
+			if (st->valid) {
+				ops += st->ops;
+				secs += st->secs;
+				util += st->util;
+			} else
+				all_valid = 0;
+		}
+
+		fprintf(fp, "\n      ],\n      \"total\": {\"valid\": %s, \"util\": ",
+				all_valid ? "true" : "false");
+		json_number(fp, util / res[r].n, all_valid && res[r].n > 0);
+		fprintf(fp, ", \"ops\": %.0f, \"secs\": ", ops);
+		json_number(fp, secs, all_valid);
+		fprintf(fp, ", \"kops\": ");
+		json_number(fp, ops / 1e3 / secs, all_valid && secs > 0);
+		fprintf(fp, "}\n    }");
+	}
+	fprintf(fp, "\n  }\n}\n");
+
+	return fclose(fp);
+}
+
+/*
+ * write_results_csv - one row per allocator and trace
+ */
+int write_results_csv(char *path, results_t *res, int nres)
+{
+	FILE *fp;
+	stats_t *st;
+	int r, i, e, t, timed;
+
+	if ((fp = fopen(path, "w")) == NULL)
+		return -1;
+
+	fprintf(fp, "allocator,trace,file,valid,util,ops,secs,kops,"
+			"runs,mad,ci_lo,ci_hi,outliers");
+	for (e = 0; e < PERF_NUM_EVENTS; e++)
+		fprintf(fp, ",%s", perf_event_names[e]);
+	for (t = 0; t < 3; t++)
+		fprintf(fp, ",%s_count,%s_mean_ns,%s_p50_ns,%s_p99_ns,%s_p999_ns,%s_max_ns",
+				op_names[t], op_names[t], op_names[t],
+				op_names[t], op_names[t], op_names[t]);
+	fprintf(fp, ",peak_op,peak_live,peak_heap,peak_internal,peak_external,peak_largest_free");
+	fprintf(fp, ",touch_secs,touch_kops");
+	fprintf(fp, ",mean_heap,mean_live,handle_mean_heap,handle_peak_heap,"
+			"handle_end_heap,moved_blocks,moved_bytes,handle_secs,handle_kops\n");
+
+	for (r = 0; r < nres; r++) {
+		for (i = 0; i < res[r].n; i++) {
+			st = &res[r].stats[i];
+			fprintf(fp, "%s,%d,%s,%d", res[r].name, i, res[r].tracefiles[i], st->valid);
+			csv_number(fp, st->util, st->valid);
+			fprintf(fp, ",%.0f", st->ops);
+			csv_number(fp, st->secs, st->valid);
+			csv_number(fp, kops(st), kops(st) >= 0);
+
+			timed = st->valid && st->timing.runs > 0;
+			if (timed)
+				fprintf(fp, ",%d", st->timing.runs);
+			else
+				fprintf(fp, ",");
+			csv_number(fp, st->timing.mad, timed);
+			csv_number(fp, st->timing.ci_lo, timed);
+			csv_number(fp, st->timing.ci_hi, timed);
+			if (timed)
+				fprintf(fp, ",%d", st->timing.outliers);
+			else
+				fprintf(fp, ",");
+
+			for (e = 0; e < PERF_NUM_EVENTS; e++)
+				csv_number(fp, st->perf[e], st->valid && st->perf[e] >= 0);
+			for (t = 0; t < 3; t++) {
+				if (st->lat[t].count > 0)
+					fprintf(fp, ",%llu", st->lat[t].count);
+				else
+					fprintf(fp, ",");
+				csv_number(fp, st->lat[t].mean, st->lat[t].count > 0);
+				csv_number(fp, st->lat[t].p50, st->lat[t].count > 0);
+				csv_number(fp, st->lat[t].p99, st->lat[t].count > 0);
+				csv_number(fp, st->lat[t].p999, st->lat[t].count > 0);
+				csv_number(fp, st->lat[t].max, st->lat[t].count > 0);
+			}
+			if (st->valid && st->frag.heap.heap_size > 0)
+				fprintf(fp, ",%d,%lu,%lu,%lu,%lu,%lu", st->frag.op,
+						(unsigned long)st->frag.live,
+						(unsigned long)st->frag.heap.heap_size,
+						(unsigned long)(st->frag.heap.alloc_bytes - st->frag.live),
+						(unsigned long)st->frag.heap.free_bytes,
+						(unsigned long)st->frag.heap.largest_free);
+			else
+				fprintf(fp, ",,,,,,");
+			csv_number(fp, st->touch_secs, st->valid && st->touch_secs > 0);
+			csv_number(fp, st->touch_secs > 0 ? st->ops / 1e3 / st->touch_secs : 0,
+					st->valid && st->touch_secs > 0);
+			if (st->valid && st->handle_secs > 0)
+				fprintf(fp, ",%.0f,%.0f,%.0f,%lu,%lu,%lu,%lu",
+						st->plain_use.mean_heap, st->plain_use.mean_live,
+						st->handle_use.mean_heap,
+						(unsigned long)st->handle_use.peak_heap,
+						(unsigned long)st->handle_use.end_heap,
+						(unsigned long)st->compact.moved_blocks,
+						(unsigned long)st->compact.moved_bytes);
+			else
+				fprintf(fp, ",,,,,,,");
+			csv_number(fp, st->handle_secs, st->valid && st->handle_secs > 0);
+			csv_number(fp, st->handle_secs > 0 ? st->ops / 1e3 / st->handle_secs : 0,
+					st->valid && st->handle_secs > 0);
+			fprintf(fp, "\n");
+		}
+	}
+
+	return fclose(fp);
+}
+
+/* A row of the baseline CSV, split into fields */
+typedef struct {
+	char *line;
+	int nf;
+	char *f[CSV_FIELDS];
+	int used;          /* already matched to a trace */
+} csv_row_t;
+
+/*
+ * compare_baseline - Flag each trace that got worse than in the
+ *     baseline: it became invalid, its utilization dropped, or its
+ *     throughput dropped by more than threshold. A throughput drop
+ *     must also be significant: when both runs have a 95% confidence
+ *     interval for their time, the intervals must not overlap.
+ */
+int compare_baseline(char *path, results_t *res, double threshold)
+{
+	FILE *fp;
+	char line[CSV_LINE];
+	char *header[CSV_FIELDS], *hline;
+	csv_row_t *rows = NULL, *row;
+	int nrows = 0, nhead, i, j, regressions = 0;
+	int c_alloc, c_file, c_valid, c_util, c_kops, c_hi, need;
+	stats_t *st;
+	double base_kops, cur_kops, change, base_util;
+	int slower, worse_util, have_ci;
+
+	if ((fp = fopen(path, "r")) == NULL)
+		return -1;
+	if (fgets(line, sizeof(line), fp) == NULL || (hline = strdup(line)) == NULL) {
+		fclose(fp);
+		return -1;
+	}
+	nhead = csv_split(hline, header);
+	while (fgets(line, sizeof(line), fp) != NULL) {
+		if ((rows = (csv_row_t *)realloc(rows, (nrows + 1) * sizeof(csv_row_t))) == NULL ||
+				(rows[nrows].line = strdup(line)) == NULL) {
+			fprintf(stderr, "compare_baseline: out of memory\n");
+			exit(1);
+		}
+		rows[nrows].nf = csv_split(rows[nrows].line, rows[nrows].f);
+		rows[nrows].used = 0;
+		nrows++;
+	}
+	fclose(fp);
+
+	c_alloc = csv_column(header, nhead, "allocator");
+	c_file = csv_column(header, nhead, "file");
+	c_valid = csv_column(header, nhead, "valid");
+	c_util = csv_column(header, nhead, "util");
+	c_kops = csv_column(header, nhead, "kops");
+	c_hi = csv_column(header, nhead, "ci_hi");
+	need = c_alloc;
+	need = (c_file > need) ? c_file : need;
+	need = (c_valid > need) ? c_valid : need;
+	need = (c_util > need) ? c_util : need;
+	need = (c_kops > need) ? c_kops : need;
+	if (c_alloc < 0 || c_file < 0 || c_valid < 0 || c_util < 0 || c_kops < 0) {
+		regressions = -1;
+		goto out;
+	}
+
+	printf("\nComparison of %s malloc with baseline %s:\n", res->name, path);
+	printf("%5s%7s%7s%9s%9s%9s\n", "trace", "util", "base", "Kops", "base", "change");
+	for (i = 0; i < res->n; i++) {
+		st = &res->stats[i];
+		for (j = 0; j < nrows; j++) {
+			row = &rows[j];
+			if (!row->used && row->nf > need &&
+					strcmp(row->f[c_alloc], res->name) == 0 &&
+					strcmp(row->f[c_file], res->tracefiles[i]) == 0)
+				break;
+		}
+		if (j == nrows) {
+			printf("%2d%38s  not in baseline\n", i, "");
+			continue;
+		}
+		row->used = 1;
+
+		if (!st->valid || atoi(row->f[c_valid]) == 0) {
+			if (!st->valid && atoi(row->f[c_valid]) == 1) {
+				printf("%2d%38s  INVALID\n", i, "");
+				regressions++;
+			} else
+				printf("%2d%38s\n", i, "");
+			continue;
+		}
+
+		base_util = atof(row->f[c_util]);
+		base_kops = atof(row->f[c_kops]);
+		cur_kops = kops(st);
+		change = (base_kops > 0) ? cur_kops / base_kops - 1 : 0;
+
+		/* A run is slower for sure only if its fastest plausible time is */
+		have_ci = st->timing.runs > 0 && c_hi >= 0 && c_hi < row->nf &&
+			*row->f[c_hi] != '\0';
+		slower = change < -threshold &&
+			(!have_ci || st->timing.ci_lo > atof(row->f[c_hi]));
+		worse_util = st->util < base_util - UTIL_SLACK;
+		regressions += slower + worse_util;
+
+		printf("%2d%9.1f%%%6.1f%%%9.0f%9.0f%+8.1f%%%s%s\n", i,
+				100 * st->util, 100 * base_util, cur_kops, base_kops, 100 * change,
+				slower ? "  SLOWER" : "", worse_util ? "  UTIL" : "");
+	}
+	if (regressions > 0)
+		printf("%d regression%s against the baseline\n",
+				regressions, regressions == 1 ? "" : "s");
+	else
+		printf("No regressions against the baseline\n");
+
+out:
+	free(hline);
+	for (j = 0; j < nrows; j++)
+		free(rows[j].line);
+	free(rows);
+	return regressions;
+}
+
+/*
+ * json_string - print s as a JSON string literal
+ */
+static void json_string(FILE *fp, char *s)
+{
+	fputc('"', fp);
+	for (; *s != '\0'; s++) {
+		if (*s == '"' || *s == '\\')
+			fprintf(fp, "\\%c", *s);
+		else if ((unsigned char)*s < 0x20)
+			fprintf(fp, "\\u%04x", (unsigned char)*s);
+		else
+			fputc(*s, fp);
+	}
+	fputc('"', fp);
+}
+
+static void json_number(FILE *fp, double x, int defined)
+{
+	if (defined)
+		fprintf(fp, "%.9g", x);
+	else
+		fprintf(fp, "null");
+}
+
+static void csv_number(FILE *fp, double x, int defined)
+{
+	if (defined)
+		fprintf(fp, ",%.9g", x);
+	else
+		fprintf(fp, ",");
+}
+
+/*
+ * csv_split - split a line at the commas, in place
+ */
+static int csv_split(char *line, char **fields)
+{
+	int n = 0;
+
+	line[strcspn(line, "\r\n")] = '\0';
+	fields[n++] = line;
+	for (; *line != '\0' && n < CSV_FIELDS; line++)
+		if (*line == ',') {
+			*line = '\0';
+			fields[n++] = line + 1;
+		}
+	return n;
+}
+
+static int csv_column(char **header, int n, char *name)
+{
+	int i;
+
+	for (i = 0; i < n; i++)
+		if (strcmp(header[i], name) == 0)
+			return i;
+	return -1;
+}
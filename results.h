@@ -0,0 +1,93 @@
+#ifndef __RESULTS_H_
+#define __RESULTS_H_
+
+/*
+ * results.h - The driver's per-trace results, written out for scripts
+ *             (--json, --csv) and checked against an earlier run
+ *             (--baseline).
+ */
+#include <stdio.h>
+
+#include "fsecs.h"
+#include "perfctr.h"
+#include "latency.h"
+#include "timeline.h"
+
+/* How full the mm heap was over a replay, for --handles */
+typedef struct {
+	double mean_heap;    /* heap size averaged over the requests */
+	double mean_live;    /* live payload averaged over the requests */
+	size_t peak_heap;    /* largest heap size */
+	size_t peak_live;    /* largest live payload */
+	size_t end_heap;     /* heap size after the last request */
+} heapuse_t;
+
+/* Summarizes the important stats for some malloc function on some trace */
+typedef struct {
+	/* defined for both libc malloc and student malloc package (mm.c) */
+	double ops;      /* number of ops (malloc/free/realloc) in the trace */
+	int valid;       /* was the trace processed correctly by the allocator? */
+	double secs;     /* number of secs needed to run the trace */
+
+	/* defined only for the student malloc package */
+	double util;     /* space utilization for this trace (always 0 for libc) */
+
+	/* hardware events per run with -P; negative if not counted */
+	double perf[PERF_NUM_EVENTS];
+
+	/* spread of the timed runs behind secs (runs is 0 if not sampled) */
+	fsecs_stats_t timing;
+
+	/* request latencies with -L, by op type (count is 0 without -L) */
+	lat_summary_t lat[3];
+
+	/* mm heap at its sampled peak with --timeline (heap_size is 0 without) */
+	tl_sample_t frag;
+
+	/* time of a run with payload accesses (0 without --touch) */
+	double touch_secs;
+
+	/* with --handles: the heap over the util run and over a run with
+	   relocatable blocks, the compactor's work in the latter, and its
+	   time (handle_secs is 0 without --handles) */
+	heapuse_t plain_use;
+	heapuse_t handle_use;
+	mm_compact_stats_t compact;
+	double handle_secs;
+
+	/* Note: secs and util are only defined if valid is true */
+} stats_t;
+
+/* One allocator's results on every trace of the run */
+typedef struct {
+	char *name;        /* "mm" or "libc" */
+	int n;             /* number of traces */
+	char **tracefiles; /* their file names */
+	stats_t *stats;    /* and their stats */
+} results_t;
+
+/* The performance index and what went into it */
+typedef struct {
+	double util;       /* points for space utilization */
+	double thru;       /* points for throughput */
+	double total;      /* util + thru, out of 100 */
+	double ref_tput;   /* ops/sec that earns all the throughput points */
+	int measured_ref;  /* ref_tput measured with libc in this run? */
+} perfindex_t;
+
+/* Write every allocator's results; pi is NULL if there were errors */
+int write_results_json(char *path, results_t *res, int nres,
+		perfindex_t *pi, int errors);
+
+/* Write one row per allocator and trace, with a header row */
+int write_results_csv(char *path, results_t *res, int nres);
+
+/*
+ * Compare res against the rows for the same allocator in a CSV file
+ * written by an earlier --csv run. Prints a table and returns the
+ * number of regressions, or -1 if the file can't be read. threshold
+ * is the smallest relative throughput loss that counts.
+ */
+int compare_baseline(char *path, results_t *res, double threshold);
+
+#endif /* __RESULTS_H_ */
@@ -0,0 +1,76 @@
+/*
+ * snapshot.c - Write the mm heap's block map with mm_heap_walk.
+ *
+ * The records are collected in memory first, since the header needs
+ * the block count, and then written with one fwrite. The buffer is
+ * kept between snapshots, so a heap of a few MB is dumped in about the
+ * time it takes to walk it.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "snapshot.h"
+#include "memlib.h"
+#include "mm.h"
+
+static snap_block_t *blocks;  /* records of the snapshot being taken */
+static unsigned int num_blocks, max_blocks;
+static int num_lists;         /* one more than the largest list seen */
+
+/*
+ * add_block - mm_heap_walk callback that appends one record
+ */
+static int add_block(mm_block_t *block, void *arg)
+{
+	snap_block_t *b;
+	char *lo = (char *)arg;
+
+	if (num_blocks == max_blocks) {
+		max_blocks = max_blocks ? 2 * max_blocks : 4096;
+		if ((blocks = (snap_block_t *)realloc(blocks,
+						max_blocks * sizeof(snap_block_t))) == NULL) {
+			fprintf(stderr, "snap_write: out of memory\n");
+			exit(1);
+		}
+	}
+	b = &blocks[num_blocks++];
+	b->offset = (char *)block->addr - lo;
+	b->size = block->size;
+	b->list = block->list;
+	if (block->list >= num_lists)
+		num_lists = block->list + 1;
+	return 0;
+}
+
+/*
+ * snap_write - dump every block of the heap to path
+ */
+int snap_write(char *path, int tracenum, int op, size_t live)
+{
+	snap_hdr_t hdr;
+	FILE *fp;
+	int ok;
+
+	num_blocks = 0;
+	num_lists = 0;
+	mm_heap_walk(add_block, mem_heap_lo());
+
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, SNAP_MAGIC, 4);
+	hdr.version = SNAP_VERSION;
+	hdr.tracenum = tracenum;
+	hdr.op = op;
+	hdr.heap_size = mem_heapsize();
+	hdr.live = live;
+	hdr.num_blocks = num_blocks;
+	hdr.num_lists = num_lists;
+
+	if ((fp = fopen(path, "wb")) == NULL)
+		return -1;
+	ok = fwrite(&hdr, sizeof(hdr), 1, fp) == 1 &&
+		fwrite(blocks, sizeof(snap_block_t), num_blocks, fp) == num_blocks;
+	if (fclose(fp) != 0)
+		ok = 0;
+	return ok ? 0 : -1;
+}
@@ -0,0 +1,36 @@
+#ifndef __SNAPSHOT_H_
+#define __SNAPSHOT_H_
+
+/*
+ * snapshot.h - Binary dumps of the mm heap's block map (--snapshot),
+ *              read by the snapview script.
+ *
+ * A snapshot is a header followed immediately by num_blocks records,
+ * one per block in address order, all in host byte order.
+ */
+#include <stddef.h>
+
+#define SNAP_MAGIC   "MMSN"
+#define SNAP_VERSION 1
+
+typedef struct {
+	char magic[4];           /* SNAP_MAGIC, not NUL terminated */
+	int version;             /* SNAP_VERSION */
+	int tracenum;            /* trace the snapshot was taken on */
+	int op;                  /* requests done before the snapshot */
+	unsigned int heap_size;  /* bytes from mem_heap_lo() to mem_heap_hi() */
+	unsigned int live;       /* payload bytes the trace had allocated */
+	unsigned int num_blocks; /* number of snap_block_t records that follow */
+	int num_lists;           /* one more than the largest list number */
+} snap_hdr_t;
+
+typedef struct {
+	unsigned int offset;     /* of the payload from mem_heap_lo() */
+	unsigned int size;       /* block size, header included */
+	int list;                /* free list of a free block; -1 if allocated */
+} snap_block_t;
+
+/* Write a snapshot of the mm heap to path; returns 0, or -1 on error */
+int snap_write(char *path, int tracenum, int op, size_t live);
+
+#endif /* __SNAPSHOT_H_ */
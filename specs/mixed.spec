@@ -0,0 +1,31 @@
+# mixed.spec - a server-like mix for gentrace
+#
+# Start-up builds long-lived tables, steady state serves short-lived
+# requests with a few growing buffers, and a burst of large blocks
+# near the end pushes against the peak.
+
+seed 42
+peak 8000000
+
+phase startup
+allocs 20000
+size lognormal 4.5 1.2
+lifetime forever
+
+phase steady
+allocs 200000
+size bins 16:40 32:25 64:15 128:10 512:6 4096:4
+lifetime exp 200
+realloc 0.02 geometric 2
+
+phase burst
+allocs 20000
+size powerlaw 1.1 1024 262144
+lifetime uniform 10 1000
+realloc 0.01 linear 4096
+
+phase cooldown
+allocs 50000
+size uniform 8 256
+lifetime fixed 50
+realloc 0
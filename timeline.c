@@ -0,0 +1,135 @@
+/*
+ * timeline.c - Heap samples over a trace, written as CSV.
+ *
+ * With -j, several workers append to the same file. Each trace's rows
+ * are therefore formatted in memory and appended with a single write
+ * to a file opened with O_APPEND, so rows of different traces never
+ * interleave.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "timeline.h"
+
+#define TL_ROW 256  /* longest row we format */
+
+static char *header =
+	"trace,file,op,live,heap,alloc_bytes,alloc_blocks,internal,"
+	"free_bytes,free_blocks,largest_free,overhead,util\n";
+
+/*
+ * tl_init - choose the sampling step and make room for the samples
+ */
+void tl_init(timeline_t *tl, int num_ops, int points)
+{
+	tl->step = (points > 0 && num_ops > points) ? num_ops / points : 1;
+	tl->n = 0;
+	tl->max = num_ops / tl->step + 2; /* one at op 0, one at the end */
+	if ((tl->samples = (tl_sample_t *)malloc(tl->max * sizeof(tl_sample_t))) == NULL) {
+		fprintf(stderr, "tl_init: out of memory\n");
+		exit(1);
+	}
+}
+
+/*
+ * tl_sample - record the heap after op requests
+ */
+void tl_sample(timeline_t *tl, int op, size_t live)
+{
+	tl_sample_t *s;
+
+	if (tl->n > 0 && tl->samples[tl->n - 1].op == op)
+		return; /* the end of the trace fell on a step */
+	if (tl->n == tl->max) {
+		tl->max *= 2;
+		if ((tl->samples = (tl_sample_t *)realloc(tl->samples,
+						tl->max * sizeof(tl_sample_t))) == NULL) {
+			fprintf(stderr, "tl_sample: out of memory\n");
+			exit(1);
+		}
+	}
+	s = &tl->samples[tl->n++];
+	s->op = op;
+	s->live = live;
+	mm_heap_stats(&s->heap);
+}
+
+/*
+ * tl_peak - the last sample with the most live payload, or NULL
+ */
+tl_sample_t *tl_peak(timeline_t *tl)
+{
+	tl_sample_t *peak = NULL;
+	int i;
+
+	for (i = 0; i < tl->n; i++)
+		if (peak == NULL || tl->samples[i].live >= peak->live)
+			peak = &tl->samples[i];
+	return peak;
+}
+
+/*
+ * tl_write_header - start a new timeline file
+ */
+int tl_write_header(char *path)
+{
+	FILE *fp;
+
+	if ((fp = fopen(path, "w")) == NULL)
+		return -1;
+	fputs(header, fp);
+	return fclose(fp);
+}
+
+/*
+ * tl_write - append the samples of one trace
+ */
+int tl_write(timeline_t *tl, char *path, int tracenum, char *tracefile)
+{
+	tl_sample_t *s;
+	char *buf;
+	size_t len = 0, size;
+	ssize_t done;
+	int fd, i;
+
+	size = (size_t)tl->n * (TL_ROW + strlen(tracefile)) + 1;
+	if ((buf = (char *)malloc(size)) == NULL)
+		return -1;
+	for (i = 0; i < tl->n; i++) {
+		s = &tl->samples[i];
+		len += sprintf(buf + len, "%d,%s,%d,%lu,%lu,%lu,%lu,%lu,%lu,%lu,%lu,%lu,%.6f\n",
+				tracenum, tracefile, s->op,
+				(unsigned long)s->live,
+				(unsigned long)s->heap.heap_size,
+				(unsigned long)s->heap.alloc_bytes,
+				(unsigned long)s->heap.alloc_blocks,
+				(unsigned long)(s->heap.alloc_bytes - s->live),
+				(unsigned long)s->heap.free_bytes,
+				(unsigned long)s->heap.free_blocks,
+				(unsigned long)s->heap.largest_free,
+				(unsigned long)(s->heap.heap_size - s->heap.alloc_bytes - s->heap.free_bytes),
+				s->heap.heap_size ? (double)s->live / s->heap.heap_size : 0);
+	}
+
+	if ((fd = open(path, O_WRONLY | O_APPEND)) < 0) {
+		free(buf);
+		return -1;
+	}
+	done = write(fd, buf, len);
+	close(fd);
+	free(buf);
+	return (done == (ssize_t)len) ? 0 : -1;
+}
+
+/*
+ * tl_free - release the samples
+ */
+void tl_free(timeline_t *tl)
+{
+	free(tl->samples);
+	tl->samples = NULL;
+	tl->n = tl->max = 0;
+}
@@ -0,0 +1,52 @@
+#ifndef __TIMELINE_H_
+#define __TIMELINE_H_
+
+/*
+ * timeline.h - Samples of the mm heap taken during the utilization
+ *              pass, to show when and how the heap fragments (--timeline).
+ *
+ * Each sample splits the heap into the payload the trace has live,
+ * internal fragmentation (allocated block bytes beyond the payload:
+ * headers, footers, alignment and unsplit remainders), external
+ * fragmentation (free blocks) and the heap's fixed overhead.
+ */
+#include <stddef.h>
+
+#include "mm.h"
+
+/* One look at the heap */
+typedef struct {
+	int op;                 /* requests done before the sample */
+	size_t live;            /* payload bytes the trace has allocated */
+	mm_heap_stats_t heap;
+} tl_sample_t;
+
+/* The samples of one trace */
+typedef struct {
+	int step;               /* sample every step requests */
+	int n, max;
+	tl_sample_t *samples;
+} timeline_t;
+
+/* Plan about points samples over a trace of num_ops requests */
+void tl_init(timeline_t *tl, int num_ops, int points);
+
+/* Sample the heap now, after op requests, with live payload bytes */
+void tl_sample(timeline_t *tl, int op, size_t live);
+
+/* Is a sample due after op requests? */
+#define TL_DUE(tl, op) ((tl) != NULL && (op) % (tl)->step == 0)
+
+/* The sample with the most live payload */
+tl_sample_t *tl_peak(timeline_t *tl);
+
+/* Truncate path and write the CSV header */
+int tl_write_header(char *path);
+
+/* Append the samples of a trace to path as CSV rows */
+int tl_write(timeline_t *tl, char *path, int tracenum, char *tracefile);
+
+/* Free the samples */
+void tl_free(timeline_t *tl);
+
+#endif /* __TIMELINE_H_ */
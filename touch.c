@@ -0,0 +1,119 @@
+/*
+ * touch.c - Read and write block payloads during a replay.
+ *
+ * The live set is an array of ids with each id's position in it, so a
+ * block is added or removed in constant time. Removal moves the last
+ * entry into the hole, which keeps the array in allocation order
+ * except for the moved entries.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "touch.h"
+
+/*
+ * touch_init - allocate the live set for num_ids ids
+ */
+void touch_init(touch_t *t, int num_ids, double frac, int write_pct)
+{
+	memset(t, 0, sizeof(*t));
+	t->frac = frac;
+	t->write_pct = write_pct;
+	if ((t->live = (int *)malloc((num_ids + 1) * sizeof(int))) == NULL ||
+			(t->pos = (int *)malloc((num_ids + 1) * sizeof(int))) == NULL) {
+		fprintf(stderr, "touch_init: out of memory\n");
+		exit(1);
+	}
+	memset(t->pos, 0xff, num_ids * sizeof(int));
+	touch_start(t);
+}
+
+/*
+ * touch_start - forget the blocks of the previous replay
+ */
+void touch_start(touch_t *t)
+{
+	int i;
+
+	for (i = 0; i < t->n; i++)
+		t->pos[t->live[i]] = -1;
+	t->n = 0;
+	t->next = 0;
+	t->owed = 0;
+	t->seed = 1;
+}
+
+/*
+ * touch_alloc - write the new bytes of block id, and add it to the
+ *     live set if it wasn't there
+ */
+void touch_alloc(touch_t *t, trace_t *trace, int id, size_t oldsize)
+{
+	size_t size = trace->block_sizes[id];
+
+	if (size > oldsize)
+		memset(trace->blocks[id] + oldsize, id & 0xFF, size - oldsize);
+	if (t->pos[id] < 0) {
+		t->pos[id] = t->n;
+		t->live[t->n++] = id;
+	}
+}
+
+/*
+ * touch_free - take block id out of the live set
+ */
+void touch_free(touch_t *t, int id)
+{
+	int i = t->pos[id];
+
+	if (i < 0)
+		return;
+	t->live[i] = t->live[--t->n];
+	t->pos[t->live[i]] = i;
+	t->pos[id] = -1;
+}
+
+/*
+ * touch_some - access frac of the live blocks, continuing the sweep
+ *     where the previous request left it
+ */
+void touch_some(touch_t *t, trace_t *trace)
+{
+	unsigned char *p;
+	size_t size, off;
+	int id;
+
+	if (t->n == 0) {
+		t->owed = 0;
+		return;
+	}
+	for (t->owed += t->frac * t->n; t->owed >= 1; t->owed -= 1) {
+		if (t->next >= t->n)
+			t->next = 0;
+		id = t->live[t->next++];
+		p = (unsigned char *)trace->blocks[id];
+		size = trace->block_sizes[id];
+
+		t->seed = t->seed * 1103515245 + 12345;
+		if ((int)((t->seed >> 16) % 100) < t->write_pct) {
+			for (off = 0; off < size; off += TOUCH_LINE)
+				p[off]++;
+		}
+		else {
+			for (off = 0; off < size; off += TOUCH_LINE)
+				t->sum += p[off];
+		}
+	}
+}
+
+/*
+ * touch_deinit - free the live set
+ */
+void touch_deinit(touch_t *t)
+{
+	free(t->live);
+	free(t->pos);
+	t->live = t->pos = NULL;
+	t->n = 0;
+}
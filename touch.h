@@ -0,0 +1,48 @@
+#ifndef __TOUCH_H_
+#define __TOUCH_H_
+
+/*
+ * touch.h - Payload accesses during a replay (--touch), standing in
+ *           for the application's own use of the blocks it allocates.
+ *
+ * Every new block is written in full. After each request, a share of
+ * the live blocks is read or updated one cache line at a time. The
+ * accesses sweep the live blocks in roughly the order they were
+ * allocated, so an allocator that places blocks allocated together
+ * near each other gets fewer cache and TLB misses.
+ */
+#include "trace.h"
+
+#define TOUCH_LINE 64  /* bytes between the words accessed in a block */
+
+typedef struct {
+	double frac;        /* share of the live blocks accessed per request */
+	int write_pct;      /* percent of accesses that update the block */
+	int *live;          /* ids of the live blocks */
+	int *pos;           /* where each id is in live, or -1 */
+	int n;              /* number of live blocks */
+	int next;           /* entry of live the next access goes to */
+	double owed;        /* accesses due but not yet made */
+	unsigned int seed;  /* chooses reads or updates */
+	unsigned int sum;   /* what the reads saw */
+} touch_t;
+
+/* Make room for a trace with num_ids block ids */
+void touch_init(touch_t *t, int num_ids, double frac, int write_pct);
+
+/* Start a replay with no live blocks */
+void touch_start(touch_t *t);
+
+/* Block id was just allocated, or reallocated from oldsize bytes */
+void touch_alloc(touch_t *t, trace_t *trace, int id, size_t oldsize);
+
+/* Block id is about to be freed */
+void touch_free(touch_t *t, int id);
+
+/* The accesses that follow a request */
+void touch_some(touch_t *t, trace_t *trace);
+
+/* Release what touch_init allocated */
+void touch_deinit(touch_t *t);
+
+#endif /* __TOUCH_H_ */
@@ -0,0 +1,279 @@
+/*
+ * trace.c - Routines that read and write malloc lab trace files.
+ *
+ * Text traces (.rep) are parsed with fscanf. Binary traces written by
+ * write_trace_bin() are mmap'd read-only and their op records are used
+ * in place, so loading them costs no parsing and no copying.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "trace.h"
+
+#define MAXLINE 1024 /* max string size */
+
+/* The binary format relies on these sizes; fail the build if they change */
+typedef char tracebin_op_check[(sizeof(traceop_t) == 16) ? 1 : -1];
+typedef char tracebin_hdr_check[(sizeof(tracebin_hdr_t) % sizeof(int) == 0) ? 1 : -1];
+
+extern int verbose; /* -v option in mdriver.c */
+
+static trace_t *read_trace_text(FILE *tracefile, trace_t *trace, char *path);
+static trace_t *read_trace_bin(int fd, trace_t *trace, char *path);
+static void alloc_block_arrays(trace_t *trace);
+static void trace_error(char *msg, char *path);
+static void check_ops_bin(trace_t *trace, char *path);
+
+/*
+ * read_trace - read a trace file and store it in memory
+ */
+trace_t *read_trace(char *tracedir, char *filename)
+{
+	FILE *tracefile;
+	trace_t *trace;
+	char path[MAXLINE];
+	char magic[sizeof(((tracebin_hdr_t *)0)->magic)];
+
+	if (verbose > 1)
+		printf("Reading tracefile: %s\n", filename);
+
+	/* Allocate the trace record */
+	if ((trace = (trace_t *) malloc(sizeof(trace_t))) == NULL)
+		trace_error("malloc 1 failed in read_trace", "");
+	trace->map_base = NULL;
+	trace->map_len = 0;
+	trace->stream = NULL;
+
+	strcpy(path, tracedir);
+	strcat(path, filename);
+	if ((tracefile = fopen(path, "r")) == NULL)
+		trace_error("Could not open trace in read_trace", path);
+
+	/* Binary traces announce themselves with a magic number */
+	if (fread(magic, 1, sizeof(magic), tracefile) == sizeof(magic) &&
+			!memcmp(magic, TRACEBIN_MAGIC, sizeof(magic))) {
+		trace = read_trace_bin(fileno(tracefile), trace, path);
+		fclose(tracefile);
+		return trace;
+	}
+
+	rewind(tracefile);
+	trace = read_trace_text(tracefile, trace, path);
+	fclose(tracefile);
+	return trace;
+}
+
+/*
+ * read_trace_text - parse an ASCII .rep trace with fscanf
+ */
+static trace_t *read_trace_text(FILE *tracefile, trace_t *trace, char *path)
+{
+	char type[MAXLINE];
+	unsigned index, size;
+	unsigned max_index = 0;
+	unsigned op_index;
+	unsigned tid = 0, max_tid = 0;
+
+	/* Read the trace file header */
+	assert(fscanf(tracefile, "%d", &(trace->sugg_heapsize)) == 1); /* not used */
+	assert(fscanf(tracefile, "%d", &(trace->num_ids)) == 1);
+	assert(fscanf(tracefile, "%d", &(trace->num_ops)) == 1);
+	assert(fscanf(tracefile, "%d", &(trace->weight)) == 1);        /* not used */
+
+	/* We'll store each request line in the trace in this array */
+	if ((trace->ops =
+				(traceop_t *)malloc(trace->num_ops * sizeof(traceop_t))) == NULL)
+		trace_error("malloc 2 failed in read_trace", path);
+
+	alloc_block_arrays(trace);
+
+	/* read every request line in the trace file */
+	index = 0;
+	op_index = 0;
+	while (fscanf(tracefile, "%s", type) != EOF) {
+		switch(type[0]) {
+			case 't': /* the ops that follow were made by thread <tid> */
+				assert(fscanf(tracefile, "%u", &tid)==1);
+				max_tid = (tid > max_tid) ? tid : max_tid;
+				continue;
+			case 'a':
+				assert(fscanf(tracefile, "%u %u", &index, &size)==2);
+				trace->ops[op_index].type = ALLOC;
+				trace->ops[op_index].index = index;
+				trace->ops[op_index].size = size;
+				max_index = (index > max_index) ? index : max_index;
+				break;
+			case 'r':
+				assert(fscanf(tracefile, "%u %u", &index, &size)==2);
+				trace->ops[op_index].type = REALLOC;
+				trace->ops[op_index].index = index;
+				trace->ops[op_index].size = size;
+				max_index = (index > max_index) ? index : max_index;
+				break;
+			case 'f':
+				assert(fscanf(tracefile, "%ud", &index)==1);
+				trace->ops[op_index].type = FREE;
+				trace->ops[op_index].index = index;
+				break;
+			default:
+				printf("Bogus type character (%c) in tracefile %s\n",
+						type[0], path);
+				exit(1);
+		}
+		trace->ops[op_index].tid = tid;
+		op_index++;
+
+	}
+	assert(max_index == trace->num_ids - 1);
+	assert(trace->num_ops == op_index);
+	trace->num_threads = max_tid + 1;
+
+	return trace;
+}
+
+/*
+ * read_trace_bin - map a binary trace and use its op records in place
+ */
+static trace_t *read_trace_bin(int fd, trace_t *trace, char *path)
+{
+	struct stat st;
+	tracebin_hdr_t *hdr;
+
+	if (fstat(fd, &st) < 0)
+		trace_error("fstat failed in read_trace", path);
+	if ((size_t)st.st_size < sizeof(tracebin_hdr_t)) {
+		errno = EINVAL;
+		trace_error("Truncated binary trace header", path);
+	}
+
+	trace->map_len = st.st_size;
+	trace->map_base = mmap(NULL, trace->map_len, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (trace->map_base == MAP_FAILED)
+		trace_error("mmap failed in read_trace", path);
+
+	hdr = (tracebin_hdr_t *)trace->map_base;
+	errno = EINVAL; /* the checks below report format errors */
+	if (hdr->version != TRACEBIN_VERSION)
+		trace_error("Unsupported binary trace version", path);
+	/* Divide rather than multiply: num_ops * sizeof(traceop_t) can wrap */
+	if (hdr->num_ops < 0 ||
+			(trace->map_len - sizeof(tracebin_hdr_t)) % sizeof(traceop_t) != 0 ||
+			(size_t)hdr->num_ops !=
+			(trace->map_len - sizeof(tracebin_hdr_t)) / sizeof(traceop_t))
+		trace_error("Binary trace length does not match its header", path);
+
+	trace->sugg_heapsize = hdr->sugg_heapsize;
+	trace->num_ids = hdr->num_ids;
+	trace->num_ops = hdr->num_ops;
+	trace->weight = hdr->weight;
+	trace->num_threads = hdr->num_threads;
+	trace->ops = (traceop_t *)(hdr + 1);
+	if (trace->num_ids < 0 || trace->num_threads < 1)
+		trace_error("Bad id or thread count in binary trace header", path);
+
+	/* Hint that the ops will be read, and replayed, front to back */
+	madvise(trace->map_base, trace->map_len, MADV_SEQUENTIAL);
+	check_ops_bin(trace, path);
+
+	/* Only the id-indexed arrays need fresh storage */
+	alloc_block_arrays(trace);
+
+	return trace;
+}
+
+/*
+ * check_ops_bin - the records of a binary trace are used in place, so
+ *     check once that each names a known request, an id below num_ids
+ *     and a thread below num_threads, as the text reader's checks do
+ */
+static void check_ops_bin(trace_t *trace, char *path)
+{
+	traceop_t *op;
+	int i;
+
+	errno = EINVAL;
+	for (i = 0; i < trace->num_ops; i++) {
+		op = &trace->ops[i];
+		if ((int)op->type != ALLOC && (int)op->type != FREE && (int)op->type != REALLOC)
+			trace_error("Bad request type in binary trace", path);
+		if (op->index < 0 || op->index >= trace->num_ids)
+			trace_error("Block id out of range in binary trace", path);
+		if (op->tid < 0 || op->tid >= trace->num_threads)
+			trace_error("Thread id out of range in binary trace", path);
+	}
+}
+
+/*
+ * alloc_block_arrays - size the per-id block arrays from num_ids
+ */
+static void alloc_block_arrays(trace_t *trace)
+{
+	/* We'll keep an array of pointers to the allocated blocks here... */
+	if ((trace->blocks =
+				(char **)malloc(trace->num_ids * sizeof(char *))) == NULL)
+		trace_error("malloc 3 failed in read_trace", "");
+
+	/* ... along with the corresponding byte sizes of each block */
+	if ((trace->block_sizes =
+				(size_t *)malloc(trace->num_ids * sizeof(size_t))) == NULL)
+		trace_error("malloc 4 failed in read_trace", "");
+}
+
+/*
+ * free_trace - Free the trace record and the three arrays it points
+ *              to, all of which were allocated in read_trace().
+ */
+void free_trace(trace_t *trace)
+{
+	if (trace->map_base != NULL)  /* binary ops live in the mapping */
+		munmap(trace->map_base, trace->map_len);
+	else
+		free(trace->ops);
+	free(trace->blocks);
+	free(trace->block_sizes);
+	free(trace);              /* and the trace record itself... */
+}
+
+/*
+ * write_trace_bin - Write a trace in the format read_trace_bin() maps.
+ */
+int write_trace_bin(trace_t *trace, char *path)
+{
+	FILE *out;
+	tracebin_hdr_t hdr;
+
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, TRACEBIN_MAGIC, sizeof(hdr.magic));
+	hdr.version = TRACEBIN_VERSION;
+	hdr.sugg_heapsize = trace->sugg_heapsize;
+	hdr.num_ids = trace->num_ids;
+	hdr.num_ops = trace->num_ops;
+	hdr.weight = trace->weight;
+	hdr.num_threads = trace->num_threads;
+
+	if ((out = fopen(path, "wb")) == NULL)
+		return -1;
+	if (fwrite(&hdr, sizeof(hdr), 1, out) != 1 ||
+			fwrite(trace->ops, sizeof(traceop_t), trace->num_ops, out) !=
+			(size_t)trace->num_ops) {
+		fclose(out);
+		return -1;
+	}
+	return fclose(out);
+}
+
+/*
+ * trace_error - Report a Unix-style error while handling a trace
+ */
+static void trace_error(char *msg, char *path)
+{
+	printf("%s %s: %s\n", msg, path, strerror(errno));
+	exit(1);
+}
@@ -0,0 +1,64 @@
+#ifndef __TRACE_H_
+#define __TRACE_H_
+
+/*
+ * trace.h - Trace file records shared by the malloc driver and the
+ *           trace tools.
+ *
+ * A trace is either an ASCII .rep file (see README) or a binary trace
+ * produced by rep2bin. Binary traces are mapped straight into memory,
+ * so the op records below double as the on-disk format.
+ */
+#include <stddef.h>
+
+/* Characterizes a single trace operation (allocator request) */
+typedef struct tag_traceop_t {
+	enum {ALLOC, FREE, REALLOC} type; /* type of request */
+	int index;                        /* index for free() to use later */
+	int size;                         /* byte size of alloc/realloc request */
+	int tid;                          /* trace thread that made the request */
+} traceop_t;
+
+/* Holds the information for one trace file*/
+typedef struct {
+	int sugg_heapsize;   /* suggested heap size (unused) */
+	int num_ids;         /* number of alloc/realloc ids */
+	int num_ops;         /* number of distinct requests */
+	int weight;          /* weight for this trace (unused) */
+	int num_threads;     /* largest thread id + 1 */
+	traceop_t *ops;      /* array of requests */
+	char **blocks;       /* array of ptrs returned by malloc/realloc... */
+	size_t *block_sizes; /* ... and a corresponding array of payload sizes */
+	void *map_base;      /* start of the mapping if ops came from mmap... */
+	size_t map_len;      /* ... and its length in bytes */
+	struct tracestream *stream; /* reader state if streamed, else NULL */
+} trace_t;
+
+/*
+ * Binary trace header. It is followed immediately by num_ops
+ * traceop_t records in host byte order. The header is a multiple of
+ * the record alignment, so the records can be used in place.
+ */
+#define TRACEBIN_MAGIC   "MMTB"
+#define TRACEBIN_VERSION 2
+
+typedef struct {
+	char magic[4];       /* TRACEBIN_MAGIC, not NUL terminated */
+	int version;         /* TRACEBIN_VERSION */
+	int sugg_heapsize;   /* copied from the .rep header */
+	int num_ids;         /* max id + 1, checked by the converter */
+	int num_ops;         /* number of traceop_t records that follow */
+	int weight;          /* copied from the .rep header */
+	int num_threads;     /* largest thread id + 1 */
+} tracebin_hdr_t;
+
+/* Read a text or binary trace file into memory */
+trace_t *read_trace(char *tracedir, char *filename);
+
+/* Free the trace record and everything read_trace() attached to it */
+void free_trace(trace_t *trace);
+
+/* Write a trace in binary form; returns 0 on success, -1 on error */
+int write_trace_bin(trace_t *trace, char *path);
+
+#endif /* __TRACE_H_ */
@@ -0,0 +1,575 @@
+/*
+ * traceinfo.c - Describe what a trace asks of an allocator.
+ *
+ *     unix> traceinfo traces/realloc-bal.rep
+ *     unix> traceinfo -n 20 -c live.csv traces/amptjp-bal.rep traces/cccp-bal.rep
+ *     unix> traceinfo            (the default traces in config.h)
+ *
+ * For each trace it prints the mix of requests, a histogram of request
+ * sizes and the most common exact sizes, how many requests each block
+ * lives for, the live payload over the trace, and the realloc chains.
+ *
+ * It ends with bounds on the heap the trace needs, to set mdriver's
+ * util against:
+ *
+ *   lower bound  The most ALIGNMENT-rounded payload that is ever live
+ *                at once. No allocator can use a smaller heap, so
+ *                util can't exceed hwm / lower bound (hwm being the
+ *                peak live payload, as eval_mm_util counts it).
+ *
+ *   packing      The heap of an offline placement that knows every
+ *                block's lifetime in advance: blocks are placed one
+ *                by one, largest first, at the lowest address free for
+ *                the block's whole life. A realloc'd block is placed
+ *                either as separate blocks, the old and the new one
+ *                overlapping for the request that copies, or as one
+ *                block as large as the chain ever gets, which grows
+ *                in place. All four combinations with placing blocks
+ *                in allocation order instead are tried, and the
+ *                smallest heap is kept. That heap is achievable, so
+ *                the best util lies between hwm / packing and hwm /
+ *                lower bound.
+ *
+ * The packing is quadratic in the number of blocks, so traces with
+ * more than PACK_MAX blocks skip it unless -p is given.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <getopt.h>
+
+#include "trace.h"
+#include "config.h"
+
+#define NBINS     32        /* power of two bins for sizes and lifetimes */
+#define PACK_MAX  50000     /* most blocks packed without -p */
+#define CURVE_ROWS 20       /* rows of the live payload plot */
+
+#define ALIGN(size) (((size) + (ALIGNMENT-1)) & ~(ALIGNMENT-1))
+
+int verbose = 0; /* read by trace.c */
+
+/* One block for the packing: live for requests [start, end) */
+typedef struct {
+	int start, end;
+	int size;           /* ALIGNMENT-rounded */
+	long off;           /* where the packing put it */
+} interval_t;
+
+/* A distinct request size and how often it was asked for */
+typedef struct {
+	int size;
+	int count;
+} size_count_t;
+
+static int top_sizes = 10;    /* exact sizes to list (-n) */
+static int bar_width = 40;    /* characters in the longest bar (-w) */
+static int force_pack = 0;    /* pack however many blocks there are (-p) */
+static FILE *curve_file = NULL; /* live payload after each request (-c) */
+
+static char *default_tracefiles[] = {
+	DEFAULT_TRACEFILES, NULL
+};
+
+static void usage(void);
+static void analyze(char *tracedir, char *file, int tracenum);
+static int bin_of(long x);
+static void bar(double frac);
+static void print_bins(char *title, char *unit, long *count, double *bytes);
+static int cmp_count(const void *a, const void *b);
+static int cmp_size(const void *a, const void *b);
+static int cmp_start(const void *a, const void *b);
+static int cmp_off(const void *a, const void *b);
+static int cmp_by_size(const void *a, const void *b);
+static long pack(interval_t *iv, int n, int by_size);
+
+int main(int argc, char **argv)
+{
+	char *curve_path = NULL;
+	int c, i;
+
+	while ((c = getopt(argc, argv, "n:w:c:ph")) != EOF) {
+		switch (c) {
+			case 'n':
+				top_sizes = atoi(optarg);
+				break;
+			case 'w':
+				bar_width = atoi(optarg);
+				break;
+			case 'c':
+				curve_path = optarg;
+				break;
+			case 'p':
+				force_pack = 1;
+				break;
+			case 'h':
+			default:
+				usage();
+				exit(c == 'h' ? 0 : 1);
+		}
+	}
+	if (top_sizes < 0 || bar_width < 1) {
+		usage();
+		exit(1);
+	}
+
+	if (curve_path != NULL) {
+		if ((curve_file = fopen(curve_path, "w")) == NULL) {
+			fprintf(stderr, "traceinfo: cannot create %s: %s\n", curve_path, strerror(errno));
+			exit(1);
+		}
+		fprintf(curve_file, "trace,file,op,live,live_aligned\n");
+	}
+
+	if (optind == argc) {
+		for (i = 0; default_tracefiles[i] != NULL; i++)
+			analyze(TRACEDIR, default_tracefiles[i], i);
+	} else {
+		for (i = optind; i < argc; i++)
+			analyze("", argv[i], i - optind);
+	}
+
+	if (curve_file != NULL && fclose(curve_file) != 0) {
+		fprintf(stderr, "traceinfo: cannot write %s: %s\n", curve_path, strerror(errno));
+		exit(1);
+	}
+	exit(0);
+}
+
+/*
+ * usage - print the command line options
+ */
+static void usage(void)
+{
+	fprintf(stderr, "Usage: traceinfo [-hp] [-n <n>] [-w <width>] [-c <file>] [<trace> ...]\n");
+	fprintf(stderr, "Options\n");
+	fprintf(stderr, "\t-c <file>  Write the live payload after every request to <file> as CSV.\n");
+	fprintf(stderr, "\t-h         Print this message.\n");
+	fprintf(stderr, "\t-n <n>     List the <n> most common request sizes (default 10).\n");
+	fprintf(stderr, "\t-p         Compute the packing bound even for very large traces.\n");
+	fprintf(stderr, "\t-w <width> Draw bars up to <width> characters (default 40).\n");
+	fprintf(stderr, "With no traces, the default traces in %s are analyzed.\n", TRACEDIR);
+}
+
+/*
+ * analyze - print everything we know about one trace
+ */
+static void analyze(char *tracedir, char *file, int tracenum)
+{
+	trace_t *trace;
+	traceop_t *op;
+	int i, j, id, n, nsizes, ndiff;
+	int num_alloc = 0, num_free = 0, num_realloc = 0, never_freed = 0;
+	int *born, *chain, *first_size;   /* per id; born is -1 if not live */
+	int *cur_iv, *cur_ivc;            /* per id: the live block's intervals */
+	long live = 0, live_aligned = 0, hwm = 0, lower = 0;
+	int hwm_op = 0, lower_op = 0;
+	long size_count[NBINS], life_count[NBINS], chain_count[NBINS];
+	double size_bytes[NBINS], life_bytes[NBINS];
+	long *curve;                      /* live payload after each op */
+	long curve_max;
+	interval_t *iv, *ivc;             /* blocks moved by realloc, or grown */
+	int niv = 0, nivc = 0;
+	size_count_t *sizes;
+	long grow = 0, shrink = 0, same = 0;
+	double ratio_sum = 0, delta_sum = 0;
+	int longest = 0, longest_from = 0, longest_to = 0;
+	long packed, packed2;
+
+	trace = read_trace(tracedir, file);
+	n = trace->num_ops;
+
+	born = (int *)calloc(trace->num_ids + 1, sizeof(int));
+	chain = (int *)calloc(trace->num_ids + 1, sizeof(int));
+	first_size = (int *)calloc(trace->num_ids + 1, sizeof(int));
+	cur_iv = (int *)calloc(trace->num_ids + 1, sizeof(int));
+	cur_ivc = (int *)calloc(trace->num_ids + 1, sizeof(int));
+	curve = (long *)malloc((n + 1) * sizeof(long));
+	iv = (interval_t *)malloc((n + 1) * sizeof(interval_t));
+	ivc = (interval_t *)malloc((n + 1) * sizeof(interval_t));
+	sizes = (size_count_t *)malloc((n + 1) * sizeof(size_count_t));
+	if (!born || !chain || !first_size || !cur_iv || !cur_ivc || !curve ||
+			!iv || !ivc || !sizes) {
+		fprintf(stderr, "traceinfo: out of memory for %s\n", file);
+		exit(1);
+	}
+	memset(size_count, 0, sizeof(size_count));
+	memset(size_bytes, 0, sizeof(size_bytes));
+	memset(life_count, 0, sizeof(life_count));
+	memset(life_bytes, 0, sizeof(life_bytes));
+	memset(chain_count, 0, sizeof(chain_count));
+	for (id = 0; id < trace->num_ids; id++)
+		born[id] = -1;
+
+	/*
+	 * One pass over the requests. trace->block_sizes holds each live
+	 * block's size. iv[] gets an interval for each block, whose end is
+	 * filled in when the block dies or is moved by realloc, and ivc[]
+	 * one for each malloc, which grows with its realloc chain.
+	 */
+	nsizes = 0;
+	for (i = 0; i < n; i++) {
+		op = &trace->ops[i];
+		id = op->index;
+		switch (op->type) {
+			case ALLOC:
+				num_alloc++;
+				born[id] = i;
+				chain[id] = 0;
+				first_size[id] = op->size;
+				trace->block_sizes[id] = op->size;
+				cur_iv[id] = niv;
+				iv[niv].start = i;
+				iv[niv].end = n;
+				iv[niv++].size = ALIGN(op->size);
+				cur_ivc[id] = nivc;
+				ivc[nivc].start = i;
+				ivc[nivc].end = n;
+				ivc[nivc++].size = ALIGN(op->size);
+				live += op->size;
+				live_aligned += ALIGN(op->size);
+				break;
+
+			case REALLOC:
+				num_realloc++;
+				chain[id]++;
+				if (op->size > (int)trace->block_sizes[id])
+					grow++;
+				else if (op->size < (int)trace->block_sizes[id])
+					shrink++;
+				else
+					same++;
+				if (trace->block_sizes[id] > 0)
+					ratio_sum += (double)op->size / trace->block_sizes[id];
+				delta_sum += op->size - (double)trace->block_sizes[id];
+				live += op->size - (long)trace->block_sizes[id];
+				live_aligned += ALIGN(op->size) - ALIGN((long)trace->block_sizes[id]);
+				iv[cur_iv[id]].end = i + 1; /* copied during this request */
+				cur_iv[id] = niv;
+				iv[niv].start = i;
+				iv[niv].end = n;
+				iv[niv++].size = ALIGN(op->size);
+				if (ALIGN(op->size) > ivc[cur_ivc[id]].size)
+					ivc[cur_ivc[id]].size = ALIGN(op->size);
+				trace->block_sizes[id] = op->size;
+				break;
+
+			case FREE:
+				num_free++;
+				j = bin_of(i - born[id]);
+				life_count[j]++;
+				life_bytes[j] += trace->block_sizes[id];
+				j = bin_of(chain[id]);
+				if (chain[id] > 0) {
+					chain_count[j]++;
+					if (chain[id] > longest) {
+						longest = chain[id];
+						longest_from = first_size[id];
+						longest_to = trace->block_sizes[id];
+					}
+				}
+				live -= trace->block_sizes[id];
+				live_aligned -= ALIGN((long)trace->block_sizes[id]);
+				iv[cur_iv[id]].end = i;
+				ivc[cur_ivc[id]].end = i;
+				trace->block_sizes[id] = 0;
+				born[id] = -1;
+				break;
+		}
+
+		if (op->type != FREE) {
+			j = bin_of(op->size);
+			size_count[j]++;
+			size_bytes[j] += op->size;
+			sizes[nsizes].size = op->size;
+			sizes[nsizes++].count = 1;
+		}
+		curve[i] = live;
+		if (live > hwm) {
+			hwm = live;
+			hwm_op = i;
+		}
+		if (live_aligned > lower) {
+			lower = live_aligned;
+			lower_op = i;
+		}
+		if (curve_file != NULL)
+			fprintf(curve_file, "%d,%s,%d,%ld,%ld\n", tracenum, file, i, live, live_aligned);
+	}
+
+	/* Blocks still live at the end, and their realloc chains */
+	for (id = 0; id < trace->num_ids; id++) {
+		if (born[id] >= 0) {
+			never_freed++;
+			if (chain[id] > 0)
+				chain_count[bin_of(chain[id])]++;
+		}
+	}
+
+	printf("%s: %d requests (%d malloc, %d realloc, %d free), %d ids, %d thread%s\n",
+			file, n, num_alloc, num_realloc, num_free, trace->num_ids,
+			trace->num_threads, trace->num_threads == 1 ? "" : "s");
+
+	/* Request sizes */
+	print_bins("request size", "bytes", size_count, size_bytes);
+
+	/* Exact sizes, most common first */
+	qsort(sizes, nsizes, sizeof(size_count_t), cmp_size);
+	for (i = 0, ndiff = 0; i < nsizes; i++) {
+		if (ndiff > 0 && sizes[ndiff-1].size == sizes[i].size)
+			sizes[ndiff-1].count++;
+		else
+			sizes[ndiff++] = sizes[i];
+	}
+	qsort(sizes, ndiff, sizeof(size_count_t), cmp_count);
+	if (top_sizes > 0 && ndiff > 0) {
+		printf("\n%d distinct sizes; the most common:\n", ndiff);
+		printf("%10s%10s%8s\n", "size", "requests", "share");
+		for (i = 0; i < ndiff && i < top_sizes; i++)
+			printf("%10d%10d%7.1f%%\n", sizes[i].size, sizes[i].count,
+					100.0 * sizes[i].count / nsizes);
+	}
+
+	/* Lifetimes */
+	print_bins("lifetime (requests)", "bytes", life_count, life_bytes);
+	if (never_freed > 0)
+		printf("%21s %8d\n", "never freed", never_freed);
+
+	/* Realloc chains */
+	if (num_realloc > 0) {
+		printf("\n%d reallocs: %ld grow, %ld shrink, %ld same size\n",
+				num_realloc, grow, shrink, same);
+		printf("Mean change %+.0f bytes, mean new/old size %.3f\n",
+				delta_sum / num_realloc, ratio_sum / num_realloc);
+		printf("Longest chain: %d reallocs, from %d to %d bytes\n",
+				longest, longest_from, longest_to);
+		print_bins("reallocs per block", NULL, chain_count, NULL);
+	}
+
+	/* Live payload over the trace, as the largest value in each slice */
+	if (n > 0 && hwm > 0) {
+		printf("\nLive payload (peak %ld bytes at request %d):\n", hwm, hwm_op);
+		for (i = 0; i < CURVE_ROWS; i++) {
+			int lo = (long)n * i / CURVE_ROWS, hi = (long)n * (i + 1) / CURVE_ROWS;
+			if (hi <= lo)
+				continue;
+			for (curve_max = 0, j = lo; j < hi; j++)
+				if (curve[j] > curve_max)
+					curve_max = curve[j];
+			printf("%10d %10ld  ", lo, curve_max);
+			bar((double)curve_max / hwm);
+			printf("\n");
+		}
+	}
+
+	/* Bounds on the heap */
+	printf("\nHeap needed:\n");
+	printf("%-14s%10ld bytes  at request %d\n", "lower bound", lower, lower_op);
+	if (niv > PACK_MAX && !force_pack) {
+		printf("%-14s%10s  (more than %d blocks; use -p)\n", "packing", "skipped", PACK_MAX);
+		if (lower > 0)
+			printf("util can be at most %.1f%%\n", 100.0 * hwm / lower);
+	}
+	else {
+		packed = pack(iv, niv, 1);
+		if ((packed2 = pack(iv, niv, 0)) < packed)
+			packed = packed2;
+		if (num_realloc > 0) {
+			if ((packed2 = pack(ivc, nivc, 1)) < packed)
+				packed = packed2;
+			if ((packed2 = pack(ivc, nivc, 0)) < packed)
+				packed = packed2;
+		}
+		printf("%-14s%10ld bytes  (%.1f%% over the lower bound)\n", "packing",
+				packed, lower ? 100.0 * (packed - lower) / lower : 0.0);
+		if (lower > 0 && packed > 0)
+			printf("util can reach %.1f%%, and no more than %.1f%%\n",
+					100.0 * hwm / packed, 100.0 * hwm / lower);
+	}
+	printf("\n");
+
+	free(born);
+	free(chain);
+	free(first_size);
+	free(cur_iv);
+	free(cur_ivc);
+	free(curve);
+	free(iv);
+	free(ivc);
+	free(sizes);
+	free_trace(trace);
+}
+
+/*
+ * bin_of - the power of two bin of x: 0 for x <= 1, else floor(log2 x)
+ */
+static int bin_of(long x)
+{
+	int b = 0;
+
+	while (x > 1 && b < NBINS - 1) {
+		x >>= 1;
+		b++;
+	}
+	return b;
+}
+
+/*
+ * bar - draw frac of bar_width
+ */
+static void bar(double frac)
+{
+	int i, len = (int)(frac * bar_width + 0.5);
+
+	for (i = 0; i < len; i++)
+		putchar('#');
+}
+
+/*
+ * print_bins - print a power of two histogram, with the bytes in each
+ *     bin if bytes isn't NULL
+ */
+static void print_bins(char *title, char *unit, long *count, double *bytes)
+{
+	long most = 0, total = 0;
+	double total_bytes = 0;
+	int b, lo = NBINS, hi = -1;
+	char range[64];
+
+	for (b = 0; b < NBINS; b++) {
+		if (count[b] == 0)
+			continue;
+		if (b < lo)
+			lo = b;
+		hi = b;
+		total += count[b];
+		if (bytes)
+			total_bytes += bytes[b];
+		if (count[b] > most)
+			most = count[b];
+	}
+	if (total == 0)
+		return;
+
+	printf("\n%21s %8s %6s", title, "count", "share");
+	if (bytes)
+		printf(" %12s %6s", unit, "share");
+	printf("\n");
+	for (b = lo; b <= hi; b++) {
+		if (b == 0)
+			sprintf(range, "0-1");
+		else
+			sprintf(range, "%ld-%ld", 1L << b, (2L << b) - 1);
+		printf("%21s %8ld %5.1f%%", range, count[b], 100.0 * count[b] / total);
+		if (bytes)
+			printf(" %12.0f %5.1f%%", bytes[b],
+					total_bytes ? 100.0 * bytes[b] / total_bytes : 0.0);
+		printf("  ");
+		bar((double)count[b] / most);
+		printf("\n");
+	}
+}
+
+/* Sort sizes by count, most common first, then by size */
+static int cmp_count(const void *a, const void *b)
+{
+	const size_count_t *x = a, *y = b;
+
+	if (x->count != y->count)
+		return y->count - x->count;
+	return x->size - y->size;
+}
+
+/* Sort sizes by size */
+static int cmp_size(const void *a, const void *b)
+{
+	const size_count_t *x = a, *y = b;
+
+	return (x->size > y->size) - (x->size < y->size);
+}
+
+/* Sort intervals by start; larger first among equal starts */
+static int cmp_start(const void *a, const void *b)
+{
+	const interval_t *x = *(interval_t **)a, *y = *(interval_t **)b;
+
+	if (x->start != y->start)
+		return x->start - y->start;
+	return y->size - x->size;
+}
+
+/* Sort intervals by the offset the packing gave them */
+static int cmp_off(const void *a, const void *b)
+{
+	const interval_t *x = *(interval_t **)a, *y = *(interval_t **)b;
+
+	return (x->off > y->off) - (x->off < y->off);
+}
+
+/* Sort intervals largest first, then by start */
+static int cmp_by_size(const void *a, const void *b)
+{
+	const interval_t *x = *(interval_t **)a, *y = *(interval_t **)b;
+
+	if (x->size != y->size)
+		return y->size - x->size;
+	return x->start - y->start;
+}
+
+/*
+ * pack - Place every interval at the lowest offset where it doesn't
+ *     overlap, in space, any interval already placed that it overlaps
+ *     in time. Intervals are placed largest first if by_size, else in
+ *     order of their start. Returns the heap size the placement needs.
+ */
+static long pack(interval_t *iv, int n, int by_size)
+{
+	interval_t **order, **placed, **conflict, *x;
+	int i, j, nplaced = 0, nconflict;
+	long off, heap = 0;
+
+	order = (interval_t **)malloc((n + 1) * sizeof(interval_t *));
+	placed = (interval_t **)malloc((n + 1) * sizeof(interval_t *));
+	conflict = (interval_t **)malloc((n + 1) * sizeof(interval_t *));
+	if (!order || !placed || !conflict) {
+		fprintf(stderr, "traceinfo: out of memory for the packing\n");
+		exit(1);
+	}
+	for (i = 0; i < n; i++)
+		order[i] = &iv[i];
+	qsort(order, n, sizeof(interval_t *), by_size ? cmp_by_size : cmp_start);
+
+	for (i = 0; i < n; i++) {
+		x = order[i];
+		if (x->start >= x->end || x->size == 0) {
+			x->off = 0;
+			continue;
+		}
+
+		/* The placed intervals alive at some point of x's life */
+		nconflict = 0;
+		for (j = 0; j < nplaced; j++)
+			if (placed[j]->start < x->end && x->start < placed[j]->end)
+				conflict[nconflict++] = placed[j];
+		qsort(conflict, nconflict, sizeof(interval_t *), cmp_off);
+
+		/* First gap, in address order, that x fits in */
+		off = 0;
+		for (j = 0; j < nconflict; j++) {
+			if (off + x->size <= conflict[j]->off)
+				break;
+			if (conflict[j]->off + conflict[j]->size > off)
+				off = conflict[j]->off + conflict[j]->size;
+		}
+		x->off = off;
+		if (off + x->size > heap)
+			heap = off + x->size;
+		placed[nplaced++] = x;
+	}
+
+	free(order);
+	free(placed);
+	free(conflict);
+	return heap;
+}
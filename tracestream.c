@@ -0,0 +1,397 @@
+/*
+ * tracestream.c - Stream trace ops from disk through a bounded ring.
+ *
+ * The reader thread decodes STREAM_CHUNK_OPS ops at a time into the
+ * next free slot of a STREAM_CHUNKS-slot ring. The replay thread takes
+ * whole chunks, so the two threads synchronize once per chunk rather
+ * than once per op. Memory use is bounded by the ring, not the trace.
+ *
+ * Every evaluation pass starts with rewind_trace_stream(), which waits
+ * until the ring is full. A replay that runs no faster than the reader
+ * therefore never blocks; any time it does spend blocked is recorded
+ * so the driver can take it out of the timing. When the entire trace
+ * fits in the ring, rewinding just resets the replay cursor.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <sys/time.h>
+
+#include "tracestream.h"
+
+#define MAXLINE          1024 /* max string size */
+#define STREAM_CHUNK_OPS 4096 /* ops decoded per ring slot */
+#define STREAM_CHUNKS      64 /* ring slots (about 3 MB of ops) */
+
+/* One slot of the ring */
+typedef struct {
+	int count;                            /* ops in this chunk */
+	int max_index;                        /* largest block id in this chunk */
+	traceop_t ops[STREAM_CHUNK_OPS];
+} chunk_t;
+
+struct tracestream {
+	/* Owned by the reader thread */
+	FILE *file;
+	char path[MAXLINE];
+	int binary;             /* binary trace (fread) or text (fscanf)? */
+	long ops_offset;        /* file offset of the first op */
+	int num_threads;        /* from a binary header, to check each op's tid */
+	unsigned tid;           /* thread named by the last 't' line */
+
+	/* Shared, protected by lock */
+	pthread_t reader;
+	pthread_mutex_t lock;
+	pthread_cond_t filled;  /* signalled when a chunk is produced */
+	pthread_cond_t drained; /* signalled when a chunk is released */
+	chunk_t *ring;
+	unsigned long produced; /* chunks written since the last rewind */
+	unsigned long consumed; /* chunks released since the last rewind */
+	int eof;                /* reader hit the end of the trace */
+	int rewind;             /* replay asked the reader to start over */
+	int quit;               /* replay asked the reader to exit */
+
+	/* Owned by the replay thread */
+	chunk_t *cur;           /* chunk being replayed, or NULL */
+	int base;               /* op number of cur->ops[0] */
+	size_t ids_cap;         /* capacity of trace->blocks/block_sizes */
+	double stall;           /* seconds spent waiting on the reader */
+};
+
+static void *reader_main(void *arg);
+static int decode_chunk(struct tracestream *s, chunk_t *chunk);
+static void check_op_bin(struct tracestream *s, traceop_t *op);
+static void grow_ids(trace_t *trace, int max_index);
+static void wait_timed(struct tracestream *s, pthread_cond_t *cond);
+static void stream_error(char *msg, char *path);
+
+/*
+ * open_trace_stream - read the trace header and start the reader thread
+ */
+trace_t *open_trace_stream(char *tracedir, char *filename)
+{
+	trace_t *trace;
+	struct tracestream *s;
+	tracebin_hdr_t hdr;
+
+	if ((trace = (trace_t *)calloc(1, sizeof(trace_t))) == NULL ||
+			(s = (struct tracestream *)calloc(1, sizeof(*s))) == NULL ||
+			(s->ring = (chunk_t *)malloc(STREAM_CHUNKS * sizeof(chunk_t))) == NULL)
+		stream_error("malloc failed in open_trace_stream", "");
+	trace->stream = s;
+
+	strcpy(s->path, tracedir);
+	strcat(s->path, filename);
+	if ((s->file = fopen(s->path, "r")) == NULL)
+		stream_error("Could not open trace in open_trace_stream", s->path);
+
+	/* Same header information as read_trace, without reading any ops */
+	if (fread(&hdr, sizeof(hdr), 1, s->file) == 1 &&
+			!memcmp(hdr.magic, TRACEBIN_MAGIC, sizeof(hdr.magic))) {
+		if (hdr.version != TRACEBIN_VERSION) {
+			errno = EINVAL;
+			stream_error("Unsupported binary trace version", s->path);
+		}
+		s->binary = 1;
+		trace->sugg_heapsize = hdr.sugg_heapsize;
+		trace->num_ids = hdr.num_ids;
+		trace->num_ops = hdr.num_ops;
+		trace->weight = hdr.weight;
+		trace->num_threads = hdr.num_threads;
+		s->num_threads = hdr.num_threads;
+		if (hdr.num_ids < 0 || hdr.num_threads < 1) {
+			errno = EINVAL;
+			stream_error("Bad id or thread count in binary trace header", s->path);
+		}
+	} else {
+		rewind(s->file);
+		if (fscanf(s->file, "%d %d %d %d", &trace->sugg_heapsize,
+					&trace->num_ids, &trace->num_ops, &trace->weight) != 4) {
+			errno = EINVAL;
+			stream_error("Bad trace header", s->path);
+		}
+		trace->num_threads = 1; /* not known without reading the ops */
+	}
+	s->ops_offset = ftell(s->file);
+
+	/* num_ids only sizes the initial arrays; grow_ids handles the rest */
+	grow_ids(trace, (trace->num_ids > 0) ? trace->num_ids - 1 : 0);
+
+	pthread_mutex_init(&s->lock, NULL);
+	pthread_cond_init(&s->filled, NULL);
+	pthread_cond_init(&s->drained, NULL);
+	if (pthread_create(&s->reader, NULL, reader_main, s) != 0)
+		stream_error("pthread_create failed in open_trace_stream", s->path);
+
+	return trace;
+}
+
+/*
+ * close_trace_stream - stop the reader and free everything
+ */
+void close_trace_stream(trace_t *trace)
+{
+	struct tracestream *s = trace->stream;
+
+	pthread_mutex_lock(&s->lock);
+	s->quit = 1;
+	pthread_cond_signal(&s->drained);
+	pthread_mutex_unlock(&s->lock);
+	pthread_join(s->reader, NULL);
+
+	pthread_mutex_destroy(&s->lock);
+	pthread_cond_destroy(&s->filled);
+	pthread_cond_destroy(&s->drained);
+	fclose(s->file);
+	free(s->ring);
+	free(s);
+	free(trace->blocks);
+	free(trace->block_sizes);
+	free(trace);
+}
+
+/*
+ * rewind_trace_stream - start a new pass over the trace
+ */
+void rewind_trace_stream(trace_t *trace)
+{
+	struct tracestream *s = trace->stream;
+
+	pthread_mutex_lock(&s->lock);
+	s->cur = NULL;
+	s->base = 0;
+	if (s->eof && s->produced <= STREAM_CHUNKS) {
+		/* Every chunk of the trace is still in the ring */
+		s->consumed = 0;
+	} else {
+		s->rewind = 1;
+		pthread_cond_signal(&s->drained);
+		while (s->rewind)
+			wait_timed(s, &s->filled);
+
+		/* Let the reader get a full ring ahead before replay starts */
+		while (!s->eof && s->produced - s->consumed < STREAM_CHUNKS)
+			wait_timed(s, &s->filled);
+	}
+	pthread_mutex_unlock(&s->lock);
+}
+
+/*
+ * trace_stream_op - Return op i, fetching the next chunk when needed.
+ *     Ops must be requested in order, starting from 0 after a rewind.
+ */
+traceop_t *trace_stream_op(trace_t *trace, int i)
+{
+	struct tracestream *s = trace->stream;
+	chunk_t *chunk;
+
+	if (s->cur != NULL && i - s->base < s->cur->count)
+		return &s->cur->ops[i - s->base];
+
+	pthread_mutex_lock(&s->lock);
+
+	/* Hand the chunk we were replaying back to the reader */
+	if (s->cur != NULL) {
+		s->base += s->cur->count;
+		s->cur = NULL;
+		s->consumed++;
+		pthread_cond_signal(&s->drained);
+	}
+
+	while (s->consumed == s->produced && !s->eof)
+		wait_timed(s, &s->filled);
+
+	if (s->consumed == s->produced) {
+		pthread_mutex_unlock(&s->lock);
+		return NULL; /* end of trace */
+	}
+	chunk = &s->ring[s->consumed % STREAM_CHUNKS];
+	pthread_mutex_unlock(&s->lock);
+
+	if (chunk->count == 0)
+		return NULL;
+	if ((size_t)chunk->max_index >= s->ids_cap)
+		grow_ids(trace, chunk->max_index);
+	s->cur = chunk;
+	return &chunk->ops[i - s->base];
+}
+
+/*
+ * trace_stream_stall - report and reset the time spent blocked
+ */
+double trace_stream_stall(trace_t *trace)
+{
+	double stall = trace->stream->stall;
+
+	trace->stream->stall = 0;
+	return stall;
+}
+
+/*
+ * reader_main - the reader thread: fill free ring slots until told to quit
+ */
+static void *reader_main(void *arg)
+{
+	struct tracestream *s = (struct tracestream *)arg;
+	chunk_t *chunk;
+	int full;
+
+	pthread_mutex_lock(&s->lock);
+	for (;;) {
+		while (!s->quit && !s->rewind &&
+				(s->eof || s->produced - s->consumed >= STREAM_CHUNKS))
+			pthread_cond_wait(&s->drained, &s->lock);
+		if (s->quit)
+			break;
+
+		if (s->rewind) {
+			fseek(s->file, s->ops_offset, SEEK_SET);
+			s->tid = 0;
+			s->produced = s->consumed = 0;
+			s->eof = 0;
+			s->rewind = 0;
+			pthread_cond_broadcast(&s->filled);
+			continue;
+		}
+
+		/* Decode outside the lock; the slot is not visible to replay yet */
+		chunk = &s->ring[s->produced % STREAM_CHUNKS];
+		pthread_mutex_unlock(&s->lock);
+		full = decode_chunk(s, chunk);
+		pthread_mutex_lock(&s->lock);
+
+		s->produced++;
+		if (!full)
+			s->eof = 1;
+		pthread_cond_broadcast(&s->filled);
+	}
+	pthread_mutex_unlock(&s->lock);
+	return NULL;
+}
+
+/*
+ * decode_chunk - Read up to STREAM_CHUNK_OPS ops. Returns 1 if the chunk
+ *     was filled, 0 if the end of the trace was reached.
+ */
+static int decode_chunk(struct tracestream *s, chunk_t *chunk)
+{
+	char type[MAXLINE];
+	unsigned index, size;
+	traceop_t *op;
+
+	chunk->count = 0;
+	chunk->max_index = 0;
+
+	if (s->binary) {
+		chunk->count = fread(chunk->ops, sizeof(traceop_t), STREAM_CHUNK_OPS, s->file);
+		for (op = chunk->ops; op < chunk->ops + chunk->count; op++) {
+			check_op_bin(s, op);
+			if (op->index > chunk->max_index)
+				chunk->max_index = op->index;
+		}
+	} else {
+		while (chunk->count < STREAM_CHUNK_OPS &&
+				fscanf(s->file, "%s", type) != EOF) {
+			op = &chunk->ops[chunk->count];
+			switch (type[0]) {
+				case 't':
+					if (fscanf(s->file, "%u", &s->tid) != 1)
+						stream_error("Truncated thread id in trace", s->path);
+					continue;
+				case 'a':
+				case 'r':
+					if (fscanf(s->file, "%u %u", &index, &size) != 2)
+						stream_error("Truncated request in trace", s->path);
+					op->type = (type[0] == 'a') ? ALLOC : REALLOC;
+					op->size = size;
+					break;
+				case 'f':
+					if (fscanf(s->file, "%u", &index) != 1)
+						stream_error("Truncated request in trace", s->path);
+					op->type = FREE;
+					break;
+				default:
+					printf("Bogus type character (%c) in tracefile %s\n",
+							type[0], s->path);
+					exit(1);
+			}
+			if (index > INT_MAX) {
+				errno = EINVAL;
+				stream_error("Block id out of range in trace", s->path);
+			}
+			op->index = index;
+			op->tid = s->tid;
+			if ((int)index > chunk->max_index)
+				chunk->max_index = index;
+			chunk->count++;
+		}
+	}
+
+	return chunk->count == STREAM_CHUNK_OPS;
+}
+
+/*
+ * check_op_bin - Binary ops are used as read, so check each one as
+ *     check_ops_bin in trace.c does: a known request, a nonnegative
+ *     id (grow_ids makes room for any), and a thread below num_threads
+ */
+static void check_op_bin(struct tracestream *s, traceop_t *op)
+{
+	errno = EINVAL;
+	if ((int)op->type != ALLOC && (int)op->type != FREE && (int)op->type != REALLOC)
+		stream_error("Bad request type in binary trace", s->path);
+	if (op->index < 0)
+		stream_error("Block id out of range in binary trace", s->path);
+	if (op->tid < 0 || op->tid >= s->num_threads)
+		stream_error("Thread id out of range in binary trace", s->path);
+}
+
+/*
+ * grow_ids - make sure the block arrays can be indexed by max_index
+ */
+static void grow_ids(trace_t *trace, int max_index)
+{
+	struct tracestream *s = trace->stream;
+	size_t cap = (s->ids_cap > 0) ? s->ids_cap : 1024;
+
+	while (cap <= (size_t)max_index)
+		cap *= 2;
+	if (cap == s->ids_cap)
+		return;
+	if (cap > SIZE_MAX / sizeof(char *) || cap > SIZE_MAX / sizeof(size_t)) {
+		errno = ENOMEM;
+		stream_error("Too many block ids in grow_ids", s->path);
+	}
+
+	if ((trace->blocks = (char **)realloc(trace->blocks, cap * sizeof(char *))) == NULL ||
+			(trace->block_sizes = (size_t *)realloc(trace->block_sizes,
+					cap * sizeof(size_t))) == NULL)
+		stream_error("realloc failed in grow_ids", s->path);
+	s->ids_cap = cap;
+}
+
+/*
+ * wait_timed - wait on cond (with lock held), charging the time to stall
+ */
+static void wait_timed(struct tracestream *s, pthread_cond_t *cond)
+{
+	struct timeval stv, etv;
+
+	gettimeofday(&stv, NULL);
+	pthread_cond_wait(cond, &s->lock);
+	gettimeofday(&etv, NULL);
+	s->stall += (etv.tv_sec - stv.tv_sec) + 1E-6*(etv.tv_usec - stv.tv_usec);
+}
+
+/*
+ * stream_error - Report a Unix-style error while streaming a trace
+ */
+static void stream_error(char *msg, char *path)
+{
+	printf("%s %s: %s\n", msg, path, strerror(errno));
+	exit(1);
+}
@@ -0,0 +1,29 @@
+#ifndef __TRACESTREAM_H_
+#define __TRACESTREAM_H_
+
+/*
+ * tracestream.h - Replay traces that are too large to hold in memory.
+ *
+ * A reader thread decodes the trace file (text or binary) into a
+ * bounded ring of op chunks while the replay thread consumes them.
+ * The id-indexed block arrays of the trace grow on demand, so num_ids
+ * in the header is only a sizing hint.
+ */
+#include "trace.h"
+
+/* Open a trace for streaming; the returned trace has ops == NULL */
+trace_t *open_trace_stream(char *tracedir, char *filename);
+
+/* Stop the reader thread and free the trace */
+void close_trace_stream(trace_t *trace);
+
+/* Restart at op 0 and wait until the ring is full (or holds the whole trace) */
+void rewind_trace_stream(trace_t *trace);
+
+/* Return op i of the current pass, or NULL at the end of the trace */
+traceop_t *trace_stream_op(trace_t *trace, int i);
+
+/* Seconds the replay thread has spent waiting on the reader; reset to 0 */
+double trace_stream_stall(trace_t *trace);
+
+#endif /* __TRACESTREAM_H_ */